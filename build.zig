@@ -40,6 +40,12 @@ pub fn build(b: *std.Build) void {
         .optimize = optimize,
     });
 
+    const digilogic_bench = b.addExecutable(.{
+        .name = "bench",
+        .target = target,
+        .optimize = optimize,
+    });
+
     var cflags = std.ArrayList([]const u8).init(b.allocator);
     cflags.append("-std=gnu11") catch @panic("OOM");
 
@@ -66,13 +72,16 @@ pub fn build(b: *std.Build) void {
                 cflags.append("-fsanitize=address,undefined") catch @panic("OOM");
                 digilogic.addLibraryPath(.{ .cwd_relative = llvm_lib_path });
                 digilogic_test.addLibraryPath(.{ .cwd_relative = llvm_lib_path });
+                digilogic_bench.addLibraryPath(.{ .cwd_relative = llvm_lib_path });
 
                 if (target.result.os.tag.isDarwin()) {
                     digilogic.linkSystemLibrary("clang_rt.asan_osx_dynamic");
                     digilogic_test.linkSystemLibrary("clang_rt.asan_osx_dynamic");
+                    digilogic_bench.linkSystemLibrary("clang_rt.asan_osx_dynamic");
                 } else {
                     digilogic.linkSystemLibrary("clang_rt.asan");
                     digilogic_test.linkSystemLibrary("clang_rt.asan");
+                    digilogic_bench.linkSystemLibrary("clang_rt.asan");
                 }
             } else if (target.result.os.tag.isDarwin() and optimize == .Debug) {
                 @panic("Failed to find LLVM memory sanitizer libraries. Please install LLVM via Homebrew.");
@@ -80,10 +89,17 @@ pub fn build(b: *std.Build) void {
         }
     }
 
+    // 64 bit IDs, see core.h
+    const id64 = b.option(bool, "id64", "Use 64 bit IDs for very large circuits and long editing sessions") orelse false;
+    if (id64) {
+        cflags.append("-DID_64BIT") catch @panic("OOM");
+    }
+
     // add files common to both the main and test executables
     const common_files = &.{
         "core/circuit.c",
         "core/smap.c",
+        "core/arena.c",
         "core/save.c",
         "core/load.c",
         "core/bvh.c",
@@ -113,6 +129,15 @@ pub fn build(b: *std.Build) void {
         .file = b.path("thirdparty/yyjson.c"),
         .flags = cflags.items,
     });
+    digilogic_bench.addCSourceFiles(.{
+        .root = b.path("src"),
+        .files = common_files,
+        .flags = cflags.items,
+    });
+    digilogic_bench.addCSourceFile(.{
+        .file = b.path("thirdparty/yyjson.c"),
+        .flags = cflags.items,
+    });
 
     digilogic.addCSourceFiles(.{
         .root = b.path("src"),
@@ -342,6 +367,8 @@ pub fn build(b: *std.Build) void {
     digilogic.linkSystemLibrary("digilogic_routing");
     digilogic_test.addLibraryPath(rust_lib_path.dirname());
     digilogic_test.linkSystemLibrary("digilogic_routing");
+    digilogic_bench.addLibraryPath(rust_lib_path.dirname());
+    digilogic_bench.linkSystemLibrary("digilogic_routing");
 
     if (target.result.os.tag.isDarwin()) {
         // apple has their own way of doing things
@@ -378,7 +405,30 @@ pub fn build(b: *std.Build) void {
     const test_step = b.step("test", "Build and run tests");
     test_step.dependOn(&test_run.step);
 
-    zcc.createStep(b, "cdb", .{ .targets = &.{ digilogic, digilogic_test } });
+    digilogic_bench.linkLibC();
+
+    digilogic_bench.addCSourceFiles(.{
+        .root = b.path("src"),
+        .files = &.{
+            "bench.c",
+            "core/core_bench.c",
+            "view/view_bench.c",
+            "import/import_bench.c",
+            "ux/ux_bench.c",
+            "render/draw_test.c",
+        },
+        .flags = cflags.items,
+    });
+
+    digilogic_bench.addIncludePath(b.path("src"));
+    digilogic_bench.addIncludePath(b.path("thirdparty"));
+
+    const bench_run = b.addRunArtifact(digilogic_bench);
+
+    const bench_step = b.step("bench", "Build and run benchmarks (use -Doptimize=ReleaseFast)");
+    bench_step.dependOn(&bench_run.step);
+
+    zcc.createStep(b, "cdb", .{ .targets = &.{ digilogic, digilogic_test, digilogic_bench } });
 }
 
 fn build_nvdialog(b: *std.Build, target: std.Build.ResolvedTarget, optimize: std.builtin.OptimizeMode) *std.Build.Step.Compile {
@@ -20,6 +20,7 @@
 #include "autoroute/autoroute.h"
 #include "core/core.h"
 #include "routing/routing.h"
+#include "thread.h"
 #include "view/view.h"
 #include <stdint.h>
 
@@ -30,6 +31,109 @@
 
 #define TIME_SAMPLES 120
 
+// a net of n endpoints and waypoints is a tree of at most 2n wires: each point
+// joins with one wire, and may split the wire it joins in two
+#define RT_WIRES_PER_POINT 2
+// how many vertices to expect per point before a route has shown the real
+// number, and how much room to leave on top of it
+#define RT_VERTICES_PER_POINT 8.0f
+#define RT_VERTEX_HEADROOM 1.5f
+
+// An RT_Graph and what it was last built from. It only needs building again
+// once the anchors or boxes change.
+typedef struct RouteGraph {
+  RT_Graph *graph;
+  bool built;
+  bool minimal;
+  uint32_t version;
+} RouteGraph;
+
+// Everything a single route reads and writes. Routes on the UI thread point it
+// at the router's own arrays, background routes at copies the worker owns.
+typedef struct RouteJob {
+  uint32_t generation;
+  RoutingConfig config;
+  RouteGraph *graph;
+  // the version of the anchors and boxes, and whether the graph was built
+  uint32_t obstacleVersion;
+  bool builtGraph;
+
+  RT_Slice_Anchor anchors;
+  RT_Slice_BoundingBox boxes;
+  RT_Slice_Net nets;
+  RT_Slice_Endpoint endpoints;
+  RT_Slice_Waypoint waypoints;
+
+  // the nets to route again, unless all of them are. the others copy their
+  // wires over from the last route.
+  bool all;
+  const uint32_t *routeNets;
+  size_t routeCount;
+  const RT_NetView *lastViews;
+  const Wire *lastWires;
+  const HMM_Vec2 *lastVertices;
+
+  // one view per net into the wires and vertices
+  RT_NetView *netViews;
+  arr(Wire) wires;
+  arr(HMM_Vec2) vertices;
+
+  // scratch for routing just some of the nets
+  arr(RT_Net) subsetNets;
+  arr(RT_NetView) subsetViews;
+  arr(Wire) subsetWires;
+  arr(HMM_Vec2) subsetVertices;
+
+  // used to size the output up front, and measured again after routing
+  float verticesPerPoint;
+  size_t routedPoints;
+  size_t routedVertices;
+  int retries;
+
+  RT_Result result;
+  uint64_t buildTime;
+  uint64_t routeTime;
+} RouteJob;
+
+// A route for the worker thread, with its own copy of everything it reads.
+typedef struct AsyncRoute {
+  RouteJob job;
+  arr(NetID) netIDs;
+  arr(RT_Net) nets;
+  arr(RT_Endpoint) endpoints;
+  arr(RT_Waypoint) waypoints;
+  arr(RT_Anchor) anchors;
+  arr(RT_BoundingBox) boxes;
+  arr(uint32_t) routeNets;
+  arr(RT_NetView) lastViews;
+  arr(Wire) lastWires;
+  arr(HMM_Vec2) lastVertices;
+  arr(RT_NetView) netViews;
+} AsyncRoute;
+
+typedef struct RouteWorker {
+  thread_ptr_t thread;
+  thread_mutex_t mutex;
+  thread_signal_t wake;
+  thread_signal_t idle;
+  RouteGraph graph;
+  bool quit;
+  bool busy;
+
+  // the newest request waits in pending, replacing any the worker didn't get
+  // to. the newest finished route waits in done until the UI thread polls.
+  bool hasPending;
+  bool hasDone;
+  AsyncRoute pending;
+  AsyncRoute working;
+  AsyncRoute done;
+} RouteWorker;
+
+typedef struct DirtyBox {
+  Box box;
+  uint32_t generation;
+} DirtyBox;
+
 struct AutoRoute {
   Circuit *circuit;
 
@@ -39,17 +143,62 @@ struct AutoRoute {
   RT_Waypoint *waypoints;
   RT_BoundingBox *boxes;
 
+  // one anchor per port, per endpoint that isn't on a port, and per waypoint,
+  // kept up to date by the callbacks. anchorIndex maps the ID of each of them
+  // to its anchor, anchorOwners maps back.
   arr(RT_Anchor) anchors;
+  arr(ID) anchorOwners;
+  struct {
+    ID key;
+    uint32_t value;
+  } *anchorIndex;
 
   arr(Wire) prevWires;
   arr(HMM_Vec2) prevVertices;
 
-  RT_Graph *graph;
+  RouteGraph graph;
+  RouteJob job;
+  RouteWorker *worker;
+
+  // bumped whenever an anchor or box changes
+  uint32_t obstacleVersion;
+
+  // what changed since the last route: nets whose endpoints or waypoints
+  // changed, and the old and new boxes of components that moved, which other
+  // nets may have to route around now. only the nets affected are routed
+  // again, unless routeAll is set. each change is stamped with the generation
+  // of the next route, and forgotten once a route that covers it is
+  // installed.
+  struct {
+    NetID key;
+    uint32_t value;
+  } *dirtyNets;
+  arr(DirtyBox) dirtyBoxes;
+  // nets whose wires changed since autoroute_changed_nets last took them
+  struct {
+    NetID key;
+    char value;
+  } *changedNets;
+  bool routeAll;
+  uint32_t allGeneration;
+  uint32_t generation;
+  RoutingConfig lastConfig;
+
+  // synced with the nets, the bounds of each net's wires as last routed
+  Box *netBounds;
+
+  // the nets picked to be routed again
+  arr(uint32_t) routeNets;
+  arr(uint32_t) installMap;
+  int routedNets;
+  float verticesPerPoint;
 
   int timeIndex;
   int timeLength;
   uint64_t buildTimes[TIME_SAMPLES];
   uint64_t routeTimes[TIME_SAMPLES];
+  int retries[TIME_SAMPLES];
+  bool builtGraphs[TIME_SAMPLES];
 };
 
 void autoroute_global_init() {
@@ -57,16 +206,111 @@ void autoroute_global_init() {
   assert(res == RT_RESULT_SUCCESS);
 }
 
-static void
-autoroute_on_component_update(void *user, ComponentID id, void *ptr) {
-  AutoRoute *ar = user;
-  Component *comp = ptr;
+static void autoroute_dirty_net(AutoRoute *ar, NetID id) {
+  if (circuit_has(ar->circuit, id)) {
+    hmput(ar->dirtyNets, id, ar->generation);
+  }
+}
 
+static void autoroute_dirty_box(AutoRoute *ar, RT_BoundingBox *box) {
+  DirtyBox dirty = {
+    .box =
+      {
+        .center = HMM_V2(box->center.x, box->center.y),
+        .halfSize = HMM_V2(box->half_width + 1, box->half_height + 1),
+      },
+    .generation = ar->generation,
+  };
+  arrput(ar->dirtyBoxes, dirty);
+}
+
+static bool autoroute_same_anchor(RT_Anchor a, RT_Anchor b) {
+  return a.position.x == b.position.x && a.position.y == b.position.y &&
+         a.bounding_box == b.bounding_box &&
+         a.connect_directions == b.connect_directions;
+}
+
+static bool autoroute_same_box(RT_BoundingBox a, RT_BoundingBox b) {
+  return a.center.x == b.center.x && a.center.y == b.center.y &&
+         a.half_width == b.half_width && a.half_height == b.half_height;
+}
+
+static void autoroute_set_anchor(AutoRoute *ar, ID id, RT_Anchor anchor) {
+  ptrdiff_t i = hmgeti(ar->anchorIndex, id);
+  if (i >= 0) {
+    RT_Anchor *existing = &ar->anchors[ar->anchorIndex[i].value];
+    if (!autoroute_same_anchor(*existing, anchor)) {
+      *existing = anchor;
+      ar->obstacleVersion++;
+    }
+    return;
+  }
+  ar->obstacleVersion++;
+  hmput(ar->anchorIndex, id, arrlen(ar->anchors));
+  arrput(ar->anchors, anchor);
+  arrput(ar->anchorOwners, id);
+}
+
+static void autoroute_remove_anchor(AutoRoute *ar, ID id) {
+  ptrdiff_t i = hmgeti(ar->anchorIndex, id);
+  if (i < 0) {
+    return;
+  }
+
+  ar->obstacleVersion++;
+
+  // the last anchor takes its place
+  uint32_t index = ar->anchorIndex[i].value;
+  uint32_t last = arrlen(ar->anchors) - 1;
+  if (index != last) {
+    ar->anchors[index] = ar->anchors[last];
+    ar->anchorOwners[index] = ar->anchorOwners[last];
+    hmput(ar->anchorIndex, ar->anchorOwners[index], index);
+  }
+  arrsetlen(ar->anchors, last);
+  arrsetlen(ar->anchorOwners, last);
+  hmdel(ar->anchorIndex, id);
+}
+
+static void autoroute_sync_port(AutoRoute *ar, PortID id, Port *port) {
+  Component *comp = circuit_component_ptr(ar->circuit, port->component);
+  PortDesc *portDesc =
+    &ar->circuit->componentDescs[comp->desc].ports[port->desc];
+  HMM_Vec2 pos = HMM_AddV2(comp->box.center, port->position);
+  assert(!isnan(pos.X));
+  assert(!isnan(pos.Y));
+
+  autoroute_set_anchor(
+    ar, id,
+    (RT_Anchor){
+      .bounding_box = circuit_index(ar->circuit, port->component),
+      .position =
+        {
+          .x = pos.X,
+          .y = pos.Y,
+        },
+      .connect_directions = portDesc->direction == PORT_IN
+                              ? RT_DIRECTIONS_NEG_X
+                              : RT_DIRECTIONS_POS_X,
+    });
+}
+
+static void autoroute_on_port_update(void *user, PortID id, void *ptr) {
+  autoroute_sync_port(user, id, ptr);
+}
+
+static void autoroute_on_anchor_delete(void *user, ID id, void *ptr) {
+  autoroute_remove_anchor(user, id);
+}
+
+static void
+autoroute_sync_component(AutoRoute *ar, ComponentID id, Component *comp) {
   RT_BoundingBox *box = &ar->boxes[circuit_index(ar->circuit, id)];
   assert(!isnan(comp->box.center.X));
   assert(!isnan(comp->box.center.Y));
   assert(!isnan(comp->box.halfSize.X));
   assert(!isnan(comp->box.halfSize.Y));
+  RT_BoundingBox prevBox = *box;
   *box = (RT_BoundingBox){
     .center =
       {
@@ -76,8 +320,11 @@ autoroute_on_component_update(void *user, ComponentID id, void *ptr) {
     .half_width = (uint16_t)(comp->box.halfSize.X + RT_PADDING) - 1,
     .half_height = (uint16_t)(comp->box.halfSize.Y + RT_PADDING) - 1,
   };
+  if (!autoroute_same_box(prevBox, *box)) {
+    ar->obstacleVersion++;
+  }
   log_debug(
-    "Updating component %d to %f %f", id, comp->box.center.X,
+    "Updating component %" PRIxID " to %f %f", id, comp->box.center.X,
     comp->box.center.Y);
 
   // todo: this belongs in core?
@@ -86,6 +333,7 @@ autoroute_on_component_update(void *user, ComponentID id, void *ptr) {
     Port *port = circuit_port_ptr(ar->circuit, portID);
 
     HMM_Vec2 pos = HMM_AddV2(comp->box.center, port->position);
+    autoroute_sync_port(ar, portID, port);
 
     if (circuit_has(ar->circuit, port->endpoint)) {
       Endpoint *endpoint = circuit_endpoint_ptr(ar->circuit, port->endpoint);
@@ -95,11 +343,51 @@ autoroute_on_component_update(void *user, ComponentID id, void *ptr) {
 
     portID = port->next;
   }
+  autoroute_dirty_box(ar, box);
+}
+
+static void
+autoroute_on_component_create(void *user, ComponentID id, void *ptr) {
+  AutoRoute *ar = user;
+  ar->obstacleVersion++;
+  autoroute_sync_component(ar, id, ptr);
+}
+
+static void
+autoroute_on_component_update(void *user, ComponentID id, void *ptr) {
+  AutoRoute *ar = user;
+  // nets may have routed around where it was
+  autoroute_dirty_box(ar, &ar->boxes[circuit_index(ar->circuit, id)]);
+  autoroute_sync_component(ar, id, ptr);
+}
+
+static void
+autoroute_on_component_delete(void *user, ComponentID id, void *ptr) {
+  AutoRoute *ar = user;
+  uint32_t index = circuit_index(ar->circuit, id);
+  autoroute_dirty_box(ar, &ar->boxes[index]);
+  ar->obstacleVersion++;
+
+  // the last component takes its place, so its ports' anchors need to point
+  // at the new index
+  uint32_t last = circuit_component_len(ar->circuit) - 1;
+  if (index == last) {
+    return;
+  }
+  PortID portID = ar->circuit->components[last].portFirst;
+  while (circuit_has(ar->circuit, portID)) {
+    ptrdiff_t i = hmgeti(ar->anchorIndex, portID);
+    if (i >= 0) {
+      ar->anchors[ar->anchorIndex[i].value].bounding_box = index;
+    }
+    portID = circuit_port_ptr(ar->circuit, portID)->next;
+  }
 }
 
 static void autoroute_on_net_update(void *user, NetID id, void *ptr) {
   AutoRoute *ar = user;
   Net *net = ptr;
+  autoroute_dirty_net(ar, id);
 
   RT_Net *rtNet = &ar->nets[circuit_index(ar->circuit, id)];
   rtNet->first_endpoint = RT_INVALID_ENDPOINT_INDEX;
@@ -110,7 +398,7 @@ static void autoroute_on_net_update(void *user, NetID id, void *ptr) {
   if (circuit_has(ar->circuit, net->waypointFirst)) {
     rtNet->first_waypoint = circuit_index(ar->circuit, net->waypointFirst);
   }
-  log_debug("Updating net %x", id);
+  log_debug("Updating net %" PRIxID "", id);
 }
 
 static void autoroute_on_endpoint_update(void *user, EndpointID id, void *ptr) {
@@ -131,12 +419,28 @@ static void autoroute_on_endpoint_update(void *user, EndpointID id, void *ptr) {
   }
 
   log_debug(
-    "Setting endpoint %d to %f %f", id, endpoint->position.X,
+    "Setting endpoint %" PRIxID " to %f %f", id, endpoint->position.X,
     endpoint->position.Y);
   rtEndpoint->position = (RT_Point){
     .x = endpoint->position.X,
     .y = endpoint->position.Y,
   };
+
+  // endpoints on a port use the port's anchor
+  if (circuit_has(ar->circuit, endpoint->port)) {
+    autoroute_remove_anchor(ar, id);
+  } else {
+    assert(!isnan(endpoint->position.X));
+    assert(!isnan(endpoint->position.Y));
+    autoroute_set_anchor(
+      ar, id,
+      (RT_Anchor){
+        .position = rtEndpoint->position,
+        .connect_directions = RT_DIRECTIONS_ALL,
+        .bounding_box = RT_INVALID_BOUNDING_BOX_INDEX,
+      });
+  }
+
   autoroute_on_net_update(
     ar, endpoint->net, circuit_net_ptr(ar->circuit, endpoint->net));
 }
@@ -162,27 +466,55 @@ static void autoroute_on_waypoint_update(void *user, WaypointID id, void *ptr) {
     .x = waypoint->position.X,
     .y = waypoint->position.Y,
   };
+  autoroute_set_anchor(
+    ar, id,
+    (RT_Anchor){
+      .position = rtWaypoint->position,
+      .connect_directions = RT_DIRECTIONS_ALL,
+      .bounding_box = RT_INVALID_BOUNDING_BOX_INDEX,
+    });
   log_debug(
-    "Setting waypoint %x to %f %f", id, waypoint->position.X,
+    "Setting waypoint %" PRIxID " to %f %f", id, waypoint->position.X,
     waypoint->position.Y);
   autoroute_on_net_update(
     ar, waypoint->net, circuit_net_ptr(ar->circuit, waypoint->net));
 }
 
+static void autoroute_on_endpoint_delete(void *user, EndpointID id, void *ptr) {
+  Endpoint *endpoint = ptr;
+  autoroute_remove_anchor(user, id);
+  autoroute_dirty_net(user, endpoint->net);
+}
+
+static void autoroute_on_waypoint_delete(void *user, WaypointID id, void *ptr) {
+  Waypoint *waypoint = ptr;
+  autoroute_remove_anchor(user, id);
+  autoroute_dirty_net(user, waypoint->net);
+}
+
 AutoRoute *autoroute_create(Circuit *circuit) {
   AutoRoute *ar = malloc(sizeof(AutoRoute));
   *ar = (AutoRoute){
     .circuit = circuit,
+    .routeAll = true,
+    .verticesPerPoint = RT_VERTICES_PER_POINT,
   };
   smap_add_synced_array(
     &circuit->sm.components, (void **)&ar->boxes, sizeof(*ar->boxes));
-  circuit_on_component_create(circuit, ar, autoroute_on_component_update);
+  circuit_on_component_create(circuit, ar, autoroute_on_component_create);
   circuit_on_component_update(circuit, ar, autoroute_on_component_update);
+  circuit_on_component_delete(circuit, ar, autoroute_on_component_delete);
+
+  circuit_on_port_create(circuit, ar, autoroute_on_port_update);
+  circuit_on_port_update(circuit, ar, autoroute_on_port_update);
+  circuit_on_port_delete(circuit, ar, autoroute_on_anchor_delete);
 
   smap_add_synced_array(
     &circuit->sm.nets, (void **)&ar->nets, sizeof(*ar->nets));
   smap_add_synced_array(
     &circuit->sm.nets, (void **)&ar->netViews, sizeof(*ar->netViews));
+  smap_add_synced_array(
+    &circuit->sm.nets, (void **)&ar->netBounds, sizeof(*ar->netBounds));
   circuit_on_net_create(circuit, ar, autoroute_on_net_update);
   circuit_on_net_update(circuit, ar, autoroute_on_net_update);
 
@@ -190,153 +522,84 @@ AutoRoute *autoroute_create(Circuit *circuit) {
     &circuit->sm.endpoints, (void **)&ar->endpoints, sizeof(*ar->endpoints));
   circuit_on_endpoint_create(circuit, ar, autoroute_on_endpoint_update);
   circuit_on_endpoint_update(circuit, ar, autoroute_on_endpoint_update);
+  circuit_on_endpoint_delete(circuit, ar, autoroute_on_endpoint_delete);
 
   smap_add_synced_array(
     &circuit->sm.waypoints, (void **)&ar->waypoints, sizeof(*ar->waypoints));
   circuit_on_waypoint_create(circuit, ar, autoroute_on_waypoint_update);
   circuit_on_waypoint_update(circuit, ar, autoroute_on_waypoint_update);
+  circuit_on_waypoint_delete(circuit, ar, autoroute_on_waypoint_delete);
 
-  RT_Result res = RT_graph_new(&ar->graph);
+  RT_Result res = RT_graph_new(&ar->graph.graph);
   assert(res == RT_RESULT_SUCCESS);
 
   return ar;
 }
 
-void autoroute_free(AutoRoute *ar) {
-  arrfree(ar->anchors);
-
-  RT_Result res = RT_graph_free(ar->graph);
-  assert(res == RT_RESULT_SUCCESS);
-  free(ar);
+static void autoroute_free_job(RouteJob *job) {
+  arrfree(job->wires);
+  arrfree(job->vertices);
+  arrfree(job->subsetNets);
+  arrfree(job->subsetViews);
+  arrfree(job->subsetWires);
+  arrfree(job->subsetVertices);
 }
 
-static void autoroute_update_anchors(AutoRoute *ar) {
-  arrsetlen(ar->anchors, 0);
-  for (int i = 0; i < circuit_component_len(ar->circuit); i++) {
-    Component *comp = &ar->circuit->components[i];
-    Box box = comp->box;
-
-    float cx = box.center.X;
-    float cy = box.center.Y;
-
-    PortID portID = comp->portFirst;
-    while (circuit_has(ar->circuit, portID)) {
-      Port *port = circuit_port_ptr(ar->circuit, portID);
-
-      PortDesc *portDesc =
-        &ar->circuit->componentDescs[comp->desc].ports[port->desc];
-      RT_Directions directions = portDesc->direction == PORT_IN
-                                   ? RT_DIRECTIONS_NEG_X
-                                   : RT_DIRECTIONS_POS_X;
-
-      RT_Anchor anchor = (RT_Anchor){
-        .bounding_box = i,
-        .position =
-          {
-            .x = cx + port->position.X,
-            .y = cy + port->position.Y,
-          },
-        .connect_directions = directions,
-      };
-      arrput(ar->anchors, anchor);
-      assert(!isnan(cx + port->position.X));
-      assert(!isnan(cy + port->position.Y));
-      assert(anchor.position.x != 0 || anchor.position.y != 0);
-
-      if (circuit_has(ar->circuit, port->endpoint)) {
-        RT_Endpoint *endpoint =
-          &ar->endpoints[circuit_index(ar->circuit, port->endpoint)];
-        assert(endpoint->position.x == anchor.position.x);
-        assert(endpoint->position.y == anchor.position.y);
-      }
-
-      portID = port->next;
-    }
-  }
-  for (int i = 0; i < circuit_endpoint_len(ar->circuit); i++) {
-    Endpoint *endpoint = &ar->circuit->endpoints[i];
-    if (circuit_has(ar->circuit, endpoint->port)) {
-      continue;
-    }
-
-    RT_BoundingBoxIndex boundingBox = RT_INVALID_BOUNDING_BOX_INDEX;
-    RT_Directions connectDirections = RT_DIRECTIONS_ALL;
-
-    // for (int j = 0; j < circuit_component_len(ar->circuit); j++) {
-    //   Component *comp = &ar->circuit->components[j];
-    //   Box box = comp->box;
-
-    //   if (box_intersect_point(box, endpoint->position)) {
-    //     boundingBox = j;
-
-    //     if (endpoint->position.X < box.center.X) {
-    //       connectDirections = RT_DIRECTIONS_NEG_X;
-    //     } else {
-    //       connectDirections = RT_DIRECTIONS_POS_X;
-    //     }
-
-    //     break;
-    //   }
-    // }
-
-    RT_Anchor anchor = (RT_Anchor){
-      .position =
-        {
-          .x = endpoint->position.X,
-          .y = endpoint->position.Y,
-        },
-      .connect_directions = connectDirections,
-      .bounding_box = boundingBox,
-    };
-    arrput(ar->anchors, anchor);
-    assert(!isnan(endpoint->position.X));
-    assert(!isnan(endpoint->position.Y));
-    assert(anchor.position.x != 0 || anchor.position.y != 0);
-  }
-  for (int i = 0; i < circuit_waypoint_len(ar->circuit); i++) {
-    Waypoint *waypoint = &ar->circuit->waypoints[i];
-    RT_Anchor anchor = (RT_Anchor){
-      .position =
-        {
-          .x = waypoint->position.X,
-          .y = waypoint->position.Y,
-        },
-      .connect_directions = RT_DIRECTIONS_ALL,
-      .bounding_box = RT_INVALID_BOUNDING_BOX_INDEX,
-    };
-    arrput(ar->anchors, anchor);
-  }
+static void autoroute_free_async(AsyncRoute *req) {
+  autoroute_free_job(&req->job);
+  arrfree(req->netIDs);
+  arrfree(req->nets);
+  arrfree(req->endpoints);
+  arrfree(req->waypoints);
+  arrfree(req->anchors);
+  arrfree(req->boxes);
+  arrfree(req->routeNets);
+  arrfree(req->lastViews);
+  arrfree(req->lastWires);
+  arrfree(req->lastVertices);
+  arrfree(req->netViews);
 }
 
-static void autoroute_prepare_routing(AutoRoute *ar, RoutingConfig config) {
-  autoroute_update_anchors(ar);
-
-  if (arrlen(ar->anchors) == 0) {
-    return;
-  }
-
-  RT_Result res = RT_graph_build(
-    ar->graph, (RT_Slice_Anchor){ar->anchors, arrlen(ar->anchors)},
-    (RT_Slice_BoundingBox){ar->boxes, circuit_component_len(ar->circuit)},
-    config.minimizeGraph);
-  if (res != RT_RESULT_SUCCESS) {
-    log_error("Error building graph: %d", res);
-  }
+static void autoroute_stop_worker(RouteWorker *worker) {
+  thread_mutex_lock(&worker->mutex);
+  worker->quit = true;
+  thread_mutex_unlock(&worker->mutex);
+  thread_signal_raise(&worker->wake);
+  thread_destroy(worker->thread);
+
+  autoroute_free_async(&worker->pending);
+  autoroute_free_async(&worker->working);
+  autoroute_free_async(&worker->done);
+  RT_Result res = RT_graph_free(worker->graph.graph);
   assert(res == RT_RESULT_SUCCESS);
+  thread_signal_term(&worker->wake);
+  thread_signal_term(&worker->idle);
+  thread_mutex_term(&worker->mutex);
+  free(worker);
+}
 
-  if (arrlen(ar->circuit->vertices) == 0) {
-    arrsetlen(ar->circuit->vertices, 1024);
-    arrsetlen(ar->prevVertices, 1024);
-  }
-  if (arrlen(ar->circuit->wires) == 0) {
-    arrsetlen(ar->circuit->wires, 1024);
-    arrsetlen(ar->prevWires, 1024);
+void autoroute_free(AutoRoute *ar) {
+  if (ar->worker) {
+    autoroute_stop_worker(ar->worker);
   }
+  autoroute_free_job(&ar->job);
+  arrfree(ar->anchors);
+  arrfree(ar->anchorOwners);
+  hmfree(ar->anchorIndex);
+  arrfree(ar->prevWires);
+  arrfree(ar->prevVertices);
+  hmfree(ar->dirtyNets);
+  arrfree(ar->dirtyBoxes);
+  hmfree(ar->changedNets);
+  arrfree(ar->routeNets);
+  arrfree(ar->installMap);
+
+  RT_Result res = RT_graph_free(ar->graph.graph);
+  assert(res == RT_RESULT_SUCCESS);
+  free(ar);
+}
 
-  assert(ar->graph);
-  assert(ar->circuit->wires);
-  assert(ar->circuit->vertices);
-
+static void autoroute_prepare_routing(AutoRoute *ar) {
   // todo: remove this checking code
   for (int netIdx = 0; netIdx < circuit_net_len(ar->circuit); netIdx++) {
     RT_Net *net = &ar->nets[netIdx];
@@ -357,11 +620,42 @@ static void autoroute_prepare_routing(AutoRoute *ar, RoutingConfig config) {
   }
 }
 
+// Builds the graph, unless it was already built from the same anchors and
+// boxes. Returns true if it had to be built.
+static bool autoroute_build_graph(
+  RouteGraph *graph, RT_Slice_Anchor anchors, RT_Slice_BoundingBox boxes,
+  RoutingConfig config, uint32_t version) {
+  if (anchors.len == 0) {
+    return false;
+  }
+  if (
+    graph->built && graph->version == version &&
+    graph->minimal == config.minimizeGraph) {
+    return false;
+  }
+
+  RT_Result res =
+    RT_graph_build(graph->graph, anchors, boxes, config.minimizeGraph);
+  if (res != RT_RESULT_SUCCESS) {
+    log_error("Error building graph: %d", res);
+  }
+  assert(res == RT_RESULT_SUCCESS);
+  graph->built = true;
+  graph->minimal = config.minimizeGraph;
+  graph->version = version;
+  return true;
+}
+
 bool autoroute_dump_routing_data(
   AutoRoute *ar, RoutingConfig config, const char *filename) {
-  autoroute_prepare_routing(ar, config);
+  autoroute_wait(ar);
+  autoroute_prepare_routing(ar);
+  autoroute_build_graph(
+    &ar->graph, (RT_Slice_Anchor){ar->anchors, arrlen(ar->anchors)},
+    (RT_Slice_BoundingBox){ar->boxes, circuit_component_len(ar->circuit)},
+    config, ar->obstacleVersion);
   RT_Result res = RT_graph_serialize_connect_nets_query(
-    ar->graph, (RT_Slice_Net){ar->nets, circuit_net_len(ar->circuit)},
+    ar->graph.graph, (RT_Slice_Net){ar->nets, circuit_net_len(ar->circuit)},
     (RT_Slice_Endpoint){ar->endpoints, circuit_endpoint_len(ar->circuit)},
     (RT_Slice_Waypoint){ar->waypoints, circuit_waypoint_len(ar->circuit)},
     config.performCentering, filename);
@@ -372,47 +666,53 @@ bool autoroute_dump_routing_data(
   return true;
 }
 
-void autoroute_route(AutoRoute *ar, RoutingConfig config) {
-  uint64_t start = stm_now();
-
-  autoroute_prepare_routing(ar, config);
-
-  uint64_t graphBuild = stm_since(start);
-  uint64_t pathFindStart = stm_now();
-
-  {
-    // swap wires
-    arr(Wire) tmp = ar->prevWires;
-    ar->prevWires = ar->circuit->wires;
-    ar->circuit->wires = tmp;
+// Makes the vertices and wires big enough for the nets to be routed in one go.
+// The router can't say how much room it needs before it is done, so the
+// wires are sized to the most a net can need, and the vertices to what the
+// last routes needed per point, plus some room to spare.
+static void autoroute_size_output(
+  RouteJob *job, RT_Slice_Net nets, arr(HMM_Vec2) * vertices,
+  arr(Wire) * wires) {
+  size_t points = 0;
+  for (size_t i = 0; i < nets.len; i++) {
+    RT_EndpointIndex endpoint = nets.ptr[i].first_endpoint;
+    while (endpoint != RT_INVALID_ENDPOINT_INDEX) {
+      points++;
+      endpoint = job->endpoints.ptr[endpoint].next;
+    }
+    RT_WaypointIndex waypoint = nets.ptr[i].first_waypoint;
+    while (waypoint != RT_INVALID_WAYPOINT_INDEX) {
+      points++;
+      waypoint = job->waypoints.ptr[waypoint].next;
+    }
   }
+  job->routedPoints += points;
 
-  {
-    // swap vertices
-    arr(HMM_Vec2) tmp = ar->prevVertices;
-    ar->prevVertices = ar->circuit->vertices;
-    ar->circuit->vertices = tmp;
+  size_t wireCount = points * RT_WIRES_PER_POINT;
+  size_t vertexCount =
+    (size_t)(points * job->verticesPerPoint * RT_VERTEX_HEADROOM);
+  if (arrlen(*wires) < wireCount) {
+    arrsetlen(*wires, wireCount);
+  }
+  if (arrlen(*vertices) < vertexCount) {
+    arrsetlen(*vertices, vertexCount);
   }
+}
+
+// Connects the nets into the vertices and wires. If the output doesn't fit
+// after all, it grows and the router starts over.
+static RT_Result autoroute_connect(
+  RouteJob *job, RT_Slice_Net nets, RT_NetView *netViews,
+  arr(HMM_Vec2) * vertices, arr(Wire) * wires) {
+  autoroute_size_output(job, nets, vertices, wires);
 
-  RT_Result res;
   for (;;) {
-    res = RT_graph_connect_nets(
-      ar->graph, (RT_Slice_Net){ar->nets, circuit_net_len(ar->circuit)},
-      (RT_Slice_Endpoint){ar->endpoints, circuit_endpoint_len(ar->circuit)},
-      (RT_Slice_Waypoint){ar->waypoints, circuit_waypoint_len(ar->circuit)},
-      (RT_MutSlice_Vertex){
-        (RT_Vertex *)ar->circuit->vertices,
-        arrlen(ar->circuit->vertices),
-      },
-      (RT_MutSlice_WireView){
-        (RT_WireView *)ar->circuit->wires,
-        arrlen(ar->circuit->wires),
-      },
-      (RT_MutSlice_NetView){
-        ar->netViews,
-        circuit_net_len(ar->circuit),
-      },
-      config.performCentering);
+    RT_Result res = RT_graph_connect_nets(
+      job->graph->graph, nets, job->endpoints, job->waypoints,
+      (RT_MutSlice_Vertex){(RT_Vertex *)*vertices, arrlen(*vertices)},
+      (RT_MutSlice_WireView){(RT_WireView *)*wires, arrlen(*wires)},
+      (RT_MutSlice_NetView){netViews, nets.len},
+      job->config.performCentering);
     switch (res) {
     case RT_RESULT_SUCCESS:
       break;
@@ -429,61 +729,353 @@ void autoroute_route(AutoRoute *ar, RoutingConfig config) {
       log_error("Invalid argument error");
       break;
     case RT_RESULT_VERTEX_BUFFER_OVERFLOW_ERROR:
-      arrsetlen(ar->circuit->vertices, arrlen(ar->circuit->vertices) * 2);
-      arrsetlen(ar->prevVertices, arrlen(ar->prevVertices) * 2);
+      arrsetlen(*vertices, HMM_MAX(arrlen(*vertices) * 2, 1024));
+      job->retries++;
       continue;
     case RT_RESULT_WIRE_VIEW_BUFFER_OVERFLOW_ERROR:
-      arrsetlen(ar->circuit->wires, arrlen(ar->circuit->wires) * 2);
-      arrsetlen(ar->prevWires, arrlen(ar->prevWires) * 2);
+      arrsetlen(*wires, HMM_MAX(arrlen(*wires) * 2, 1024));
+      job->retries++;
       continue;
     }
+
+    if (res == RT_RESULT_SUCCESS) {
+      for (size_t i = 0; i < nets.len; i++) {
+        const Wire *netWires = &(*wires)[netViews[i].wire_offset];
+        for (size_t j = 0; j < netViews[i].wire_count; j++) {
+          job->routedVertices +=
+            circuit_wire_vertex_count(netWires[j].vertexCount);
+        }
+      }
+    }
+    return res;
+  }
+}
+
+// Picks the nets that have to be routed again into routeNets. Returns true if
+// all the nets should be routed instead. The changes stay tracked until the
+// route that covers them is installed.
+static bool autoroute_select_nets(AutoRoute *ar, RoutingConfig config) {
+  size_t netCount = circuit_net_len(ar->circuit);
+  if (
+    ar->lastConfig.minimizeGraph != config.minimizeGraph ||
+    ar->lastConfig.performCentering != config.performCentering) {
+    ar->routeAll = true;
+    ar->allGeneration = ar->generation;
+  }
+  ar->lastConfig = config;
+  bool all = ar->routeAll;
+
+  arrsetlen(ar->routeNets, 0);
+  for (size_t i = 0; i < netCount && !all; i++) {
+    bool affected = hmgeti(ar->dirtyNets, circuit_net_id(ar->circuit, i)) >= 0;
+    for (size_t j = 0; j < arrlen(ar->dirtyBoxes) && !affected; j++) {
+      affected = box_intersect_box(ar->netBounds[i], ar->dirtyBoxes[j].box);
+    }
+    if (affected) {
+      arrput(ar->routeNets, i);
+    }
+  }
+
+  // past a point splicing costs more than it saves
+  return all || arrlen(ar->routeNets) * 2 > netCount;
+}
+
+// Routes just the nets in routeNets, and splices their new wires together
+// with the wires the other nets kept from the last route.
+static RT_Result autoroute_route_nets(RouteJob *job) {
+  size_t count = job->routeCount;
+  arrsetlen(job->subsetNets, count);
+  arrsetlen(job->subsetViews, count);
+  for (size_t i = 0; i < count; i++) {
+    job->subsetNets[i] = job->nets.ptr[job->routeNets[i]];
+  }
+
+  if (count > 0) {
+    RT_Result res = autoroute_connect(
+      job, (RT_Slice_Net){job->subsetNets, count}, job->subsetViews,
+      &job->subsetVertices, &job->subsetWires);
+    if (res != RT_RESULT_SUCCESS) {
+      return res;
+    }
+  }
+
+  size_t wireLen = 0;
+  size_t vertexLen = 0;
+  size_t next = 0;
+  for (size_t i = 0; i < job->nets.len; i++) {
+    const Wire *wires;
+    const HMM_Vec2 *vertices;
+    size_t wireCount;
+    if (next < count && job->routeNets[next] == i) {
+      RT_NetView *view = &job->subsetViews[next++];
+      wires = &job->subsetWires[view->wire_offset];
+      vertices = &job->subsetVertices[view->vertex_offset];
+      wireCount = view->wire_count;
+    } else {
+      const RT_NetView *view = &job->lastViews[i];
+      wires = &job->lastWires[view->wire_offset];
+      vertices = &job->lastVertices[view->vertex_offset];
+      wireCount = view->wire_count;
+    }
+
+    size_t vertexCount = 0;
+    for (size_t j = 0; j < wireCount; j++) {
+      vertexCount += circuit_wire_vertex_count(wires[j].vertexCount);
+    }
+
+    if (arrlen(job->wires) < wireLen + wireCount) {
+      arrsetlen(
+        job->wires, HMM_MAX(arrlen(job->wires) * 2, wireLen + wireCount));
+    }
+    if (arrlen(job->vertices) < vertexLen + vertexCount) {
+      arrsetlen(
+        job->vertices,
+        HMM_MAX(arrlen(job->vertices) * 2, vertexLen + vertexCount));
+    }
+    memcpy(&job->wires[wireLen], wires, wireCount * sizeof(Wire));
+    memcpy(
+      &job->vertices[vertexLen], vertices, vertexCount * sizeof(HMM_Vec2));
+
+    // lastViews may be the same array as netViews, so this has to come last
+    job->netViews[i] = (RT_NetView){
+      .wire_offset = wireLen,
+      .wire_count = wireCount,
+      .vertex_offset = vertexLen,
+    };
+    wireLen += wireCount;
+    vertexLen += vertexCount;
+  }
+
+  return RT_RESULT_SUCCESS;
+}
+
+static void autoroute_log_serialize_error(RT_Result serres) {
+  switch (serres) {
+  case RT_RESULT_NULL_POINTER_ERROR:
+    log_error("error serializing graph: null pointer error");
+    break;
+  case RT_RESULT_INVALID_OPERATION_ERROR:
+    log_error("error serializing graph: serialization failed (invalid "
+              "operation error)");
+    break;
+  case RT_RESULT_INVALID_ARGUMENT_ERROR:
+    log_error("error serializing graph: file path contains illegal UTF-8 "
+              "(invalid argument error)");
+    break;
+  case RT_RESULT_IO_ERROR:
+    log_error("error serializing graph: IO error");
+    break;
+  default:
+    log_error("error serializing graph: %d", serres);
     break;
   }
+}
 
-  if (res != RT_RESULT_SUCCESS) {
-    RT_Result serres = RT_graph_serialize(ar->graph, "graph.dump");
+// Builds the graph and routes the job. Only touches the job, so it can run on
+// the worker thread.
+static void autoroute_run(RouteJob *job) {
+  uint64_t start = stm_now();
+  job->routedPoints = 0;
+  job->routedVertices = 0;
+  job->retries = 0;
+
+  job->builtGraph = autoroute_build_graph(
+    job->graph, job->anchors, job->boxes, job->config, job->obstacleVersion);
+
+  job->buildTime = stm_since(start);
+  uint64_t pathFindStart = stm_now();
+
+  if (job->all) {
+    job->result = autoroute_connect(
+      job, job->nets, job->netViews, &job->vertices, &job->wires);
+  } else {
+    job->result = autoroute_route_nets(job);
+  }
+
+  if (job->result != RT_RESULT_SUCCESS) {
+    RT_Result serres = RT_graph_serialize(job->graph->graph, "graph.dump");
     if (serres != RT_RESULT_SUCCESS) {
-      switch (serres) {
-      case RT_RESULT_NULL_POINTER_ERROR:
-        log_error("error serializing graph: null pointer error");
-        break;
-      case RT_RESULT_INVALID_OPERATION_ERROR:
-        log_error("error serializing graph: serialization failed (invalid "
-                  "operation error)");
-        break;
-      case RT_RESULT_INVALID_ARGUMENT_ERROR:
-        log_error("error serializing graph: file path contains illegal UTF-8 "
-                  "(invalid argument error)");
-        break;
-      case RT_RESULT_IO_ERROR:
-        log_error("error serializing graph: IO error");
-        break;
-      default:
-        log_error("error serializing graph: %d", serres);
-        break;
-      }
+      autoroute_log_serialize_error(serres);
     }
   }
 
-  assert(res == RT_RESULT_SUCCESS);
+  job->routeTime = stm_since(pathFindStart);
+}
+
+// Called for each net whose wires a route replaced.
+static void autoroute_update_net_bounds(AutoRoute *ar, size_t index) {
+  hmput(ar->changedNets, circuit_net_id(ar->circuit, index), 1);
+
+  Net *net = &ar->circuit->nets[index];
+  size_t vertexCount = 0;
+  for (size_t i = 0; i < net->wireCount; i++) {
+    vertexCount += circuit_wire_vertex_count(
+      ar->circuit->wires[net->wireOffset + i].vertexCount);
+  }
+
+  if (vertexCount == 0) {
+    ar->netBounds[index] = (Box){0};
+    return;
+  }
+
+  HMM_Vec2 *vertices = &ar->circuit->vertices[net->vertexOffset];
+  HMM_Vec2 tl = vertices[0];
+  HMM_Vec2 br = vertices[0];
+  for (size_t i = 1; i < vertexCount; i++) {
+    tl = HMM_V2(HMM_MIN(tl.X, vertices[i].X), HMM_MIN(tl.Y, vertices[i].Y));
+    br = HMM_V2(HMM_MAX(br.X, vertices[i].X), HMM_MAX(br.Y, vertices[i].Y));
+  }
+  ar->netBounds[index] = box_from_tlbr(tl, br);
+}
 
-  uint64_t pathFind = stm_since(pathFindStart);
+// Points the nets at the wires of a finished route, which must already be in
+// the circuit, and forgets the changes the route covered. netIDs are the nets
+// the job was made from, or NULL if the nets haven't changed since.
+static void
+autoroute_install(AutoRoute *ar, RouteJob *job, const NetID *netIDs) {
+  assert(job->result == RT_RESULT_SUCCESS);
+
+  size_t netCount = circuit_net_len(ar->circuit);
+  arrsetlen(ar->installMap, netCount);
+  for (size_t i = 0; i < netCount; i++) {
+    ar->installMap[i] = netIDs ? UINT32_MAX : i;
+  }
+  for (size_t i = 0; netIDs && i < job->nets.len; i++) {
+    if (circuit_has(ar->circuit, netIDs[i])) {
+      ar->installMap[circuit_index(ar->circuit, netIDs[i])] = i;
+    }
+  }
+
+  for (size_t i = 0; i < netCount; i++) {
+    // nets made after the job was sent off have no wires until the next one
+    RT_NetView view = {0};
+    if (ar->installMap[i] != UINT32_MAX) {
+      view = job->netViews[ar->installMap[i]];
+    }
+    ar->netViews[i] = view;
 
-  for (int i = 0; i < circuit_net_len(ar->circuit); i++) {
-    RT_NetView *rtNetView = &ar->netViews[i];
     Net *net = &ar->circuit->nets[i];
+    if (
+      net->wireOffset != view.wire_offset ||
+      net->wireCount != view.wire_count ||
+      net->vertexOffset != view.vertex_offset) {
+      net->wireOffset = view.wire_offset;
+      net->wireCount = view.wire_count;
+      net->vertexOffset = view.vertex_offset;
+      circuit_touch_index(ar->circuit, ID_NET, i);
+    }
 
-    net->wireOffset = rtNetView->wire_offset;
-    net->wireCount = rtNetView->wire_count;
-    net->vertexOffset = rtNetView->vertex_offset;
+    if (job->all || ar->installMap[i] == UINT32_MAX) {
+      autoroute_update_net_bounds(ar, i);
+    }
+  }
+  for (size_t i = 0; !job->all && i < job->routeCount; i++) {
+    uint32_t index = job->routeNets[i];
+    if (netIDs) {
+      if (!circuit_has(ar->circuit, netIDs[index])) {
+        continue;
+      }
+      index = circuit_index(ar->circuit, netIDs[index]);
+    }
+    autoroute_update_net_bounds(ar, index);
   }
 
-  ar->buildTimes[ar->timeIndex] = graphBuild;
-  ar->routeTimes[ar->timeIndex] = pathFind;
+  // changes made after the job was sent off stay for the next route
+  for (ptrdiff_t i = hmlen(ar->dirtyNets) - 1; i >= 0; i--) {
+    if (ar->dirtyNets[i].value <= job->generation) {
+      hmdel(ar->dirtyNets, ar->dirtyNets[i].key);
+    }
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < arrlen(ar->dirtyBoxes); i++) {
+    if (ar->dirtyBoxes[i].generation > job->generation) {
+      ar->dirtyBoxes[kept++] = ar->dirtyBoxes[i];
+    }
+  }
+  arrsetlen(ar->dirtyBoxes, kept);
+  if (job->all && ar->allGeneration <= job->generation) {
+    ar->routeAll = false;
+  }
+
+  ar->routedNets = job->all ? job->nets.len : job->routeCount;
+  if (job->routedPoints > 0) {
+    // rise right away, but settle down slowly so that one route of simple nets
+    // doesn't leave the next big one short
+    float measured = (float)job->routedVertices / job->routedPoints;
+    ar->verticesPerPoint =
+      HMM_MAX(measured, (ar->verticesPerPoint + measured) / 2);
+  }
+  ar->retries[ar->timeIndex] = job->retries;
+  ar->builtGraphs[ar->timeIndex] = job->builtGraph;
+  ar->buildTimes[ar->timeIndex] = job->buildTime;
+  ar->routeTimes[ar->timeIndex] = job->routeTime;
   ar->timeIndex = (ar->timeIndex + 1) % TIME_SAMPLES;
   if (ar->timeLength < TIME_SAMPLES) {
     ar->timeLength++;
   }
+}
+
+void autoroute_route(AutoRoute *ar, RoutingConfig config) {
+  // a background route finishing later would undo this one
+  autoroute_wait(ar);
+
+  autoroute_prepare_routing(ar);
+  bool all = autoroute_select_nets(ar, config);
+
+  {
+    // swap wires
+    arr(Wire) tmp = ar->prevWires;
+    ar->prevWires = ar->circuit->wires;
+    ar->circuit->wires = tmp;
+  }
+
+  {
+    // swap vertices
+    arr(HMM_Vec2) tmp = ar->prevVertices;
+    ar->prevVertices = ar->circuit->vertices;
+    ar->circuit->vertices = tmp;
+  }
+
+  RouteJob *job = &ar->job;
+  job->generation = ar->generation++;
+  job->config = config;
+  job->verticesPerPoint = ar->verticesPerPoint;
+  job->graph = &ar->graph;
+  job->obstacleVersion = ar->obstacleVersion;
+  job->anchors = (RT_Slice_Anchor){ar->anchors, arrlen(ar->anchors)};
+  job->boxes =
+    (RT_Slice_BoundingBox){ar->boxes, circuit_component_len(ar->circuit)};
+  job->nets = (RT_Slice_Net){ar->nets, circuit_net_len(ar->circuit)};
+  job->endpoints =
+    (RT_Slice_Endpoint){ar->endpoints, circuit_endpoint_len(ar->circuit)};
+  job->waypoints =
+    (RT_Slice_Waypoint){ar->waypoints, circuit_waypoint_len(ar->circuit)};
+  job->all = all;
+  job->routeNets = ar->routeNets;
+  job->routeCount = arrlen(ar->routeNets);
+  job->lastViews = ar->netViews;
+  job->lastWires = ar->prevWires;
+  job->lastVertices = ar->prevVertices;
+  job->netViews = ar->netViews;
+  job->wires = ar->circuit->wires;
+  job->vertices = ar->circuit->vertices;
+
+  autoroute_run(job);
+
+  ar->circuit->wires = job->wires;
+  ar->circuit->vertices = job->vertices;
+  job->wires = NULL;
+  job->vertices = NULL;
+
+  // keep both buffers the same size so the next route doesn't have to grow
+  if (arrlen(ar->prevWires) < arrlen(ar->circuit->wires)) {
+    arrsetlen(ar->prevWires, arrlen(ar->circuit->wires));
+  }
+  if (arrlen(ar->prevVertices) < arrlen(ar->circuit->vertices)) {
+    arrsetlen(ar->prevVertices, arrlen(ar->circuit->vertices));
+  }
+
+  autoroute_install(ar, job, NULL);
 
   // RouteTimeStats stats = autoroute_stats(ar);
 
@@ -495,6 +1087,174 @@ void autoroute_route(AutoRoute *ar, RoutingConfig config) {
   //   stm_ms(stats.route.avg), stm_ms(stats.route.max), ar->timeLength);
 }
 
+static int autoroute_worker(void *user) {
+  RouteWorker *worker = user;
+  for (;;) {
+    thread_signal_wait(&worker->wake, THREAD_SIGNAL_WAIT_INFINITE);
+
+    thread_mutex_lock(&worker->mutex);
+    while (worker->hasPending && !worker->quit) {
+      AsyncRoute tmp = worker->working;
+      worker->working = worker->pending;
+      worker->pending = tmp;
+      worker->hasPending = false;
+      worker->busy = true;
+      thread_mutex_unlock(&worker->mutex);
+
+      autoroute_run(&worker->working.job);
+
+      // a finished route nobody picked up yet is simply replaced, this one
+      // covers everything it did
+      thread_mutex_lock(&worker->mutex);
+      tmp = worker->done;
+      worker->done = worker->working;
+      worker->working = tmp;
+      worker->hasDone = true;
+    }
+    worker->busy = false;
+    bool quit = worker->quit;
+    thread_mutex_unlock(&worker->mutex);
+    thread_signal_raise(&worker->idle);
+
+    if (quit) {
+      return 0;
+    }
+  }
+}
+
+static void autoroute_start_worker(AutoRoute *ar) {
+  RouteWorker *worker = calloc(1, sizeof(RouteWorker));
+  thread_mutex_init(&worker->mutex);
+  thread_signal_init(&worker->wake);
+  thread_signal_init(&worker->idle);
+  RT_Result res = RT_graph_new(&worker->graph.graph);
+  assert(res == RT_RESULT_SUCCESS);
+  worker->thread =
+    thread_create(autoroute_worker, worker, THREAD_STACK_SIZE_DEFAULT);
+  assert(worker->thread);
+  ar->worker = worker;
+}
+
+#define autoroute_copy(dst, src, len)                                          \
+  do {                                                                         \
+    arrsetlen(dst, len);                                                       \
+    if ((len) > 0) {                                                           \
+      memcpy(dst, src, (len) * sizeof(*(dst)));                                \
+    }                                                                          \
+  } while (0)
+
+void autoroute_route_async(AutoRoute *ar, RoutingConfig config) {
+  autoroute_prepare_routing(ar);
+  bool all = autoroute_select_nets(ar, config);
+
+  if (!ar->worker) {
+    autoroute_start_worker(ar);
+  }
+  RouteWorker *worker = ar->worker;
+
+  thread_mutex_lock(&worker->mutex);
+
+  // the worker hasn't started on an older request yet, it can go
+  AsyncRoute *req = &worker->pending;
+  size_t netCount = circuit_net_len(ar->circuit);
+  autoroute_copy(req->netIDs, ar->circuit->sm.nets.ids, netCount);
+  autoroute_copy(req->nets, ar->nets, netCount);
+  autoroute_copy(
+    req->endpoints, ar->endpoints, circuit_endpoint_len(ar->circuit));
+  autoroute_copy(
+    req->waypoints, ar->waypoints, circuit_waypoint_len(ar->circuit));
+  autoroute_copy(req->anchors, ar->anchors, arrlen(ar->anchors));
+  autoroute_copy(req->boxes, ar->boxes, circuit_component_len(ar->circuit));
+  autoroute_copy(req->routeNets, ar->routeNets, arrlen(ar->routeNets));
+  arrsetlen(req->netViews, netCount);
+  if (!all) {
+    // the nets that aren't routed again keep the wires on screen right now
+    autoroute_copy(req->lastViews, ar->netViews, netCount);
+    autoroute_copy(
+      req->lastWires, ar->circuit->wires, arrlen(ar->circuit->wires));
+    autoroute_copy(
+      req->lastVertices, ar->circuit->vertices,
+      arrlen(ar->circuit->vertices));
+  }
+
+  RouteJob *job = &req->job;
+  job->generation = ar->generation++;
+  job->config = config;
+  job->verticesPerPoint = ar->verticesPerPoint;
+  job->graph = &worker->graph;
+  job->obstacleVersion = ar->obstacleVersion;
+  job->anchors = (RT_Slice_Anchor){req->anchors, arrlen(req->anchors)};
+  job->boxes = (RT_Slice_BoundingBox){req->boxes, arrlen(req->boxes)};
+  job->nets = (RT_Slice_Net){req->nets, netCount};
+  job->endpoints = (RT_Slice_Endpoint){req->endpoints, arrlen(req->endpoints)};
+  job->waypoints = (RT_Slice_Waypoint){req->waypoints, arrlen(req->waypoints)};
+  job->all = all;
+  job->routeNets = req->routeNets;
+  job->routeCount = arrlen(req->routeNets);
+  job->lastViews = req->lastViews;
+  job->lastWires = req->lastWires;
+  job->lastVertices = req->lastVertices;
+  job->netViews = req->netViews;
+
+  worker->hasPending = true;
+  thread_mutex_unlock(&worker->mutex);
+  thread_signal_raise(&worker->wake);
+}
+
+bool autoroute_poll(AutoRoute *ar) {
+  RouteWorker *worker = ar->worker;
+  if (!worker) {
+    return false;
+  }
+
+  thread_mutex_lock(&worker->mutex);
+  if (!worker->hasDone) {
+    thread_mutex_unlock(&worker->mutex);
+    return false;
+  }
+
+  // the wires on screen go back to the worker to be reused
+  RouteJob *job = &worker->done.job;
+  arr(Wire) wires = ar->circuit->wires;
+  ar->circuit->wires = job->wires;
+  job->wires = wires;
+  arr(HMM_Vec2) vertices = ar->circuit->vertices;
+  ar->circuit->vertices = job->vertices;
+  job->vertices = vertices;
+
+  autoroute_install(ar, job, worker->done.netIDs);
+  worker->hasDone = false;
+  thread_mutex_unlock(&worker->mutex);
+  return true;
+}
+
+bool autoroute_wait(AutoRoute *ar) {
+  RouteWorker *worker = ar->worker;
+  if (!worker) {
+    return false;
+  }
+
+  thread_mutex_lock(&worker->mutex);
+  while (worker->busy || worker->hasPending) {
+    thread_mutex_unlock(&worker->mutex);
+    thread_signal_wait(&worker->idle, THREAD_SIGNAL_WAIT_INFINITE);
+    thread_mutex_lock(&worker->mutex);
+  }
+  thread_mutex_unlock(&worker->mutex);
+
+  return autoroute_poll(ar);
+}
+
+// Appends the nets whose wires changed since the last call to nets, which
+// may include nets deleted since.
+arr(NetID) autoroute_changed_nets(AutoRoute *ar, arr(NetID) nets) {
+  for (ptrdiff_t i = 0; i < hmlen(ar->changedNets); i++) {
+    arrput(nets, ar->changedNets[i].key);
+  }
+  hmfree(ar->changedNets);
+  return nets;
+}
+
 RouteTimeStats autoroute_stats(AutoRoute *ar) {
   RouteTimeStats stats = {
     .build = {.avg = 0, .min = UINT64_MAX, .max = 0},
@@ -508,6 +1268,8 @@ RouteTimeStats autoroute_stats(AutoRoute *ar) {
     stats.route.min = HMM_MIN(stats.route.min, ar->routeTimes[i]);
     stats.build.max = HMM_MAX(stats.build.max, ar->buildTimes[i]);
     stats.route.max = HMM_MAX(stats.route.max, ar->routeTimes[i]);
+    stats.retries += ar->retries[i];
+    stats.graphBuilds += ar->builtGraphs[i];
   }
 
   if (ar->timeLength != 0) {
@@ -516,6 +1278,8 @@ RouteTimeStats autoroute_stats(AutoRoute *ar) {
   }
 
   stats.samples = ar->timeLength;
+  stats.routedNets = ar->routedNets;
+  stats.totalNets = circuit_net_len(ar->circuit);
 
   return stats;
 }
@@ -533,7 +1297,7 @@ void draw_filled_circle(
 void autoroute_draw_debug_lines(AutoRoute *ar, void *ctx) {
   RT_Slice_Node nodes;
 
-  RT_Result res = RT_graph_get_nodes(ar->graph, &nodes);
+  RT_Result res = RT_graph_get_nodes(ar->graph.graph, &nodes);
   assert(res == RT_RESULT_SUCCESS);
 
   for (size_t i = 0; i < nodes.len; i++) {
@@ -575,6 +1339,90 @@ void autoroute_draw_debug_lines(AutoRoute *ar, void *ctx) {
   }
 }
 
+static bool
+autoroute_check_anchor(AutoRoute *ar, ID id, RT_Anchor expected) {
+  ptrdiff_t i = hmgeti(ar->anchorIndex, id);
+  if (i < 0) {
+    log_error("Missing anchor for %" PRIxID, id);
+    return false;
+  }
+  RT_Anchor *anchor = &ar->anchors[ar->anchorIndex[i].value];
+  if (
+    anchor->position.x != expected.position.x ||
+    anchor->position.y != expected.position.y ||
+    anchor->bounding_box != expected.bounding_box ||
+    anchor->connect_directions != expected.connect_directions) {
+    log_error("Anchor for %" PRIxID " is out of date", id);
+    return false;
+  }
+  return true;
+}
+
+bool autoroute_check_anchors(AutoRoute *ar) {
+  size_t count = 0;
+  for (int i = 0; i < circuit_component_len(ar->circuit); i++) {
+    Component *comp = &ar->circuit->components[i];
+    PortID portID = comp->portFirst;
+    while (circuit_has(ar->circuit, portID)) {
+      Port *port = circuit_port_ptr(ar->circuit, portID);
+      PortDesc *portDesc =
+        &ar->circuit->componentDescs[comp->desc].ports[port->desc];
+      RT_Anchor expected = {
+        .bounding_box = i,
+        .position =
+          {
+            .x = comp->box.center.X + port->position.X,
+            .y = comp->box.center.Y + port->position.Y,
+          },
+        .connect_directions = portDesc->direction == PORT_IN
+                                ? RT_DIRECTIONS_NEG_X
+                                : RT_DIRECTIONS_POS_X,
+      };
+      if (!autoroute_check_anchor(ar, portID, expected)) {
+        return false;
+      }
+      count++;
+      portID = port->next;
+    }
+  }
+  for (int i = 0; i < circuit_endpoint_len(ar->circuit); i++) {
+    Endpoint *endpoint = &ar->circuit->endpoints[i];
+    if (circuit_has(ar->circuit, endpoint->port)) {
+      continue;
+    }
+    RT_Anchor expected = {
+      .position = {.x = endpoint->position.X, .y = endpoint->position.Y},
+      .connect_directions = RT_DIRECTIONS_ALL,
+      .bounding_box = RT_INVALID_BOUNDING_BOX_INDEX,
+    };
+    if (!autoroute_check_anchor(
+          ar, circuit_endpoint_id(ar->circuit, i), expected)) {
+      return false;
+    }
+    count++;
+  }
+  for (int i = 0; i < circuit_waypoint_len(ar->circuit); i++) {
+    Waypoint *waypoint = &ar->circuit->waypoints[i];
+    RT_Anchor expected = {
+      .position = {.x = waypoint->position.X, .y = waypoint->position.Y},
+      .connect_directions = RT_DIRECTIONS_ALL,
+      .bounding_box = RT_INVALID_BOUNDING_BOX_INDEX,
+    };
+    if (!autoroute_check_anchor(
+          ar, circuit_waypoint_id(ar->circuit, i), expected)) {
+      return false;
+    }
+    count++;
+  }
+
+  if (count != arrlen(ar->anchors)) {
+    log_error(
+      "Expected %zu anchors, have %zu", count, (size_t)arrlen(ar->anchors));
+    return false;
+  }
+  return true;
+}
+
 void autoroute_dump_anchor_boxes(AutoRoute *ar) {
   FILE *fp = fopen("dump.rs", "w");
   fprintf(fp, "const ANCHOR_POINTS: &[Anchor] = &[\n");
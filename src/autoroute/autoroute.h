@@ -33,6 +33,18 @@ typedef struct RouteTimeStats {
     uint64_t max;
   } route;
   int samples;
+
+  // how many of the nets the last route actually routed, the rest kept their
+  // wires from the route before
+  int routedNets;
+  int totalNets;
+
+  // how many times over the samples the output didn't fit and the router had
+  // to start over
+  int retries;
+  // how many of the samples had to build the graph, the others reused the
+  // graph of an earlier route since no anchors or boxes had changed
+  int graphBuilds;
 } RouteTimeStats;
 
 typedef struct RoutingConfig {
@@ -44,11 +56,23 @@ void autoroute_global_init();
 AutoRoute *autoroute_create(Circuit *circuit);
 void autoroute_free(AutoRoute *ar);
 void autoroute_route(AutoRoute *ar, RoutingConfig config);
+
+// Routes on a worker thread instead. The circuit keeps the wires of the last
+// finished route until autoroute_poll picks up a newer one, and a request the
+// worker hasn't started on yet is replaced by the next one.
+void autoroute_route_async(AutoRoute *ar, RoutingConfig config);
+// Installs the newest finished background route, returns true if there was one.
+bool autoroute_poll(AutoRoute *ar);
+// Waits for the worker to finish everything it was asked to do, then polls.
+bool autoroute_wait(AutoRoute *ar);
 bool autoroute_dump_routing_data(
   AutoRoute *ar, RoutingConfig config, const char *filename);
 
 void autoroute_draw_debug_lines(AutoRoute *ar, void *ctx);
 void autoroute_dump_anchor_boxes(AutoRoute *ar);
+// Compares the anchors against ones made from scratch, for testing.
+bool autoroute_check_anchors(AutoRoute *ar);
+arr(NetID) autoroute_changed_nets(AutoRoute *ar, arr(NetID) nets);
 RouteTimeStats autoroute_stats(AutoRoute *ar);
 
 #endif // AUTOROUTE_H
\ No newline at end of file
@@ -0,0 +1,39 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Benchmarks are utest cases that time themselves and print the results. They
+// are built into a separate executable so they don't slow down the tests, and
+// should be run from an optimized build.
+
+#include "ux/ux.h"
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+
+#define SOKOL_IMPL
+#include "sokol_time.h"
+
+#define THREAD_IMPLEMENTATION
+#include "thread.h"
+
+#include "utest.h"
+
+UTEST_STATE();
+int main(int argc, const char *const argv[]) {
+  stm_setup();
+  ux_global_init();
+  return utest_main(argc, argv);
+}
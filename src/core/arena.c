@@ -0,0 +1,136 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+
+#define LOG_LEVEL LL_DEBUG
+#include "log.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(n)                                                      \
+  (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ALIGN_UP(sizeof(ArenaBlock))
+
+static ArenaBlock *arena_add_block(Arena *arena, size_t size) {
+  // each new block is at least as big as all the others together, so an
+  // arena that was sized too small still only needs a few of them
+  size_t total = arena->blockSize;
+  for (ArenaBlock *block = arena->blocks; block; block = block->next) {
+    total = HMM_MAX(total, block->size * 2);
+  }
+  size = HMM_MAX(size, total);
+  ArenaBlock *block = malloc(ARENA_HEADER + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  *block = (ArenaBlock){.next = arena->blocks, .size = size};
+  arena->blocks = block;
+  arena->blockCount++;
+  return block;
+}
+
+void arena_init(Arena *arena, size_t capacity) {
+  *arena = (Arena){.blockSize = ARENA_ALIGN_UP(capacity)};
+  if (arena->blockSize < 4096) {
+    arena->blockSize = 4096;
+  }
+  arena_add_block(arena, arena->blockSize);
+}
+
+void arena_free(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  *arena = (Arena){0};
+}
+
+// Gives back everything allocated from the arena. If it outgrew its first
+// block, the blocks are replaced by one big enough for all of it, so the next
+// round of allocations fits in one block.
+void arena_reset(Arena *arena) {
+  if (arena->blocks && arena->blocks->next) {
+    size_t blockSize = HMM_MAX(arena->blockSize, arena->peak);
+    size_t peak = arena->peak;
+    arena_free(arena);
+    arena_init(arena, blockSize);
+    arena->peak = peak;
+    return;
+  }
+  if (arena->blocks) {
+    arena->blocks->used = 0;
+  }
+  arena->used = 0;
+  arena->last = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = ARENA_ALIGN_UP(size);
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    block = arena_add_block(arena, size);
+    if (block == NULL) {
+      return NULL;
+    }
+  }
+  void *ptr = (char *)block + ARENA_HEADER + block->used;
+  block->used += size;
+  arena->last = ptr;
+  arena->used += size;
+  arena->peak = HMM_MAX(arena->peak, arena->used);
+  return ptr;
+}
+
+static void *
+arena_realloc(void *user, void *ptr, size_t oldSize, size_t newSize) {
+  Arena *arena = user;
+  if (newSize == 0) {
+    // only the most recent allocation can be given back early
+    if (ptr != NULL && ptr == arena->last) {
+      arena->blocks->used -= ARENA_ALIGN_UP(oldSize);
+      arena->used -= ARENA_ALIGN_UP(oldSize);
+      arena->last = NULL;
+    }
+    return NULL;
+  }
+
+  if (ptr != NULL && ptr == arena->last) {
+    // grow or shrink in place if there is room
+    ArenaBlock *block = arena->blocks;
+    size_t start = (char *)ptr - ((char *)block + ARENA_HEADER);
+    if (start + ARENA_ALIGN_UP(newSize) <= block->size) {
+      block->used = start + ARENA_ALIGN_UP(newSize);
+      arena->used += ARENA_ALIGN_UP(newSize) - ARENA_ALIGN_UP(oldSize);
+      arena->peak = HMM_MAX(arena->peak, arena->used);
+      return ptr;
+    }
+  }
+
+  void *newPtr = arena_alloc(arena, newSize);
+  if (newPtr != NULL && ptr != NULL) {
+    memcpy(newPtr, ptr, HMM_MIN(oldSize, newSize));
+  }
+  return newPtr;
+}
+
+Allocator arena_allocator(Arena *arena) {
+  return (Allocator){.realloc = arena_realloc, .user = arena};
+}
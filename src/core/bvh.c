@@ -16,210 +16,1124 @@
 
 #include "core/core.h"
 
+#include "sokol_time.h"
 #include "stb_ds.h"
+#include "thread.h"
+#include <float.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #define LOG_LEVEL LL_DEBUG
 #include "log.h"
 
-void bvh_init(BVH *bvh) { *bvh = (BVH){0}; }
+void bvh_init(BVH *bvh) {
+  *bvh = (BVH){
+    .root = BVH_NULL,
+    .freeNodes = BVH_NULL,
+    .threads = BVH_DEFAULT_THREADS,
+    .wideVersion = UINT32_MAX,
+    .queriedVersion = UINT32_MAX,
+  };
+}
 
 void bvh_free(BVH *bvh) {
-  arrfree(bvh->nodeHeap);
-  arrfree(bvh->leaves);
+  arrfree(bvh->nodes);
+  hmfree(bvh->items);
   arrfree(bvh->stack);
   arrfree(bvh->scratch);
+  arrfree(bvh->slots);
+  arrfree(bvh->wide);
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    arrfree(bvh->visited[i]);
+  }
 }
 
 void bvh_clear(BVH *bvh) {
-  arrsetlen(bvh->nodeHeap, 0);
-  arrsetlen(bvh->leaves, 0);
+  arrsetlen(bvh->nodes, 0);
+  hmfree(bvh->items);
   arrsetlen(bvh->stack, 0);
+  bvh->root = BVH_NULL;
+  bvh->freeNodes = BVH_NULL;
+  bvh->leafCount = 0;
+  bvh->needsRebuild = true;
+  bvh->version++;
 }
 
-// static inline uint32_t bvh_parent(uint32_t i) { return (i - 1) / 2; }
-static inline uint32_t bvh_left(uint32_t i) { return 2 * i + 1; }
-static inline uint32_t bvh_right(uint32_t i) { return 2 * i + 2; }
+static uint32_t bvh_alloc_node(BVH *bvh) {
+  uint32_t index = bvh->freeNodes;
+  if (index != BVH_NULL) {
+    bvh->freeNodes = bvh->nodes[index].nextLeaf;
+  } else {
+    index = arrlen(bvh->nodes);
+    arraddnptr(bvh->nodes, 1);
+  }
+  bvh->nodes[index] = (BVHNode){
+    .parent = BVH_NULL,
+    .left = BVH_NULL,
+    .right = BVH_NULL,
+    .nextLeaf = BVH_NULL,
+  };
+  return index;
+}
 
-void bvh_query_leaf_nodes(BVH *bvh, HMM_Vec2 point) {
-  arrsetlen(bvh->scratch, 0);
-  arrsetlen(bvh->stack, 0);
-  if (arrlen(bvh->nodeHeap) == 0) {
-    return;
+static void bvh_free_node(BVH *bvh, uint32_t index) {
+  bvh->nodes[index].height = -1;
+  bvh->nodes[index].nextLeaf = bvh->freeNodes;
+  bvh->freeNodes = index;
+}
+
+static inline bool bvh_is_leaf(BVHNode *node) { return node->left == BVH_NULL; }
+
+// the perimeter stands in for the surface area heuristic in 2D
+static inline float bvh_cost(Box box) {
+  return 4.0f * (box.halfSize.X + box.halfSize.Y);
+}
+
+static void bvh_refit_node(BVH *bvh, uint32_t index) {
+  BVHNode *node = &bvh->nodes[index];
+  BVHNode *left = &bvh->nodes[node->left];
+  BVHNode *right = &bvh->nodes[node->right];
+  node->box = box_union(left->box, right->box);
+  node->height = 1 + HMM_MAX(left->height, right->height);
+}
+
+static void bvh_replace_child(
+  BVH *bvh, uint32_t parent, uint32_t oldChild, uint32_t newChild) {
+  if (parent == BVH_NULL) {
+    bvh->root = newChild;
+  } else if (bvh->nodes[parent].left == oldChild) {
+    bvh->nodes[parent].left = newChild;
+  } else {
+    bvh->nodes[parent].right = newChild;
   }
-  arrput(bvh->stack, 0);
-  while (arrlen(bvh->stack) > 0) {
-    uint32_t index = arrpop(bvh->stack);
-    BVHNode *node = &bvh->nodeHeap[index];
-    if (box_intersect_point(node->box, point)) {
-      if (node->numLeaves == 0) {
-        arrput(bvh->stack, bvh_left(index));
-        arrput(bvh->stack, bvh_right(index));
-      }
-      arrput(bvh->scratch, index);
+}
+
+// If one child of node A is more than one level taller than the other, rotate
+// the taller child up into A's place. Returns the index of the node now in A's
+// place.
+static uint32_t bvh_balance(BVH *bvh, uint32_t iA) {
+  BVHNode *nodes = bvh->nodes;
+  BVHNode *a = &nodes[iA];
+  if (bvh_is_leaf(a) || a->height < 2) {
+    return iA;
+  }
+
+  uint32_t iB = a->left;
+  uint32_t iC = a->right;
+  BVHNode *b = &nodes[iB];
+  BVHNode *c = &nodes[iC];
+  int balance = c->height - b->height;
+
+  if (balance > 1) {
+    // rotate C up
+    uint32_t iF = c->left;
+    uint32_t iG = c->right;
+    BVHNode *f = &nodes[iF];
+    BVHNode *g = &nodes[iG];
+
+    c->left = iA;
+    c->parent = a->parent;
+    a->parent = iC;
+    bvh_replace_child(bvh, c->parent, iA, iC);
+
+    if (f->height > g->height) {
+      c->right = iF;
+      a->right = iG;
+      g->parent = iA;
+      a->box = box_union(b->box, g->box);
+      c->box = box_union(a->box, f->box);
+      a->height = 1 + HMM_MAX(b->height, g->height);
+      c->height = 1 + HMM_MAX(a->height, f->height);
+    } else {
+      c->right = iG;
+      a->right = iF;
+      f->parent = iA;
+      a->box = box_union(b->box, f->box);
+      c->box = box_union(a->box, g->box);
+      a->height = 1 + HMM_MAX(b->height, f->height);
+      c->height = 1 + HMM_MAX(a->height, g->height);
+    }
+    return iC;
+  }
+
+  if (balance < -1) {
+    // rotate B up
+    uint32_t iD = b->left;
+    uint32_t iE = b->right;
+    BVHNode *d = &nodes[iD];
+    BVHNode *e = &nodes[iE];
+
+    b->left = iA;
+    b->parent = a->parent;
+    a->parent = iB;
+    bvh_replace_child(bvh, b->parent, iA, iB);
+
+    if (d->height > e->height) {
+      b->right = iD;
+      a->left = iE;
+      e->parent = iA;
+      a->box = box_union(c->box, e->box);
+      b->box = box_union(a->box, d->box);
+      a->height = 1 + HMM_MAX(c->height, e->height);
+      b->height = 1 + HMM_MAX(a->height, d->height);
+    } else {
+      b->right = iE;
+      a->left = iD;
+      d->parent = iA;
+      a->box = box_union(c->box, d->box);
+      b->box = box_union(a->box, e->box);
+      a->height = 1 + HMM_MAX(c->height, d->height);
+      b->height = 1 + HMM_MAX(a->height, e->height);
     }
+    return iB;
   }
+
+  return iA;
 }
 
-arr(ID) bvh_query(BVH *bvh, Box box, arr(ID) result) {
-  if (bvh->needsRebuild) {
-    bvh_rebuild(bvh);
+// walks from index up to the root, rebalancing and refitting each ancestor
+static void bvh_fix_upwards(BVH *bvh, uint32_t index) {
+  while (index != BVH_NULL) {
+    index = bvh_balance(bvh, index);
+    bvh_refit_node(bvh, index);
+    index = bvh->nodes[index].parent;
   }
-  if (arrlen(bvh->nodeHeap) == 0) {
-    return result;
+}
+
+// cost of descending into child to find a sibling for a leaf with box
+static float bvh_descend_cost(BVH *bvh, uint32_t child, Box box) {
+  BVHNode *node = &bvh->nodes[child];
+  float cost = bvh_cost(box_union(node->box, box));
+  if (!bvh_is_leaf(node)) {
+    cost -= bvh_cost(node->box);
   }
-  arrsetlen(bvh->stack, 0);
-  arrput(bvh->stack, 0);
-  while (arrlen(bvh->stack) > 0) {
-    uint32_t index = arrpop(bvh->stack);
-    BVHNode *node = &bvh->nodeHeap[index];
-    if (box_intersect_box(box, node->box)) {
-      if (node->numLeaves == 0) {
-        arrput(bvh->stack, bvh_left(index));
-        arrput(bvh->stack, bvh_right(index));
-      } else {
-        for (uint32_t i = 0; i < node->numLeaves; i++) {
-          if (box_intersect_box(box, bvh->leaves[node->firstLeaf + i].box)) {
-            // item may be in the BVH multiple times, so we need to check
-            // if it's already in the result array
-            ID item = bvh->leaves[node->firstLeaf + i].item;
-            bool found = false;
-            for (size_t j = 0; j < arrlen(result); j++) {
-              if (result[j] == item) {
-                found = true;
-                break;
-              }
-            }
-            if (!found) {
-              arrput(result, item);
-            }
-          }
-        }
-      }
+  return cost;
+}
+
+static void bvh_insert_leaf(BVH *bvh, uint32_t leaf) {
+  bvh->version++;
+  if (bvh->root == BVH_NULL) {
+    bvh->root = leaf;
+    bvh->nodes[leaf].parent = BVH_NULL;
+    return;
+  }
+
+  // find the cheapest sibling for the leaf by following the child that grows
+  // the least, stopping when pairing up right here would be cheaper
+  Box box = bvh->nodes[leaf].box;
+  uint32_t index = bvh->root;
+  while (!bvh_is_leaf(&bvh->nodes[index])) {
+    BVHNode *node = &bvh->nodes[index];
+    float area = bvh_cost(node->box);
+    float combinedArea = bvh_cost(box_union(node->box, box));
+
+    float cost = 2.0f * combinedArea;
+    float inheritanceCost = 2.0f * (combinedArea - area);
+    float leftCost = bvh_descend_cost(bvh, node->left, box) + inheritanceCost;
+    float rightCost = bvh_descend_cost(bvh, node->right, box) + inheritanceCost;
+
+    if (cost < leftCost && cost < rightCost) {
+      break;
     }
+    index = leftCost < rightCost ? node->left : node->right;
   }
-  return result;
+
+  uint32_t sibling = index;
+  uint32_t oldParent = bvh->nodes[sibling].parent;
+  uint32_t newParent = bvh_alloc_node(bvh);
+  BVHNode *nodes = bvh->nodes;
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].left = sibling;
+  nodes[newParent].right = leaf;
+  nodes[sibling].parent = newParent;
+  nodes[leaf].parent = newParent;
+  bvh_replace_child(bvh, oldParent, sibling, newParent);
+
+  bvh_fix_upwards(bvh, newParent);
+}
+
+static void bvh_remove_leaf(BVH *bvh, uint32_t leaf) {
+  bvh->version++;
+  BVHNode *nodes = bvh->nodes;
+  if (leaf == bvh->root) {
+    bvh->root = BVH_NULL;
+    return;
+  }
+
+  uint32_t parent = nodes[leaf].parent;
+  uint32_t grandParent = nodes[parent].parent;
+  uint32_t sibling =
+    nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+  bvh_replace_child(bvh, grandParent, parent, sibling);
+  nodes[sibling].parent = grandParent;
+  nodes[leaf].parent = BVH_NULL;
+  bvh_free_node(bvh, parent);
+
+  bvh_fix_upwards(bvh, grandParent);
 }
 
 void bvh_add(BVH *bvh, ID item, Box box) {
-  BVHLeaf leaf = {.box = box, .item = item};
-  bvh_query_leaf_nodes(bvh, box.center);
-  for (size_t i = 0; i < arrlen(bvh->scratch); i++) {
-    uint32_t index = bvh->scratch[i];
-    BVHNode *node = &bvh->nodeHeap[index];
-    if (node->numLeaves > 0) {
-      // This node has leaves, so add the leaf to this node,
-      // then increase the `firstLeaf` of all the nodes that
-      // come after it.
-      arrins(bvh->leaves, node->firstLeaf + node->numLeaves, leaf);
-      node->numLeaves++;
-      for (size_t j = index + 1; j < arrlen(bvh->nodeHeap); j++) {
-        bvh->nodeHeap[j].firstLeaf++;
-      }
-      node->box = box_union(node->box, box);
-      return;
+  uint32_t leaf = bvh_alloc_node(bvh);
+  BVHNode *node = &bvh->nodes[leaf];
+  node->box = box;
+  node->item = item;
+
+  // link it in at the head of the item's leaves
+  ptrdiff_t itemIndex = hmgeti(bvh->items, item);
+  if (itemIndex >= 0) {
+    uint32_t head = bvh->items[itemIndex].value;
+    node->nextLeaf = head;
+    node->segment = bvh->nodes[head].segment + 1;
+    bvh->items[itemIndex].value = leaf;
+  } else {
+    hmput(bvh->items, item, leaf);
+  }
+  bvh->leafCount++;
+
+  if (!bvh->needsRebuild) {
+    bvh_insert_leaf(bvh, leaf);
+  }
+}
+
+// unlinks leaf from its item's list and frees it
+static void bvh_delete_leaf(BVH *bvh, uint32_t leaf) {
+  if (!bvh->needsRebuild) {
+    bvh_remove_leaf(bvh, leaf);
+  }
+
+  BVHNode *node = &bvh->nodes[leaf];
+  ptrdiff_t itemIndex = hmgeti(bvh->items, node->item);
+  assert(itemIndex >= 0);
+  if (bvh->items[itemIndex].value == leaf) {
+    if (node->nextLeaf == BVH_NULL) {
+      hmdel(bvh->items, node->item);
+    } else {
+      bvh->items[itemIndex].value = node->nextLeaf;
     }
+  } else {
+    uint32_t prev = bvh->items[itemIndex].value;
+    while (bvh->nodes[prev].nextLeaf != leaf) {
+      prev = bvh->nodes[prev].nextLeaf;
+    }
+    bvh->nodes[prev].nextLeaf = node->nextLeaf;
   }
-  // fallback, just add to the end and rebuild
-  arrput(bvh->leaves, leaf);
-  bvh->needsRebuild = true;
+
+  bvh->leafCount--;
+  bvh_free_node(bvh, leaf);
+}
+
+static uint32_t bvh_find_leaf(BVH *bvh, ID item, Box box) {
+  ptrdiff_t itemIndex = hmgeti(bvh->items, item);
+  if (itemIndex < 0) {
+    return BVH_NULL;
+  }
+  uint32_t leaf = bvh->items[itemIndex].value;
+  while (leaf != BVH_NULL && !box_equal(bvh->nodes[leaf].box, box)) {
+    leaf = bvh->nodes[leaf].nextLeaf;
+  }
+  return leaf;
 }
 
 void bvh_remove(BVH *bvh, ID item, Box box) {
-  bvh_query_leaf_nodes(bvh, box.center);
-  for (size_t i = 0; i < arrlen(bvh->scratch); i++) {
-    uint32_t index = bvh->scratch[i];
-    BVHNode *node = &bvh->nodeHeap[index];
-    if (node->numLeaves > 0) {
-      for (size_t j = 0; j < node->numLeaves; j++) {
-        BVHLeaf leaf = bvh->leaves[node->firstLeaf + j];
-        if (leaf.item == item && box_equal(leaf.box, box)) {
-          arrdel(bvh->leaves, node->firstLeaf + j);
-          node->numLeaves--;
-          for (size_t k = index + 1; k < arrlen(bvh->nodeHeap); k++) {
-            bvh->nodeHeap[k].firstLeaf--;
-          }
-          return;
-        }
+  uint32_t leaf = bvh_find_leaf(bvh, item, box);
+  if (leaf != BVH_NULL) {
+    bvh_delete_leaf(bvh, leaf);
+  }
+}
+
+void bvh_remove_item(BVH *bvh, ID item) {
+  ptrdiff_t itemIndex;
+  while ((itemIndex = hmgeti(bvh->items, item)) >= 0) {
+    bvh_delete_leaf(bvh, bvh->items[itemIndex].value);
+  }
+}
+
+static void bvh_move_leaf(BVH *bvh, uint32_t leaf, Box box) {
+  BVHNode *node = &bvh->nodes[leaf];
+  node->box = box;
+  if (bvh->needsRebuild) {
+    return;
+  }
+
+  // small moves that stay inside the parent only need the ancestors refit,
+  // anything else is reinserted wherever it fits best now
+  bvh->version++;
+  uint32_t parent = node->parent;
+  if (parent != BVH_NULL && box_contains_box(bvh->nodes[parent].box, box)) {
+    while (parent != BVH_NULL) {
+      Box oldBox = bvh->nodes[parent].box;
+      bvh_refit_node(bvh, parent);
+      if (box_equal(oldBox, bvh->nodes[parent].box)) {
+        break;
       }
+      parent = bvh->nodes[parent].parent;
     }
+    return;
   }
+
+  bvh_remove_leaf(bvh, leaf);
+  bvh_insert_leaf(bvh, leaf);
 }
 
 void bvh_update(BVH *bvh, ID item, Box oldBox, Box newBox) {
-  // todo: a more efficient algorithm
-  bvh_remove(bvh, item, oldBox);
-  bvh_add(bvh, item, newBox);
+  uint32_t leaf = bvh_find_leaf(bvh, item, oldBox);
+  if (leaf == BVH_NULL) {
+    bvh_add(bvh, item, newBox);
+    return;
+  }
+  bvh_move_leaf(bvh, leaf, newBox);
 }
 
-static int bvh_compare_x(const void *a, const void *b) {
-  BVHLeaf *al = (BVHLeaf *)a;
-  BVHLeaf *bl = (BVHLeaf *)b;
-  return al->box.center.X - bl->box.center.X;
+// Makes boxes the leaves of item, touching only the leaves that changed.
+// Returns true if anything changed.
+bool bvh_set_boxes(BVH *bvh, ID item, Box *boxes, int count) {
+  // leaves are linked newest first, so they're compared back to front
+  int leafCount = 0;
+  bool same = true;
+  ptrdiff_t itemIndex = hmgeti(bvh->items, item);
+  uint32_t leaf = itemIndex >= 0 ? bvh->items[itemIndex].value : BVH_NULL;
+  for (; leaf != BVH_NULL; leaf = bvh->nodes[leaf].nextLeaf) {
+    leafCount++;
+    if (
+      leafCount > count ||
+      !box_equal(bvh->nodes[leaf].box, boxes[count - leafCount])) {
+      same = false;
+    }
+  }
+  if (same && leafCount == count) {
+    return false;
+  }
+
+  if (leafCount != count) {
+    bvh_remove_item(bvh, item);
+    for (int i = 0; i < count; i++) {
+      bvh_add(bvh, item, boxes[i]);
+    }
+    return true;
+  }
+
+  leaf = bvh->items[itemIndex].value;
+  for (int i = count - 1; i >= 0; i--) {
+    uint32_t next = bvh->nodes[leaf].nextLeaf;
+    if (!box_equal(bvh->nodes[leaf].box, boxes[i])) {
+      bvh_move_leaf(bvh, leaf, boxes[i]);
+    }
+    leaf = next;
+  }
+  return true;
 }
-static int bvh_compare_y(const void *a, const void *b) {
-  BVHLeaf *al = (BVHLeaf *)a;
-  BVHLeaf *bl = (BVHLeaf *)b;
-  return al->box.center.Y - bl->box.center.Y;
+
+#define BVH_BINS 16
+
+typedef struct BVHBin {
+  Box box;
+  uint32_t count;
+} BVHBin;
+
+static inline float bvh_center(BVH *bvh, uint32_t leaf, int axis) {
+  return bvh->nodes[leaf].box.center.Elements[axis];
 }
-int (*bvh_axis_compares[2])(const void *, const void *) = {
-  &bvh_compare_x, &bvh_compare_y};
 
-#define LEAVES_PER_NODE 4
+static inline int bvh_bin(float center, float min, float scale) {
+  int bin = (int)((center - min) * scale);
+  return bin < BVH_BINS ? bin : BVH_BINS - 1;
+}
 
-static void bvh_recursive_subdivide(BVH *bvh, uint32_t index, int axis) {
-  BVHNode *node = &bvh->nodeHeap[index];
-  if (node->numLeaves <= LEAVES_PER_NODE) {
-    // calculate the bounding box
-    Box box = bvh->leaves[node->firstLeaf].box;
-    for (uint32_t i = 1; i < node->numLeaves; i++) {
-      box = box_union(box, bvh->leaves[node->firstLeaf + i].box);
+// Reorders leaves so that the one with the nth smallest center on axis is at
+// nth, with no larger centers before it and no smaller ones after it.
+static void
+bvh_select(BVH *bvh, uint32_t *leaves, int count, int nth, int axis) {
+  int lo = 0;
+  int hi = count - 1;
+  while (lo < hi) {
+    float pivot = bvh_center(bvh, leaves[lo + (hi - lo) / 2], axis);
+    int i = lo;
+    int j = hi;
+    while (i <= j) {
+      while (bvh_center(bvh, leaves[i], axis) < pivot) {
+        i++;
+      }
+      while (bvh_center(bvh, leaves[j], axis) > pivot) {
+        j--;
+      }
+      if (i <= j) {
+        uint32_t tmp = leaves[i];
+        leaves[i] = leaves[j];
+        leaves[j] = tmp;
+        i++;
+        j--;
+      }
+    }
+    if (nth <= j) {
+      hi = j;
+    } else if (nth >= i) {
+      lo = i;
+    } else {
+      break;
     }
-    node->box = box;
-    return;
   }
+}
 
-  uint32_t half = (node->numLeaves) / 2;
-  if (bvh_right(index) >= arrlen(bvh->nodeHeap)) {
-    arrsetlen(bvh->nodeHeap, bvh_right(index) + 1);
-    node = &bvh->nodeHeap[index];
+// Finds the cheapest split of leaves along axis by binning their centers, and
+// partitions them into the two halves. Returns the size of the first half, or
+// 0 if no split is cheaper than the others.
+static int bvh_split_binned(
+  BVH *bvh, uint32_t *leaves, int count, int axis, float min, float extent) {
+  BVHBin bins[BVH_BINS] = {0};
+  float scale = BVH_BINS / extent;
+  for (int i = 0; i < count; i++) {
+    Box box = bvh->nodes[leaves[i]].box;
+    BVHBin *bin = &bins[bvh_bin(box.center.Elements[axis], min, scale)];
+    bin->box = bin->count == 0 ? box : box_union(bin->box, box);
+    bin->count++;
   }
 
-  // for debugging
-  node->median = bvh->leaves[node->firstLeaf + half].box.center.Elements[axis];
-  node->axis = axis;
+  // cost of everything right of each split, sweeping in from the right
+  float rightCost[BVH_BINS];
+  uint32_t rightCount[BVH_BINS];
+  Box box = {0};
+  uint32_t n = 0;
+  for (int k = BVH_BINS - 1; k > 0; k--) {
+    if (bins[k].count > 0) {
+      box = n == 0 ? bins[k].box : box_union(box, bins[k].box);
+      n += bins[k].count;
+    }
+    rightCount[k] = n;
+    rightCost[k] = n * bvh_cost(box);
+  }
 
-  bvh->nodeHeap[bvh_left(index)] =
-    (BVHNode){.firstLeaf = node->firstLeaf, .numLeaves = half};
-  bvh->nodeHeap[bvh_right(index)] = (BVHNode){
-    .firstLeaf = node->firstLeaf + half, .numLeaves = node->numLeaves - half};
+  float bestCost = FLT_MAX;
+  int bestSplit = 0;
+  n = 0;
+  for (int k = 1; k < BVH_BINS; k++) {
+    if (bins[k - 1].count > 0) {
+      box = n == 0 ? bins[k - 1].box : box_union(box, bins[k - 1].box);
+      n += bins[k - 1].count;
+    }
+    if (n == 0 || rightCount[k] == 0) {
+      continue;
+    }
+    float cost = n * bvh_cost(box) + rightCost[k];
+    if (cost < bestCost) {
+      bestCost = cost;
+      bestSplit = k;
+    }
+  }
+  if (bestSplit == 0) {
+    return 0;
+  }
 
-  qsort(
-    &bvh->leaves[node->firstLeaf], node->numLeaves, sizeof(BVHLeaf),
-    bvh_axis_compares[axis]);
+  int i = 0;
+  int j = count - 1;
+  while (i <= j) {
+    if (bvh_bin(bvh_center(bvh, leaves[i], axis), min, scale) < bestSplit) {
+      i++;
+    } else {
+      uint32_t tmp = leaves[i];
+      leaves[i] = leaves[j];
+      leaves[j] = tmp;
+      j--;
+    }
+  }
+  return i;
+}
 
-  bvh_recursive_subdivide(bvh, bvh_left(index), axis ? 0 : 1);
-  bvh_recursive_subdivide(bvh, bvh_right(index), axis ? 0 : 1);
-  node = &bvh->nodeHeap[index];
+// Splits leaves in two with the binned surface area heuristic along the longer
+// axis of their centers, returning the size of the first half.
+static int bvh_split(BVH *bvh, uint32_t *leaves, int count) {
+  HMM_Vec2 min = bvh->nodes[leaves[0]].box.center;
+  HMM_Vec2 max = min;
+  for (int i = 1; i < count; i++) {
+    HMM_Vec2 center = bvh->nodes[leaves[i]].box.center;
+    min.X = HMM_MIN(min.X, center.X);
+    min.Y = HMM_MIN(min.Y, center.Y);
+    max.X = HMM_MAX(max.X, center.X);
+    max.Y = HMM_MAX(max.Y, center.Y);
+  }
+  int axis = (max.X - min.X) >= (max.Y - min.Y) ? 0 : 1;
+  float extent = max.Elements[axis] - min.Elements[axis];
 
-  node->box = box_union(
-    bvh->nodeHeap[bvh_left(index)].box, bvh->nodeHeap[bvh_right(index)].box);
+  int split = 0;
+  if (extent > 0) {
+    split = bvh_split_binned(
+      bvh, leaves, count, axis, min.Elements[axis], extent);
+  }
+  if (split == 0) {
+    // everything landed in one bin, so fall back to the median
+    split = count / 2;
+    bvh_select(bvh, leaves, count, split, axis);
+  }
+  return split;
+}
 
-  node->firstLeaf = 0;
-  node->numLeaves = 0;
+static void bvh_set_internal(
+  BVH *bvh, uint32_t node, uint32_t parent, uint32_t left, uint32_t right) {
+  bvh->nodes[node] = (BVHNode){
+    .parent = parent,
+    .left = left,
+    .right = right,
+    .nextLeaf = BVH_NULL,
+  };
 }
 
-#include "sokol_time.h"
+// Builds a subtree over leaves top down, returning its root. The count - 1
+// internal nodes come from slots in preorder, so the layout of the subtree is
+// fixed by the leaves alone and independent subtrees can be built at once.
+static uint32_t bvh_build(
+  BVH *bvh, uint32_t *leaves, int count, uint32_t parent, uint32_t *slots) {
+  if (count == 1) {
+    bvh->nodes[leaves[0]].parent = parent;
+    return leaves[0];
+  }
+
+  int split = bvh_split(bvh, leaves, count);
+  uint32_t node = slots[0];
+  uint32_t left = bvh_build(bvh, leaves, split, node, slots + 1);
+  uint32_t right =
+    bvh_build(bvh, leaves + split, count - split, node, slots + split);
+  bvh_set_internal(bvh, node, parent, left, right);
+  bvh_refit_node(bvh, node);
+  return node;
+}
+
+// trees with fewer leaves than this aren't worth starting threads for
+#define BVH_PARALLEL_MIN 16384
+// subtrees with fewer leaves than this are built by a single thread
+#define BVH_TASK_MIN 1024
+
+typedef struct BVHBuildTask {
+  uint32_t *leaves;
+  int count;
+  uint32_t parent;
+  uint32_t *slots;
+} BVHBuildTask;
+
+typedef struct BVHBuild {
+  BVH *bvh;
+  arr(BVHBuildTask) tasks;
+  thread_atomic_int_t nextTask;
+
+  // internal nodes above the tasks, children before parents
+  arr(uint32_t) top;
+} BVHBuild;
+
+// Splits the top levels of the tree like bvh_build does, but leaves the
+// subtrees below depth as tasks for the workers.
+static uint32_t bvh_build_top(
+  BVHBuild *build, uint32_t *leaves, int count, uint32_t parent,
+  uint32_t *slots, int depth) {
+  BVH *bvh = build->bvh;
+  if (count == 1) {
+    bvh->nodes[leaves[0]].parent = parent;
+    return leaves[0];
+  }
+  if (depth == 0 || count < BVH_TASK_MIN) {
+    arrput(build->tasks, ((BVHBuildTask){leaves, count, parent, slots}));
+    return slots[0];
+  }
+
+  int split = bvh_split(bvh, leaves, count);
+  uint32_t node = slots[0];
+  uint32_t left =
+    bvh_build_top(build, leaves, split, node, slots + 1, depth - 1);
+  uint32_t right = bvh_build_top(
+    build, leaves + split, count - split, node, slots + split, depth - 1);
+  bvh_set_internal(bvh, node, parent, left, right);
+  arrput(build->top, node);
+  return node;
+}
+
+static int bvh_build_worker(void *user) {
+  BVHBuild *build = user;
+  for (;;) {
+    int i = thread_atomic_int_inc(&build->nextTask);
+    if (i >= arrlen(build->tasks)) {
+      break;
+    }
+    BVHBuildTask *task = &build->tasks[i];
+    bvh_build(build->bvh, task->leaves, task->count, task->parent, task->slots);
+  }
+  return 0;
+}
+
+static uint32_t
+bvh_build_parallel(BVH *bvh, uint32_t *leaves, int count, uint32_t *slots) {
+  BVHBuild build = {.bvh = bvh};
+  thread_atomic_int_store(&build.nextTask, 0);
+
+  // make a few tasks per thread so that uneven splits still balance out
+  int depth = 0;
+  while ((1 << depth) < bvh->threads * 4) {
+    depth++;
+  }
+  uint32_t root = bvh_build_top(&build, leaves, count, BVH_NULL, slots, depth);
+
+  // the calling thread works through the tasks too
+  arr(thread_ptr_t) threads = NULL;
+  int threadCount = HMM_MIN(bvh->threads, (int)arrlen(build.tasks)) - 1;
+  for (int i = 0; i < threadCount; i++) {
+    arrput(
+      threads,
+      thread_create(bvh_build_worker, &build, THREAD_STACK_SIZE_DEFAULT));
+  }
+  bvh_build_worker(&build);
+  for (int i = 0; i < arrlen(threads); i++) {
+    thread_destroy(threads[i]);
+  }
+  arrfree(threads);
+
+  for (int i = 0; i < arrlen(build.top); i++) {
+    bvh_refit_node(bvh, build.top[i]);
+  }
+  arrfree(build.tasks);
+  arrfree(build.top);
+  return root;
+}
+
+// Rebuilds the tree from scratch over the current leaves.
 void bvh_rebuild(BVH *bvh) {
   uint64_t now = stm_now();
-  arrsetlen(bvh->nodeHeap, 1);
 
-  bvh->nodeHeap[0].firstLeaf = 0;
-  bvh->nodeHeap[0].numLeaves = arrlen(bvh->leaves);
+  // leaves keep their nodes, everything else is a slot for an internal node
+  arrsetlen(bvh->scratch, 0);
+  arrsetlen(bvh->slots, 0);
+  for (uint32_t i = 0; i < arrlen(bvh->nodes); i++) {
+    BVHNode *node = &bvh->nodes[i];
+    if (node->height == 0 && bvh_is_leaf(node)) {
+      arrput(bvh->scratch, i);
+    } else {
+      arrput(bvh->slots, i);
+    }
+  }
+  int count = arrlen(bvh->scratch);
+  int needed = count > 0 ? count - 1 : 0;
+  for (int i = arrlen(bvh->slots); i < needed; i++) {
+    arrput(bvh->slots, arrlen(bvh->nodes));
+    arrput(bvh->nodes, (BVHNode){0});
+  }
+  bvh->freeNodes = BVH_NULL;
+  for (int i = arrlen(bvh->slots) - 1; i >= needed; i--) {
+    bvh_free_node(bvh, bvh->slots[i]);
+  }
+
+  bvh->root = BVH_NULL;
+  if (count >= BVH_PARALLEL_MIN && bvh->threads > 1) {
+    bvh->root = bvh_build_parallel(bvh, bvh->scratch, count, bvh->slots);
+  } else if (count > 0) {
+    bvh->root = bvh_build(bvh, bvh->scratch, count, BVH_NULL, bvh->slots);
+  }
 
-  bvh_recursive_subdivide(bvh, 0, 0);
   uint64_t elapsed = stm_since(now);
   log_debug("BVH rebuild took %f ms", stm_ms(elapsed));
 
   bvh->needsRebuild = false;
+  bvh->version++;
+}
+
+// the deepest wide tree the fixed traversal stack can hold: each level leaves
+// at most three siblings on the stack
+#define BVH4_STACK_SIZE 256
+#define BVH4_MAX_DEPTH ((BVH4_STACK_SIZE - 1) / 3)
+
+static void bvh4_set_lane(BVH4Node *node, int lane, Box box, uint32_t child) {
+  node->minX[lane] = box.center.X - box.halfSize.X;
+  node->minY[lane] = box.center.Y - box.halfSize.Y;
+  node->maxX[lane] = box.center.X + box.halfSize.X;
+  node->maxY[lane] = box.center.Y + box.halfSize.Y;
+  node->child[lane] = child;
+}
+
+// Collapses the subtree under index into wide nodes, returning the top one.
+static uint32_t bvh_collapse(BVH *bvh, uint32_t index, int depth) {
+  bvh->wideDepth = HMM_MAX(bvh->wideDepth, depth);
+
+  // open up the biggest internal node until there are four children
+  uint32_t children[4] = {index};
+  int count = 1;
+  while (count < 4) {
+    int best = -1;
+    float bestCost = -1;
+    for (int i = 0; i < count; i++) {
+      BVHNode *child = &bvh->nodes[children[i]];
+      if (!bvh_is_leaf(child) && bvh_cost(child->box) > bestCost) {
+        best = i;
+        bestCost = bvh_cost(child->box);
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    BVHNode *open = &bvh->nodes[children[best]];
+    children[best] = open->left;
+    children[count++] = open->right;
+  }
+
+  uint32_t wide = arrlen(bvh->wide);
+  BVH4Node node;
+  for (int i = 0; i < 4; i++) {
+    // empty lanes are inside out so nothing intersects them
+    node.minX[i] = node.minY[i] = FLT_MAX;
+    node.maxX[i] = node.maxY[i] = -FLT_MAX;
+    node.child[i] = BVH_NULL;
+  }
+  arrput(bvh->wide, node);
+
+  for (int i = 0; i < count; i++) {
+    BVHNode *child = &bvh->nodes[children[i]];
+    uint32_t childIndex = bvh_is_leaf(child)
+                            ? BVH4_LEAF | children[i]
+                            : bvh_collapse(bvh, children[i], depth + 1);
+    bvh4_set_lane(&bvh->wide[wide], i, child->box, childIndex);
+  }
+  return wide;
+}
+
+static void bvh_collapse_tree(BVH *bvh) {
+  arrsetlen(bvh->wide, 0);
+  bvh->wideDepth = 0;
+  if (bvh->root != BVH_NULL) {
+    bvh_collapse(bvh, bvh->root, 1);
+  }
+  bvh->wideVersion = bvh->version;
+}
+
+// Returns a bit per lane of node whose bounds overlap the query bounds.
+static inline int bvh4_intersect(
+  BVH4Node *node, float minX, float minY, float maxX, float maxY) {
+#if defined(HANDMADE_MATH__USE_SSE)
+  __m128 hitX = _mm_and_ps(
+    _mm_cmplt_ps(_mm_loadu_ps(node->minX), _mm_set1_ps(maxX)),
+    _mm_cmplt_ps(_mm_set1_ps(minX), _mm_loadu_ps(node->maxX)));
+  __m128 hitY = _mm_and_ps(
+    _mm_cmplt_ps(_mm_loadu_ps(node->minY), _mm_set1_ps(maxY)),
+    _mm_cmplt_ps(_mm_set1_ps(minY), _mm_loadu_ps(node->maxY)));
+  return _mm_movemask_ps(_mm_and_ps(hitX, hitY));
+#elif defined(HANDMADE_MATH__USE_NEON)
+  uint32x4_t hitX = vandq_u32(
+    vcltq_f32(vld1q_f32(node->minX), vdupq_n_f32(maxX)),
+    vcltq_f32(vdupq_n_f32(minX), vld1q_f32(node->maxX)));
+  uint32x4_t hitY = vandq_u32(
+    vcltq_f32(vld1q_f32(node->minY), vdupq_n_f32(maxY)),
+    vcltq_f32(vdupq_n_f32(minY), vld1q_f32(node->maxY)));
+  uint32x4_t hit = vandq_u32(hitX, hitY);
+  return (vgetq_lane_u32(hit, 0) & 1) | (vgetq_lane_u32(hit, 1) & 2) |
+         (vgetq_lane_u32(hit, 2) & 4) | (vgetq_lane_u32(hit, 3) & 8);
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; i++) {
+    if (
+      node->minX[i] < maxX && minX < node->maxX[i] && node->minY[i] < maxY &&
+      minY < node->maxY[i]) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+static void bvh_query_wide(BVH *bvh, Box box) {
+  float minX = box.center.X - box.halfSize.X;
+  float minY = box.center.Y - box.halfSize.Y;
+  float maxX = box.center.X + box.halfSize.X;
+  float maxY = box.center.Y + box.halfSize.Y;
+
+  uint32_t stack[BVH4_STACK_SIZE];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    BVH4Node *node = &bvh->wide[stack[--top]];
+    int mask = bvh4_intersect(node, minX, minY, maxX, maxY);
+    for (int i = 0; i < 4; i++) {
+      if (!(mask & (1 << i))) {
+        continue;
+      }
+      uint32_t child = node->child[i];
+      if (child & BVH4_LEAF) {
+        arrput(bvh->scratch, child & ~BVH4_LEAF);
+      } else {
+        stack[top++] = child;
+      }
+    }
+  }
+}
+
+// Collects the leaves intersecting box into scratch.
+static void bvh_query_nodes(BVH *bvh, Box box) {
+  if (bvh->needsRebuild) {
+    bvh_rebuild(bvh);
+  }
+  arrsetlen(bvh->scratch, 0);
+  if (bvh->root == BVH_NULL) {
+    return;
+  }
+
+  if (
+    bvh->wideVersion != bvh->version &&
+    bvh->queriedVersion == bvh->version) {
+    bvh_collapse_tree(bvh);
+  }
+  bvh->queriedVersion = bvh->version;
+  if (
+    bvh->wideVersion == bvh->version && bvh->wideDepth <= BVH4_MAX_DEPTH) {
+    bvh_query_wide(bvh, box);
+    return;
+  }
+
+  arrsetlen(bvh->stack, 0);
+  arrput(bvh->stack, bvh->root);
+  while (arrlen(bvh->stack) > 0) {
+    uint32_t index = arrpop(bvh->stack);
+    BVHNode *node = &bvh->nodes[index];
+    if (!box_intersect_box(box, node->box)) {
+      continue;
+    }
+    if (bvh_is_leaf(node)) {
+      arrput(bvh->scratch, index);
+    } else {
+      arrput(bvh->stack, node->left);
+      arrput(bvh->stack, node->right);
+    }
+  }
+}
+
+// Appends the items intersecting box to result. Items with several leaves
+// (ie, nets with a box per wire segment) are only appended once per query.
+arr(ID) bvh_query(BVH *bvh, Box box, arr(ID) result) {
+  bvh_query_nodes(bvh, box);
+
+  bvh->epoch++;
+  if (bvh->epoch == 0) {
+    // wrapped, so old stamps could match again
+    for (int i = 0; i < ID_TYPE_COUNT; i++) {
+      if (bvh->visited[i]) {
+        memset(bvh->visited[i], 0, arrlen(bvh->visited[i]) * sizeof(uint32_t));
+      }
+    }
+    bvh->epoch = 1;
+  }
+
+  for (size_t i = 0; i < arrlen(bvh->scratch); i++) {
+    ID item = bvh->nodes[bvh->scratch[i]].item;
+    arr(uint32_t) *visited = &bvh->visited[id_type(item)];
+    size_t index = id_index(item);
+    size_t len = arrlen(*visited);
+    if (index >= len) {
+      arrsetlen(*visited, index + 1);
+      memset(*visited + len, 0, (index + 1 - len) * sizeof(uint32_t));
+    }
+    if ((*visited)[index] != bvh->epoch) {
+      (*visited)[index] = bvh->epoch;
+      arrput(result, item);
+    }
+  }
+  return result;
+}
+
+// Appends every leaf intersecting box to result, so an item with several
+// leaves can be hit more than once.
+arr(BVHHit) bvh_query_leaves(BVH *bvh, Box box, arr(BVHHit) result) {
+  bvh_query_nodes(bvh, box);
+  for (size_t i = 0; i < arrlen(bvh->scratch); i++) {
+    BVHNode *node = &bvh->nodes[bvh->scratch[i]];
+    arrput(
+      result, ((BVHHit){
+                .item = node->item,
+                .segment = node->segment,
+                .box = node->box,
+              }));
+  }
+  return result;
+}
+
+#define BVH_FILE_MAGIC 0x48564244 // "DBVH"
+#define BVH_FILE_VERSION 2
+
+typedef struct BVHFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  // layout of what follows, so a file from a build with different sized IDs
+  // or nodes is rejected instead of misread
+  uint32_t nodeSize;
+  uint32_t idSize;
+
+  // what the tree was built from, as given by the caller, and the bytes after
+  // the header
+  uint64_t contentHash;
+  uint64_t payloadHash;
+
+  uint32_t nodeCount;
+  uint32_t itemCount;
+  uint32_t root;
+  uint32_t freeNodes;
+  uint32_t leafCount;
+  uint32_t padding;
+} BVHFileHeader;
+
+static uint64_t bvh_payload_hash(const uint8_t *payload, size_t size) {
+  return stbds_hash_bytes((void *)payload, size, BVH_FILE_MAGIC);
+}
+
+static ID bvh_map_id(BVHIDMap *ids, ID id) {
+  if (ids == NULL) {
+    return id;
+  }
+  ptrdiff_t i = hmgeti(ids, id);
+  assert(i >= 0);
+  return ids[i].value;
+}
+
+// Appends the tree, nodes and all, to buffer as it is, ie, with the IDs of
+// this session and no hash. Only copies it, so that bvh_stamp can finish it
+// off somewhere else, like on a save thread.
+arr(uint8_t) bvh_snapshot(BVH *bvh, arr(uint8_t) buffer) {
+  assert(!bvh->needsRebuild);
+  size_t itemCount = hmlen(bvh->items);
+  BVHFileHeader header = {
+    .magic = BVH_FILE_MAGIC,
+    .version = BVH_FILE_VERSION,
+    .nodeSize = sizeof(BVHNode),
+    .idSize = sizeof(ID),
+    .nodeCount = arrlen(bvh->nodes),
+    .itemCount = itemCount,
+    .root = bvh->root,
+    .freeNodes = bvh->freeNodes,
+    .leafCount = bvh->leafCount,
+  };
+
+  size_t start = arrlen(buffer);
+  size_t payloadSize = header.nodeCount * sizeof(BVHNode) +
+                       itemCount * (sizeof(ID) + sizeof(uint32_t));
+  arrsetlen(buffer, start + sizeof(header) + payloadSize);
+  memcpy(buffer + start, &header, sizeof(header));
+
+  uint8_t *ptr = buffer + start + sizeof(header);
+  memcpy(ptr, bvh->nodes, header.nodeCount * sizeof(BVHNode));
+  ptr += header.nodeCount * sizeof(BVHNode);
+  for (size_t i = 0; i < itemCount; i++) {
+    memcpy(ptr, &bvh->items[i].key, sizeof(ID));
+    ptr += sizeof(ID);
+  }
+  for (size_t i = 0; i < itemCount; i++) {
+    memcpy(ptr, &bvh->items[i].value, sizeof(uint32_t));
+    ptr += sizeof(uint32_t);
+  }
+  return buffer;
+}
+
+// Finishes off a tree from bvh_snapshot at data: stamps it with hash, which
+// should identify what the tree was built from, and if ids isn't NULL, saves
+// the items as the IDs it maps them to. bvh_deserialize only accepts it back
+// with the same hash, so it can stand in for rebuilding the tree.
+void bvh_stamp(uint8_t *data, uint64_t hash, BVHIDMap *ids) {
+  BVHFileHeader header;
+  memcpy(&header, data, sizeof(header));
+  uint8_t *payload = data + sizeof(header);
+  size_t payloadSize =
+    (size_t)header.nodeCount * sizeof(BVHNode) +
+    (size_t)header.itemCount * (sizeof(ID) + sizeof(uint32_t));
+
+  for (size_t i = 0; ids && i < header.nodeCount; i++) {
+    uint8_t *node = payload + i * sizeof(BVHNode);
+    int32_t height;
+    memcpy(&height, node + offsetof(BVHNode, height), sizeof(int32_t));
+    if (height == 0) {
+      ID item;
+      memcpy(&item, node + offsetof(BVHNode, item), sizeof(ID));
+      item = bvh_map_id(ids, item);
+      memcpy(node + offsetof(BVHNode, item), &item, sizeof(ID));
+    }
+  }
+  uint8_t *keys = payload + header.nodeCount * sizeof(BVHNode);
+  for (size_t i = 0; ids && i < header.itemCount; i++) {
+    ID item;
+    memcpy(&item, keys + i * sizeof(ID), sizeof(ID));
+    item = bvh_map_id(ids, item);
+    memcpy(keys + i * sizeof(ID), &item, sizeof(ID));
+  }
+
+  header.contentHash = hash;
+  header.payloadHash = bvh_payload_hash(payload, payloadSize);
+  memcpy(data, &header, sizeof(header));
+}
+
+// Appends the tree to buffer, stamped and mapped as with bvh_stamp.
+arr(uint8_t)
+  bvh_serialize(BVH *bvh, uint64_t hash, BVHIDMap *ids, arr(uint8_t) buffer) {
+  size_t start = arrlen(buffer);
+  buffer = bvh_snapshot(bvh, buffer);
+  bvh_stamp(buffer + start, hash, ids);
+  return buffer;
+}
+
+// Replaces the tree with one from bvh_serialize, if it was stamped with hash
+// and is intact. Otherwise returns false and leaves the tree as it was. If ids
+// isn't NULL, the saved items are mapped through it and must all be in it.
+bool bvh_deserialize(
+  BVH *bvh, uint64_t hash, BVHIDMap *ids, const uint8_t *data, size_t size) {
+  BVHFileHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (
+    header.magic != BVH_FILE_MAGIC || header.version != BVH_FILE_VERSION ||
+    header.nodeSize != sizeof(BVHNode) || header.idSize != sizeof(ID)) {
+    log_debug("Not a BVH file this build can read");
+    return false;
+  }
+  if (header.contentHash != hash) {
+    log_debug("BVH file was built from something else");
+    return false;
+  }
+
+  size_t payloadSize =
+    (size_t)header.nodeCount * sizeof(BVHNode) +
+    (size_t)header.itemCount * (sizeof(ID) + sizeof(uint32_t));
+  const uint8_t *payload = data + sizeof(header);
+  if (
+    size - sizeof(header) != payloadSize ||
+    header.payloadHash != bvh_payload_hash(payload, payloadSize) ||
+    (header.root != BVH_NULL && header.root >= header.nodeCount) ||
+    header.leafCount > header.nodeCount) {
+    log_debug("BVH file is damaged");
+    return false;
+  }
+
+  const uint8_t *keys = payload + header.nodeCount * sizeof(BVHNode);
+  const uint8_t *values = keys + header.itemCount * sizeof(ID);
+  for (uint32_t i = 0; ids && i < header.itemCount; i++) {
+    ID key;
+    memcpy(&key, keys + i * sizeof(ID), sizeof(ID));
+    if (hmgeti(ids, key) < 0) {
+      log_debug("BVH file has items that aren't there anymore");
+      return false;
+    }
+  }
+
+  arrsetlen(bvh->nodes, header.nodeCount);
+  memcpy(bvh->nodes, payload, header.nodeCount * sizeof(BVHNode));
+  for (uint32_t i = 0; ids && i < header.nodeCount; i++) {
+    BVHNode *node = &bvh->nodes[i];
+    if (node->height == 0) {
+      node->item = hmget(ids, node->item);
+    }
+  }
+  hmfree(bvh->items);
+  for (uint32_t i = 0; i < header.itemCount; i++) {
+    ID key;
+    uint32_t value;
+    memcpy(&key, keys + i * sizeof(ID), sizeof(ID));
+    memcpy(&value, values + i * sizeof(uint32_t), sizeof(uint32_t));
+    hmput(bvh->items, bvh_map_id(ids, key), value);
+  }
+
+  arrsetlen(bvh->stack, 0);
+  bvh->root = header.root;
+  bvh->freeNodes = header.freeNodes;
+  bvh->leafCount = header.leafCount;
+  bvh->needsRebuild = false;
+  bvh->version++;
+  return true;
 }
@@ -135,19 +135,31 @@ static PortID circuit_add_port(
   if (!circuit_has(circuit, component->portFirst)) {
     component->portFirst = id;
   }
-  circuit_update_id(circuit, componentID);
 
   return id;
 }
 
-static void circuit_augment_component(void *user, ComponentID id, void *ptr) {
+static void circuit_augment_components(
+  void *user, ComponentID *ids, void *ptr, uint32_t count) {
   Circuit *circuit = user;
-  Component *component = ptr;
-
-  ComponentDescID desc = component->desc;
-  int numPorts = circuit->componentDescs[desc].numPorts;
-  for (int i = 0; i < numPorts; i++) {
-    circuit_add_port(circuit, id, desc, i);
+  Component *components = ptr;
+
+  // each port has a label, so make room for all of them up front
+  uint32_t numPorts = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    numPorts += circuit->componentDescs[components[i].desc].numPorts;
+  }
+  smap_reserve(&circuit->sm.ports, circuit_port_len(circuit) + numPorts);
+  smap_reserve(&circuit->sm.labels, circuit_label_len(circuit) + numPorts);
+
+  for (uint32_t i = 0; i < count; i++) {
+    ComponentID id = ids[i];
+    ComponentDescID desc = components[i].desc;
+    int portCount = circuit->componentDescs[desc].numPorts;
+    for (int j = 0; j < portCount; j++) {
+      circuit_add_port(circuit, id, desc, j);
+    }
+    circuit_update_id(circuit, id);
   }
 }
 
@@ -300,6 +312,190 @@ static void circuit_endpoint_deleted(void *user, ID id, void *ptr) {
   }
 }
 
+static void circuit_invalidate_net_index(void *user, ID id, void *ptr) {
+  Circuit *circuit = user;
+  circuit->netIndex.valid = false;
+}
+
+// Returns the net adjacency index, rebuilding it first if nets have gained or
+// lost endpoints or waypoints since it was last built.
+NetIndex *circuit_net_index(Circuit *circuit) {
+  NetIndex *index = &circuit->netIndex;
+  if (index->valid) {
+    return index;
+  }
+
+  int netCount = circuit_net_len(circuit);
+  arrsetlen(index->endpointStart, netCount + 1);
+  arrsetlen(index->waypointStart, netCount + 1);
+  arrsetlen(index->endpoints, 0);
+  arrsetlen(index->waypoints, 0);
+  arrsetcap(index->endpoints, circuit_endpoint_len(circuit));
+  arrsetcap(index->waypoints, circuit_waypoint_len(circuit));
+
+  for (int i = 0; i < netCount; i++) {
+    Net *net = &circuit->nets[i];
+
+    index->endpointStart[i] = arrlen(index->endpoints);
+    EndpointID endpointID = net->endpointFirst;
+    while (circuit_has(circuit, endpointID)) {
+      arrput(index->endpoints, circuit_index(circuit, endpointID));
+      endpointID = circuit_endpoint_ptr(circuit, endpointID)->next;
+    }
+
+    index->waypointStart[i] = arrlen(index->waypoints);
+    WaypointID waypointID = net->waypointFirst;
+    while (circuit_has(circuit, waypointID)) {
+      arrput(index->waypoints, circuit_index(circuit, waypointID));
+      waypointID = circuit_waypoint_ptr(circuit, waypointID)->next;
+    }
+  }
+  index->endpointStart[netCount] = arrlen(index->endpoints);
+  index->waypointStart[netCount] = arrlen(index->waypoints);
+
+  index->valid = true;
+  return index;
+}
+
+#define TEXT_TABLE_MIN 64
+#define TEXT_GARBAGE_MIN 4096
+
+static uint32_t circuit_text_hash(const char *text) {
+  return (uint32_t)stbds_hash_string((char *)text, 0);
+}
+
+// Finds the slot in the text table holding text, or the empty slot where it
+// would go.
+static uint32_t *
+circuit_text_slot(Circuit *circuit, const char *text, uint32_t hash) {
+  uint32_t mask = arrlen(circuit->textTable) - 1;
+  uint32_t i = hash & mask;
+  while (circuit->textTable[i] != 0) {
+    TextEntry *entry = &circuit->textEntries[circuit->textTable[i] - 1];
+    if (
+      entry->hash == hash && strcmp(circuit->text + entry->offset, text) == 0) {
+      return &circuit->textTable[i];
+    }
+    i = (i + 1) & mask;
+  }
+  return &circuit->textTable[i];
+}
+
+static void circuit_text_rehash(Circuit *circuit, uint32_t size) {
+  arrsetlen(circuit->textTable, size);
+  memset(circuit->textTable, 0, size * sizeof(uint32_t));
+  uint32_t mask = size - 1;
+  for (uint32_t e = 0; e < arrlen(circuit->textEntries); e++) {
+    uint32_t i = circuit->textEntries[e].hash & mask;
+    while (circuit->textTable[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    circuit->textTable[i] = e + 1;
+  }
+}
+
+// Rebuilds the text pool with only the strings that are still referenced and
+// points all the labels at their new offsets.
+static void circuit_text_compact(Circuit *circuit) {
+  arr(char) text = NULL;
+  arrsetcap(text, arrlen(circuit->text) - circuit->textGarbage);
+
+  // move the live strings, remembering the new offset in each entry
+  arr(uint32_t) newOffsets = NULL;
+  arrsetlen(newOffsets, arrlen(circuit->textEntries));
+  for (uint32_t e = 0; e < arrlen(circuit->textEntries); e++) {
+    TextEntry *entry = &circuit->textEntries[e];
+    if (entry->refs == 0) {
+      continue;
+    }
+    const char *str = circuit->text + entry->offset;
+    size_t len = strlen(str) + 1;
+    newOffsets[e] = arrlen(text);
+    memcpy(arraddnptr(text, len), str, len);
+  }
+
+  for (uint32_t i = 0; i < circuit_label_len(circuit); i++) {
+    Label *label = &circuit->labels[i];
+    const char *str = circuit->text + label->textOffset;
+    uint32_t *slot = circuit_text_slot(circuit, str, circuit_text_hash(str));
+    assert(*slot != 0);
+    label->textOffset = newOffsets[*slot - 1];
+    circuit_touch_index(circuit, ID_LABEL, i);
+  }
+
+  uint32_t live = 0;
+  for (uint32_t e = 0; e < arrlen(circuit->textEntries); e++) {
+    if (circuit->textEntries[e].refs > 0) {
+      circuit->textEntries[live] = circuit->textEntries[e];
+      circuit->textEntries[live].offset = newOffsets[e];
+      live++;
+    }
+  }
+  arrsetlen(circuit->textEntries, live);
+  arrfree(newOffsets);
+
+  arrfree(circuit->text);
+  circuit->text = text;
+  circuit->textGarbage = 0;
+  circuit_text_rehash(circuit, arrlen(circuit->textTable));
+}
+
+static uint32_t circuit_text_intern(Circuit *circuit, const char *text) {
+  if (
+    circuit->textGarbage > TEXT_GARBAGE_MIN &&
+    circuit->textGarbage * 2 > arrlen(circuit->text)) {
+    circuit_text_compact(circuit);
+  }
+
+  // keep the load factor at or below one half
+  uint32_t size = arrlen(circuit->textTable);
+  if ((arrlen(circuit->textEntries) + 1) * 2 > size) {
+    circuit_text_rehash(
+      circuit, size < TEXT_TABLE_MIN ? TEXT_TABLE_MIN : size * 2);
+  }
+
+  uint32_t hash = circuit_text_hash(text);
+  uint32_t *slot = circuit_text_slot(circuit, text, hash);
+  if (*slot != 0) {
+    TextEntry *entry = &circuit->textEntries[*slot - 1];
+    if (entry->refs == 0) {
+      circuit->textGarbage -= strlen(text) + 1;
+    }
+    entry->refs++;
+    return entry->offset;
+  }
+
+  size_t len = strlen(text) + 1;
+  uint32_t offset = arrlen(circuit->text);
+  memcpy(arraddnptr(circuit->text, len), text, len);
+  arrput(
+    circuit->textEntries,
+    ((TextEntry){.offset = offset, .refs = 1, .hash = hash}));
+  *slot = arrlen(circuit->textEntries);
+  return offset;
+}
+
+static void circuit_label_deleted(void *user, ID id, void *ptr) {
+  Circuit *circuit = user;
+  Label *label = ptr;
+
+  if (arrlen(circuit->textTable) == 0) {
+    return;
+  }
+
+  const char *text = circuit->text + label->textOffset;
+  uint32_t *slot = circuit_text_slot(circuit, text, circuit_text_hash(text));
+  if (*slot == 0) {
+    return;
+  }
+  TextEntry *entry = &circuit->textEntries[*slot - 1];
+  assert(entry->refs > 0);
+  entry->refs--;
+  if (entry->refs == 0) {
+    circuit->textGarbage += strlen(text) + 1;
+  }
+}
+
 void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs) {
   *circuit = (Circuit){.componentDescs = componentDescs};
 
@@ -307,7 +503,9 @@ void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs) {
   smap_add_synced_array(
     &circuit->sm.components, (void **)&circuit->components,
     sizeof(*circuit->components));
-  circuit_on_component_create(circuit, circuit, circuit_augment_component);
+  smap_on_create(
+    &circuit->sm.components, circuit->components,
+    (SmapCallback){.user = circuit, .fnMany = circuit_augment_components});
   circuit_on_component_delete(circuit, circuit, circuit_componented_deleted);
 
   smap_init(&circuit->sm.ports, ID_PORT);
@@ -319,6 +517,8 @@ void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs) {
   smap_add_synced_array(
     &circuit->sm.nets, (void **)&circuit->nets, sizeof(*circuit->nets));
   circuit_on_net_delete(circuit, circuit, circuit_net_deleted);
+  circuit_on_net_create(circuit, circuit, circuit_invalidate_net_index);
+  circuit_on_net_delete(circuit, circuit, circuit_invalidate_net_index);
 
   smap_init(&circuit->sm.waypoints, ID_WAYPOINT);
   smap_add_synced_array(
@@ -326,6 +526,8 @@ void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs) {
     sizeof(*circuit->waypoints));
   circuit_on_waypoint_create(circuit, circuit, circuit_augment_waypoint);
   circuit_on_waypoint_delete(circuit, circuit, circuit_waypoint_deleted);
+  circuit_on_waypoint_create(circuit, circuit, circuit_invalidate_net_index);
+  circuit_on_waypoint_delete(circuit, circuit, circuit_invalidate_net_index);
 
   smap_init(&circuit->sm.endpoints, ID_ENDPOINT);
   smap_add_synced_array(
@@ -333,10 +535,13 @@ void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs) {
     sizeof(*circuit->endpoints));
   circuit_on_endpoint_create(circuit, circuit, circuit_augment_endpoint);
   circuit_on_endpoint_delete(circuit, circuit, circuit_endpoint_deleted);
+  circuit_on_endpoint_create(circuit, circuit, circuit_invalidate_net_index);
+  circuit_on_endpoint_delete(circuit, circuit, circuit_invalidate_net_index);
 
   smap_init(&circuit->sm.labels, ID_LABEL);
   smap_add_synced_array(
     &circuit->sm.labels, (void **)&circuit->labels, sizeof(*circuit->labels));
+  circuit_on_label_delete(circuit, circuit, circuit_label_deleted);
 }
 
 void circuit_free(Circuit *circuit) {
@@ -347,7 +552,12 @@ void circuit_free(Circuit *circuit) {
   smap_free(&circuit->sm.endpoints);
   smap_free(&circuit->sm.labels);
   arrfree(circuit->text);
-  hmfree(circuit->nextName);
+  arrfree(circuit->textEntries);
+  arrfree(circuit->textTable);
+  arrfree(circuit->netIndex.endpointStart);
+  arrfree(circuit->netIndex.endpoints);
+  arrfree(circuit->netIndex.waypointStart);
+  arrfree(circuit->netIndex.waypoints);
   arrfree(circuit->wires);
   arrfree(circuit->vertices);
 }
@@ -360,66 +570,188 @@ void circuit_clear(Circuit *circuit) {
   smap_clear(&circuit->sm.endpoints);
   smap_clear(&circuit->sm.labels);
   arrsetlen(circuit->text, 0);
-  for (int i = 0; i < hmlen(circuit->nextName); i++) {
-    hmdel(circuit->nextName, circuit->nextName[i].key);
-  }
+  arrsetlen(circuit->textEntries, 0);
+  arrsetlen(circuit->textTable, 0);
+  circuit->textGarbage = 0;
+  circuit->netIndex.valid = false;
+  memset(circuit->nextName, 0, sizeof(circuit->nextName));
   arrsetlen(circuit->wires, 0);
   arrsetlen(circuit->vertices, 0);
 }
 
+// Makes all the sparse maps of the circuit allocate from allocator. Must be
+// called before anything is added to the circuit. The text pool, wires and
+// vertices are still on the heap. Meant for circuits that are filled once and
+// then thrown away, like clones. The editor's own circuits grow and shrink
+// forever, and circuit_clear keeps their storage, so they stay on the heap.
+void circuit_set_allocator(Circuit *circuit, Allocator *allocator) {
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    smap_set_allocator(&circuit->sparsemaps[i], allocator);
+  }
+}
+
+// Returns how many bytes the sparse maps of the circuit need at their current
+// capacity, which is a good size for an arena to clone the circuit into.
+size_t circuit_storage_size(Circuit *circuit) {
+  size_t size = 0;
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    SparseMap *smap = &circuit->sparsemaps[i];
+    // plus alignment padding for each array
+    size += smap_storage_size(smap, smap->capacity) +
+            (arrlen(smap->syncedArrays) + 1) * 16;
+  }
+  return size;
+}
+
+void circuit_track_dirty(Circuit *circuit, bool enabled) {
+  if (!enabled) {
+    circuit_flush_dirty(circuit);
+  }
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    circuit->sparsemaps[i].trackDirty = enabled;
+  }
+}
+
+void circuit_flush_dirty(Circuit *circuit) {
+  // flushing one type can dirty another (ie, components move their endpoints),
+  // so repeat until all maps are clean
+  bool dirty = true;
+  while (dirty) {
+    dirty = false;
+    for (int i = 0; i < ID_TYPE_COUNT; i++) {
+      if (circuit->sparsemaps[i].dirtyCount > 0) {
+        smap_flush_dirty(&circuit->sparsemaps[i]);
+        dirty = true;
+      }
+    }
+  }
+}
+
+// Makes dst a snapshot of src that can be read while src continues to change,
+// ie, on another thread. If dst is already a snapshot of src, only the pages
+// of each map that changed since the last snapshot are copied. dst must not be
+// modified other than by taking snapshots, or the next one will be a full copy.
+void circuit_snapshot(Circuit *dst, Circuit *src) {
+  dst->componentDescs = src->componentDescs;
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    smap_snapshot(&dst->sparsemaps[i], &src->sparsemaps[i]);
+  }
+
+  arrsetlen(dst->text, arrlen(src->text));
+  memcpy(dst->text, src->text, arrlen(src->text));
+
+  memcpy(dst->nextName, src->nextName, sizeof(dst->nextName));
+  dst->netIndex.valid = false;
+
+  // the wires are regenerated by every route, so they are always copied
+  arrsetlen(dst->wires, arrlen(src->wires));
+  if (arrlen(src->wires) > 0) {
+    memcpy(dst->wires, src->wires, arrlen(src->wires) * sizeof(Wire));
+  }
+
+  arrsetlen(dst->vertices, arrlen(src->vertices));
+  if (arrlen(src->vertices) > 0) {
+    memcpy(
+      dst->vertices, src->vertices, arrlen(src->vertices) * sizeof(HMM_Vec2));
+  }
+}
+
+// Copies src into dst, reusing the capacity dst already has. No callbacks
+// are called, so dst should be a plain circuit or at least be set up the same
+// way as src.
 void circuit_clone_from(Circuit *dst, Circuit *src) {
-  circuit_clear(dst);
   dst->componentDescs = src->componentDescs;
   for (int i = 0; i < ID_TYPE_COUNT; i++) {
     smap_clone_from(&dst->sparsemaps[i], &src->sparsemaps[i]);
   }
+
   arrsetlen(dst->text, arrlen(src->text));
-  memcpy(dst->text, src->text, arrlen(src->text));
+  if (arrlen(src->text) > 0) {
+    memcpy(dst->text, src->text, arrlen(src->text));
+  }
 
-  for (int i = 0; i < hmlen(dst->nextName); i++) {
-    hmdel(dst->nextName, dst->nextName[i].key);
+  arrsetlen(dst->textEntries, arrlen(src->textEntries));
+  if (arrlen(src->textEntries) > 0) {
+    memcpy(
+      dst->textEntries, src->textEntries,
+      arrlen(src->textEntries) * sizeof(TextEntry));
   }
-  for (int i = 0; i < hmlen(src->nextName); i++) {
-    hmput(dst->nextName, src->nextName[i].key, src->nextName[i].value);
+  arrsetlen(dst->textTable, arrlen(src->textTable));
+  if (arrlen(src->textTable) > 0) {
+    memcpy(
+      dst->textTable, src->textTable,
+      arrlen(src->textTable) * sizeof(uint32_t));
   }
+  dst->textGarbage = src->textGarbage;
+
+  memcpy(dst->nextName, src->nextName, sizeof(dst->nextName));
+  dst->netIndex.valid = false;
 
   arrsetlen(dst->wires, arrlen(src->wires));
-  memcpy(dst->wires, src->wires, arrlen(src->wires));
+  if (arrlen(src->wires) > 0) {
+    memcpy(dst->wires, src->wires, arrlen(src->wires) * sizeof(Wire));
+  }
 
   arrsetlen(dst->vertices, arrlen(src->vertices));
-  memcpy(dst->vertices, src->vertices, arrlen(src->vertices));
+  if (arrlen(src->vertices) > 0) {
+    memcpy(
+      dst->vertices, src->vertices, arrlen(src->vertices) * sizeof(HMM_Vec2));
+  }
 }
 
-ComponentID circuit_add_component(
+static Component circuit_make_component(
   Circuit *circuit, ComponentDescID desc, HMM_Vec2 position) {
-
   LabelID typeLabel = circuit_add_label(
     circuit, circuit->componentDescs[desc].typeName, (Box){0});
 
-  int num = hmget(circuit->nextName, circuit->componentDescs[desc].namePrefix);
+  unsigned char prefix = circuit->componentDescs[desc].namePrefix;
+  int num = circuit->nextName[prefix];
   if (num < 1) {
     num = 1;
   }
-  hmput(circuit->nextName, circuit->componentDescs[desc].namePrefix, num + 1);
+  circuit->nextName[prefix] = num + 1;
   char name[256];
   snprintf(
     name, sizeof(name), "%c%d", circuit->componentDescs[desc].namePrefix, num);
 
   LabelID nameLabel = circuit_add_label(circuit, name, (Box){0});
 
-  ComponentID id = smap_add(
-    &circuit->sm.components, &(Component){
-                               .desc = desc,
-                               .typeLabel = typeLabel,
-                               .nameLabel = nameLabel,
-                               .box.center = position,
-                             });
+  return (Component){
+    .desc = desc,
+    .typeLabel = typeLabel,
+    .nameLabel = nameLabel,
+    .box.center = position,
+  };
+}
+
+ComponentID circuit_add_component(
+  Circuit *circuit, ComponentDescID desc, HMM_Vec2 position) {
+  Component component = circuit_make_component(circuit, desc, position);
+  ComponentID id = smap_add(&circuit->sm.components, &component);
   // NOTE: Do not add code here to further set up components, add it to
-  // circuit_augment_component instead. Otherwise the view on_create callback
+  // circuit_augment_components instead. Otherwise the view on_create callback
   // will not see the changes.
   return id;
 }
 
+void circuit_add_components(
+  Circuit *circuit, ComponentDescID *descs, HMM_Vec2 *positions,
+  uint32_t count, ComponentID *ids) {
+  smap_reserve(&circuit->sm.labels, circuit_label_len(circuit) + count * 2);
+
+  arr(Component) components = NULL;
+  arrsetlen(components, count);
+  for (uint32_t i = 0; i < count; i++) {
+    components[i] = circuit_make_component(circuit, descs[i], positions[i]);
+  }
+
+  // all the components are created first, then the create callbacks are run
+  // over the whole batch
+  smap_add_many(&circuit->sm.components, components, count, ids);
+
+  arrfree(components);
+}
+
 void circuit_move_component(Circuit *circuit, ComponentID id, HMM_Vec2 delta) {
   Component *component = circuit_component_ptr(circuit, id);
   assert(!isnan(delta.X));
@@ -432,7 +764,7 @@ void circuit_move_component(Circuit *circuit, ComponentID id, HMM_Vec2 delta) {
 void circuit_move_component_to(Circuit *circuit, ComponentID id, HMM_Vec2 pos) {
   Component *component = circuit_component_ptr(circuit, id);
   component->box.center = pos;
-  log_debug("Moving component %x to %f %f", id, pos.X, pos.Y);
+  log_debug("Moving component %" PRIxID " to %f %f", id, pos.X, pos.Y);
   circuit_update_id(circuit, id);
 }
 
@@ -495,7 +827,8 @@ EndpointID circuit_add_endpoint(
 
 void circuit_endpoint_connect(
   Circuit *circuit, EndpointID endpointID, PortID portID) {
-  log_debug("Connecting endpoint %x to port %x", endpointID, portID);
+  log_debug(
+    "Connecting endpoint %" PRIxID " to port %" PRIxID "", endpointID, portID);
 
   Endpoint *endpoint = circuit_endpoint_ptr(circuit, endpointID);
 
@@ -511,30 +844,7 @@ void circuit_endpoint_connect(
 }
 
 LabelID circuit_add_label(Circuit *circuit, const char *text, Box bounds) {
-  char *found = NULL;
-  int searchlen = strlen(text) + 1;
-  int matches = 0;
-  for (int i = 0; i < arrlen(circuit->text); i++) {
-    if (circuit->text[i] == text[matches]) {
-      matches++;
-      if (matches == searchlen) {
-        found = &circuit->text[i - matches + 1];
-        break;
-      }
-    } else {
-      matches = 0;
-    }
-  }
-
-  uint32_t textOffset = arrlen(circuit->text);
-  if (found) {
-    textOffset = found - circuit->text;
-  } else {
-    for (const char *c = text; *c; c++) {
-      arrput(circuit->text, *c);
-    }
-    arrput(circuit->text, '\0');
-  }
+  uint32_t textOffset = circuit_text_intern(circuit, text);
 
   LabelID id = smap_add(
     &circuit->sm.labels, &(Label){.textOffset = textOffset, .box = bounds});
@@ -551,7 +861,7 @@ void circuit_write_dot(Circuit *circuit, FILE *file) {
   fprintf(file, "  rankdir=LR;\n");
   fprintf(file, "  node [shape=record];\n");
 
-  for (ComponentID i = 0; i < circuit_component_len(circuit); i++) {
+  for (int i = 0; i < circuit_component_len(circuit); i++) {
     Component comp = circuit->components[i];
     const ComponentDesc *desc = &circuit->componentDescs[comp.desc];
     // const char *typeName = circuit_label_text(circuit, comp.typeLabel);
@@ -574,11 +884,12 @@ void circuit_write_dot(Circuit *circuit, FILE *file) {
   int floatPoint = 0;
   char startEndpointText[256];
 
+  NetIndex *index = circuit_net_index(circuit);
   for (int netIndex = 0; netIndex < circuit_net_len(circuit); netIndex++) {
-    Net *net = &circuit->nets[netIndex];
-    EndpointID startEndpointID = net->endpointFirst;
-    while (circuit_has(circuit, startEndpointID)) {
-      Endpoint *startEndpoint = circuit_endpoint_ptr(circuit, startEndpointID);
+    uint32_t first = index->endpointStart[netIndex];
+    uint32_t last = index->endpointStart[netIndex + 1];
+    for (uint32_t j = first; j < last; j++) {
+      Endpoint *startEndpoint = &circuit->endpoints[index->endpoints[j]];
 
       if (circuit_has(circuit, startEndpoint->port)) {
         Port *port = circuit_port_ptr(circuit, startEndpoint->port);
@@ -589,18 +900,9 @@ void circuit_write_dot(Circuit *circuit, FILE *file) {
         snprintf(startEndpointText, 256, "f%d", floatPoint++);
       }
 
-      EndpointID endEndpointID = net->endpointFirst;
-      while (circuit_has(circuit, endEndpointID) &&
-             endEndpointID != startEndpointID) {
-        Endpoint *endEndpoint = circuit_endpoint_ptr(circuit, startEndpointID);
-        endEndpointID = endEndpoint->next;
-      }
-      if (endEndpointID == startEndpointID) {
-        Endpoint *endEndpoint = circuit_endpoint_ptr(circuit, startEndpointID);
-        endEndpointID = endEndpoint->next;
-      }
-      while (circuit_has(circuit, endEndpointID)) {
-        Endpoint *endEndpoint = circuit_endpoint_ptr(circuit, startEndpointID);
+      // connect it to every endpoint after it in the net
+      for (uint32_t k = j + 1; k < last; k++) {
+        Endpoint *endEndpoint = &circuit->endpoints[index->endpoints[k]];
         if (circuit_has(circuit, endEndpoint->port)) {
           Port *port = circuit_port_ptr(circuit, endEndpoint->port);
           fprintf(
@@ -609,9 +911,7 @@ void circuit_write_dot(Circuit *circuit, FILE *file) {
         } else {
           fprintf(file, "  %s -- f%d", startEndpointText, floatPoint++);
         }
-        endEndpointID = endEndpoint->next;
       }
-      startEndpointID = startEndpoint->next;
     }
   }
 
@@ -18,6 +18,7 @@
 #define CORE_H
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -64,7 +65,20 @@ IDType;
 
 #define ID_TYPE_COUNT 7
 
+// Define ID_64BIT to use 64 bit IDs. These have enough generation bits that a
+// stale ID will practically never alias a live item, and enough index bits for
+// very large netlists, at the cost of twice the memory for every stored ID.
+#ifdef ID_64BIT
+typedef uint64_t ID;
+#define ID_BITS 64
+#define ID_GEN_BITS 29
+#define PRIxID PRIx64
+#else
 typedef uint32_t ID;
+#define ID_BITS 32
+#define ID_GEN_BITS 7
+#define PRIxID PRIx32
+#endif
 #define NO_ID 0
 
 typedef uint32_t Gen;
@@ -72,12 +86,11 @@ typedef uint32_t Gen;
 #define smap(type) type *
 
 #define ID_TYPE_BITS 3
-#define ID_GEN_BITS 7
-#define ID_INDEX_BITS (32 - ID_TYPE_BITS - ID_GEN_BITS)
+#define ID_INDEX_BITS (ID_BITS - ID_TYPE_BITS - ID_GEN_BITS)
 
-#define ID_TYPE_MASK ((1 << ID_TYPE_BITS) - 1)
-#define ID_GEN_MASK ((1 << ID_GEN_BITS) - 1)
-#define ID_INDEX_MASK ((1 << ID_INDEX_BITS) - 1)
+#define ID_TYPE_MASK (((ID)1 << ID_TYPE_BITS) - 1)
+#define ID_GEN_MASK (((ID)1 << ID_GEN_BITS) - 1)
+#define ID_INDEX_MASK (((ID)1 << ID_INDEX_BITS) - 1)
 
 #define ID_TYPE_SHIFT (ID_GEN_BITS + ID_INDEX_BITS)
 #define ID_GEN_SHIFT (ID_INDEX_BITS)
@@ -161,33 +174,110 @@ static inline bool box_equal(Box a, Box b) {
   return HMM_EqV2(a.center, b.center) && HMM_EqV2(a.halfSize, b.halfSize);
 }
 
+static inline bool box_contains_box(Box outer, Box inner) {
+  HMM_Vec2 otl = box_top_left(outer);
+  HMM_Vec2 obr = box_bottom_right(outer);
+  HMM_Vec2 itl = box_top_left(inner);
+  HMM_Vec2 ibr = box_bottom_right(inner);
+  return itl.X >= otl.X && itl.Y >= otl.Y && ibr.X <= obr.X && ibr.Y <= obr.Y;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Bounding Volume Hierarchy
 ////////////////////////////////////////////////////////////////////////////////
 
+#define BVH_NULL UINT32_MAX
+#define BVH_DEFAULT_THREADS 8
+
+// A dynamic BVH: a binary tree with one item box per leaf, kept balanced with
+// rotations as leaves come and go, so that adding, removing and updating a
+// leaf are all O(log n).
 typedef struct BVHNode {
   Box box;
-  uint32_t firstLeaf;
-  uint32_t numLeaves;
+  uint32_t parent;
+  uint32_t left;
+  uint32_t right;
 
-  // for debugging
-  float median;
-  int axis;
+  // height of the subtree, 0 for a leaf and -1 for a free node
+  int32_t height;
+
+  // leaves only: the item and the next leaf with the same item. free nodes use
+  // nextLeaf to link the free list.
+  ID item;
+  uint32_t nextLeaf;
+
+  // leaves only: which of the item's boxes this is, in the order they were
+  // added (ie, the index into the boxes given to bvh_set_boxes)
+  uint32_t segment;
 } BVHNode;
 
-typedef struct BVHLeaf {
-  Box box;
+typedef struct BVHItem {
+  ID key;
+  uint32_t value;
+} BVHItem;
+
+// Maps the IDs of the items in a tree to other IDs, ie, to ones that stay the
+// same when the tree is saved in one session and loaded in another.
+typedef struct BVHIDMap {
+  ID key;
+  ID value;
+} BVHIDMap;
+
+// A node of the BVH collapsed to four children per node for queries. The
+// children's bounds are stored lane by lane so all four can be tested at once.
+typedef struct BVH4Node {
+  float minX[4];
+  float minY[4];
+  float maxX[4];
+  float maxY[4];
+  // the wide node, or BVH4_LEAF | the leaf's index in BVH.nodes, or BVH_NULL
+  // for an empty lane
+  uint32_t child[4];
+} BVH4Node;
+
+#define BVH4_LEAF 0x80000000u
+
+// A leaf-level query hit.
+typedef struct BVHHit {
   ID item;
-} BVHLeaf;
+  uint32_t segment;
+  Box box;
+} BVHHit;
 
 typedef struct BVH {
-  arr(BVHNode) nodeHeap;
+  arr(BVHNode) nodes;
+  uint32_t root;
+  uint32_t freeNodes;
+  uint32_t leafCount;
 
-  arr(BVHLeaf) leaves;
+  // hash map from item to the first leaf holding it. an item can have several
+  // leaves (ie, one per wire segment of a net)
+  BVHItem *items;
 
   arr(uint32_t) stack;
   arr(uint32_t) scratch;
-
+  arr(uint32_t) slots;
+
+  // the query epoch each item was last returned in, per ID type and indexed by
+  // ID index, so queries dedupe items with several leaves in O(1)
+  arr(uint32_t) visited[ID_TYPE_COUNT];
+  uint32_t epoch;
+
+  // the tree collapsed for queries, valid while wideVersion == version. it's
+  // only collapsed once a query sees the tree unchanged since the last query,
+  // so that queries between edits (ie, while dragging) don't pay for it.
+  arr(BVH4Node) wide;
+  uint32_t version;
+  uint32_t wideVersion;
+  uint32_t queriedVersion;
+  int wideDepth;
+
+  // number of threads bvh_rebuild may use to build big trees. the layout of
+  // the tree doesn't depend on it.
+  int threads;
+
+  // after bvh_clear, leaves are only collected until the next rebuild, which
+  // builds the whole tree in one go
   bool needsRebuild;
 } BVH;
 
@@ -196,9 +286,57 @@ void bvh_free(BVH *bvh);
 void bvh_clear(BVH *bvh);
 void bvh_add(BVH *bvh, ID item, Box box);
 void bvh_remove(BVH *bvh, ID item, Box box);
+void bvh_remove_item(BVH *bvh, ID item);
 void bvh_update(BVH *bvh, ID item, Box oldBox, Box newBox);
+bool bvh_set_boxes(BVH *bvh, ID item, Box *boxes, int count);
 void bvh_rebuild(BVH *bvh);
 arr(ID) bvh_query(BVH *bvh, Box box, arr(ID) result);
+arr(BVHHit) bvh_query_leaves(BVH *bvh, Box box, arr(BVHHit) result);
+arr(uint8_t) bvh_snapshot(BVH *bvh, arr(uint8_t) buffer);
+void bvh_stamp(uint8_t *data, uint64_t hash, BVHIDMap *ids);
+arr(uint8_t)
+  bvh_serialize(BVH *bvh, uint64_t hash, BVHIDMap *ids, arr(uint8_t) buffer);
+bool bvh_deserialize(
+  BVH *bvh, uint64_t hash, BVHIDMap *ids, const uint8_t *data, size_t size);
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocator
+////////////////////////////////////////////////////////////////////////////////
+
+// Where a SparseMap gets the memory for its ids and synced arrays. realloc
+// allocates when ptr is NULL and frees when newSize is 0. A NULL allocator
+// means the C heap.
+typedef struct Allocator {
+  void *(*realloc)(void *user, void *ptr, size_t oldSize, size_t newSize);
+  void *user;
+} Allocator;
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+  size_t used;
+} ArenaBlock;
+
+// A linear allocator: allocations are bumped out of large blocks and only
+// given back all at once by arena_reset. Resizing the most recent allocation
+// happens in place. Size the first block from a capacity hint (ie,
+// circuit_storage_size) so that everything fits in one block.
+typedef struct Arena {
+  ArenaBlock *blocks;
+  size_t blockSize;
+  void *last;
+
+  // diagnostics - bytes in use now and at most since arena_init
+  uint32_t blockCount;
+  size_t used;
+  size_t peak;
+} Arena;
+
+void arena_init(Arena *arena, size_t capacity);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+Allocator arena_allocator(Arena *arena);
 
 ////////////////////////////////////////////////////////////////////////////////
 // SparseMap
@@ -209,6 +347,10 @@ struct SparseMap;
 typedef struct SmapCallback {
   void *user;
   void (*fn)(void *user, ID id, void *ptr);
+
+  // optional: if set, it is called instead of fn with a whole range of
+  // contiguous elements at once, such as the ones added by smap_add_many
+  void (*fnMany)(void *user, ID *ids, void *ptr, uint32_t count);
 } SmapCallback;
 
 typedef struct SyncedArray {
@@ -223,6 +365,9 @@ typedef struct SparseMap {
   // has the full id of each element
   ID *ids;
 
+  // where ids and the synced arrays are allocated, NULL for the heap
+  Allocator *allocator;
+
   // length and capacity of all synced arrays
   uint32_t length;
   uint32_t capacity;
@@ -239,10 +384,40 @@ typedef struct SparseMap {
 
   // internal - list of synced arrays
   arr(SyncedArray) syncedArrays;
+
+  // internal - when dirty tracking is on, updates only set a bit per sparse
+  // index here and the update callbacks are deferred until smap_flush_dirty
+  bool trackDirty;
+  uint32_t dirtyCount;
+  arr(uint64_t) dirty;
+
+  // diagnostics - number of times a handle's generation ran out. the handle
+  // is then retired rather than reused, unless the index space is exhausted
+  // too, in which case the generation wraps and stale IDs may alias.
+  uint32_t genOverflows;
+  uint32_t genWraps;
+
+  // internal - for incremental snapshots, each page of elements is stamped
+  // with the version it last changed in, and the version is bumped every time
+  // a snapshot is taken
+  uint32_t version;
+  uint32_t sparseVersion;
+  arr(uint32_t) pageVersions;
+
+  // internal - if this map is a snapshot, the map it is a snapshot of and the
+  // oldest version of that map which has not been copied yet
+  struct SparseMap *snapshotOf;
+  uint32_t snapshotVersion;
 } SparseMap;
 
+// number of elements per page in an incremental snapshot
+#define SMAP_PAGE_SHIFT 8
+#define SMAP_PAGE_SIZE (1 << SMAP_PAGE_SHIFT)
+
 void smap_init(SparseMap *smap, IDType type);
 void smap_free(SparseMap *smap);
+void smap_set_allocator(SparseMap *smap, Allocator *allocator);
+size_t smap_storage_size(SparseMap *smap, uint32_t capacity);
 void smap_clone_from(SparseMap *dst, SparseMap *src);
 
 void smap_add_synced_array(SparseMap *smap, void **ptr, uint32_t elemSize);
@@ -251,10 +426,16 @@ void smap_on_update(SparseMap *smap, void *array, SmapCallback callback);
 void smap_on_delete(SparseMap *smap, void *array, SmapCallback callback);
 
 void smap_clear(SparseMap *smap);
+bool smap_reserve(SparseMap *smap, uint32_t capacity);
 ID smap_add(SparseMap *smap, void *value);
+bool smap_add_many(SparseMap *smap, void *values, uint32_t count, ID *ids);
 void smap_del(SparseMap *smap, ID id);
 void smap_update_id(SparseMap *smap, ID id);
 void smap_update_index(SparseMap *smap, uint32_t index);
+void smap_track_dirty(SparseMap *smap, bool enabled);
+void smap_flush_dirty(SparseMap *smap);
+void smap_touch(SparseMap *smap, uint32_t index);
+void smap_snapshot(SparseMap *dst, SparseMap *src);
 
 static inline int smap_len(SparseMap *smap) { return smap->length; }
 
@@ -426,6 +607,28 @@ typedef struct Label {
   uint32_t textOffset;
 } Label;
 
+// An interned string in the circuit's text pool. Labels sharing the same text
+// share one copy of it, and refs counts how many labels do.
+typedef struct TextEntry {
+  uint32_t offset;
+  uint32_t refs;
+  uint32_t hash;
+} TextEntry;
+
+// Adjacency index from nets to their endpoints and waypoints, in CSR form:
+// the endpoints of the net at dense index i are at dense indices
+// endpoints[endpointStart[i]] up to endpoints[endpointStart[i + 1]], in the
+// same order as the net's linked list, and likewise for the waypoints. It is
+// invalidated whenever an endpoint, waypoint or net is added or deleted, and
+// rebuilt the next time circuit_net_index is called.
+typedef struct NetIndex {
+  arr(uint32_t) endpointStart;
+  arr(uint32_t) endpoints;
+  arr(uint32_t) waypointStart;
+  arr(uint32_t) waypoints;
+  bool valid;
+} NetIndex;
+
 typedef struct Circuit {
   // important: keep in sync with IDType
   union {
@@ -459,10 +662,19 @@ typedef struct Circuit {
 
   arr(char) text;
 
-  struct {
-    char key;
-    uint32_t value;
-  } * nextName;
+  // interner for the text pool: textTable is an open addressing hash table
+  // (power of two size) holding indices into textEntries plus one, with zero
+  // meaning empty. textGarbage counts the bytes of strings no label uses
+  // anymore, which are dropped once they make up half of the pool.
+  arr(TextEntry) textEntries;
+  arr(uint32_t) textTable;
+  uint32_t textGarbage;
+
+  // next number to use in a component name, indexed by the name prefix. a
+  // plain table rather than a hash map so that cloning is a single memcpy.
+  uint32_t nextName[256];
+
+  NetIndex netIndex;
 
   arr(Wire) wires;
   arr(HMM_Vec2) vertices;
@@ -480,6 +692,8 @@ typedef struct Circuit {
 #define circuit_len(circuit, type) (smap_len(&(circuit)->sparsemaps[type]))
 #define circuit_id(circuit, type, index)                                       \
   (smap_id(&(circuit)->sparsemaps[type], (index)))
+#define circuit_touch_index(circuit, type, index)                              \
+  (smap_touch(&(circuit)->sparsemaps[type], (index)))
 #define circuit_update_index(circuit, type, index)                             \
   (smap_update_index(&(circuit)->sparsemaps[type], (index)))
 #define circuit_on_create(circuit, type, user, callback)                       \
@@ -518,6 +732,8 @@ typedef struct Circuit {
 #define circuit_port_ptr(circuit, id)                                          \
   (&(circuit)->ports[circuit_index(circuit, id)])
 #define circuit_port_len(circuit) (smap_len(&(circuit)->sm.ports))
+#define circuit_component_port_count(circuit, component)                       \
+  ((circuit)->componentDescs[(component)->desc].numPorts)
 #define circuit_port_id(circuit, index) (smap_id(&(circuit)->sm.ports, (index)))
 #define circuit_port_update_index(circuit, index)                              \
   smap_update_index(&(circuit)->sm.ports, (index))
@@ -609,8 +825,17 @@ void circuit_init(Circuit *circuit, const ComponentDesc *componentDescs);
 void circuit_free(Circuit *circuit);
 void circuit_clear(Circuit *circuit);
 void circuit_clone_from(Circuit *dst, Circuit *src);
+void circuit_set_allocator(Circuit *circuit, Allocator *allocator);
+NetIndex *circuit_net_index(Circuit *circuit);
+size_t circuit_storage_size(Circuit *circuit);
+void circuit_snapshot(Circuit *dst, Circuit *src);
+void circuit_track_dirty(Circuit *circuit, bool enabled);
+void circuit_flush_dirty(Circuit *circuit);
 ComponentID circuit_add_component(
   Circuit *circuit, ComponentDescID desc, HMM_Vec2 position);
+void circuit_add_components(
+  Circuit *circuit, ComponentDescID *descs, HMM_Vec2 *positions,
+  uint32_t count, ComponentID *ids);
 void circuit_move_component(Circuit *circuit, ComponentID id, HMM_Vec2 delta);
 void circuit_move_component_to(Circuit *circuit, ComponentID id, HMM_Vec2 pos);
 NetID circuit_add_net(Circuit *circuit);
@@ -0,0 +1,294 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core.h"
+#include "sokol_time.h"
+#include "utest.h"
+
+#define BENCH_LOOKUP_ITEMS 1000000
+#define BENCH_LOOKUPS 10000000
+
+// build with and without ID_64BIT to compare the two ID sizes
+UTEST(CoreBench, smap_lookup) {
+  SparseMap smap;
+  Component *components = NULL;
+  smap_init(&smap, ID_COMPONENT);
+  smap_add_synced_array(&smap, (void **)&components, sizeof(Component));
+
+  arr(ID) ids = NULL;
+  arrsetlen(ids, BENCH_LOOKUP_ITEMS);
+  arr(Component) values = NULL;
+  arrsetlen(values, BENCH_LOOKUP_ITEMS);
+  for (int i = 0; i < BENCH_LOOKUP_ITEMS; i++) {
+    values[i] = (Component){.desc = i};
+  }
+  smap_add_many(&smap, values, BENCH_LOOKUP_ITEMS, ids);
+
+  // delete and re-add every other item so the sparse and dense indices
+  // don't line up, like in a circuit that has been edited for a while
+  for (int i = 0; i < BENCH_LOOKUP_ITEMS; i += 2) {
+    smap_del(&smap, ids[i]);
+  }
+  for (int i = 0; i < BENCH_LOOKUP_ITEMS; i += 2) {
+    ids[i] = smap_add(&smap, &values[i]);
+  }
+
+  // shuffle the lookup order with a simple xorshift so that lookups miss the
+  // cache the way following links through a big circuit does
+  uint32_t rng = 0x12345678;
+  for (int i = BENCH_LOOKUP_ITEMS - 1; i > 0; i--) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    int j = rng % (i + 1);
+    ID tmp = ids[i];
+    ids[i] = ids[j];
+    ids[j] = tmp;
+  }
+
+  uint64_t sum = 0;
+  uint64_t start = stm_now();
+  for (int i = 0; i < BENCH_LOOKUPS; i++) {
+    ID id = ids[i % BENCH_LOOKUP_ITEMS];
+    if (smap_has(&smap, id)) {
+      sum += components[smap_index(&smap, id)].desc;
+    }
+  }
+  double ns = stm_ns(stm_since(start)) / BENCH_LOOKUPS;
+
+  printf(
+    "smap lookup with %d bit IDs: %.2fns per lookup, %d KiB of IDs\n",
+    ID_BITS, ns,
+    (int)((arrlen(smap.sparse) + smap.length) * sizeof(ID) / 1024));
+
+  ASSERT_GT(sum, 0);
+
+  arrfree(ids);
+  arrfree(values);
+  smap_free(&smap);
+}
+
+#define BENCH_CLONE_COMPONENTS 16000
+#define BENCH_CLONES 100
+
+UTEST(CoreBench, circuit_clone) {
+  Circuit circuit;
+  Circuit clone;
+  circuit_init(&circuit, circuit_component_descs());
+  circuit_init(&clone, circuit_component_descs());
+
+  // with their ports and labels, this is about 100k elements
+  for (int i = 0; i < BENCH_CLONE_COMPONENTS; i++) {
+    circuit_add_component(
+      &circuit, COMP_AND + (i % (COMP_COUNT - COMP_AND)),
+      HMM_V2((i % 100) * 100.0f, (i / 100) * 100.0f));
+  }
+
+  int elements = 0;
+  size_t bytes = 0;
+  for (int type = ID_COMPONENT; type < ID_TYPE_COUNT; type++) {
+    SparseMap *smap = &circuit.sparsemaps[type];
+    elements += smap->length;
+    bytes += smap->length * (smap->syncedArrays[0].elemSize + sizeof(ID));
+  }
+
+  uint64_t start = stm_now();
+  for (int i = 0; i < BENCH_CLONES; i++) {
+    circuit_clone_from(&clone, &circuit);
+  }
+  double ms = stm_ms(stm_since(start)) / BENCH_CLONES;
+
+  printf(
+    "clone of %d elements: %.3fms per clone, %.0f MiB/s\n", elements, ms,
+    (bytes / (1024.0 * 1024.0)) / (ms / 1000.0));
+
+  ASSERT_EQ(
+    circuit_component_len(&clone), circuit_component_len(&circuit));
+
+  circuit_free(&clone);
+  circuit_free(&circuit);
+}
+
+#define BENCH_BVH_HOVERS 100000
+#define BENCH_BVH_VIEWS 100
+
+static uint32_t bench_bvh_rng = 0x12345678;
+
+static float bench_bvh_random(float max) {
+  bench_bvh_rng ^= bench_bvh_rng << 13;
+  bench_bvh_rng ^= bench_bvh_rng >> 17;
+  bench_bvh_rng ^= bench_bvh_rng << 5;
+  return (bench_bvh_rng % 10000) * max / 10000.0f;
+}
+
+// lays out rows of components, each with four ports and two wire segments
+// running off to a neighbour, so the boxes overlap and cluster like a circuit
+static arr(Box) bench_bvh_boxes(int count) {
+  arr(Box) boxes = NULL;
+  int columns = (int)sqrtf(count / 7.0f) + 1;
+  for (int i = 0; boxes == NULL || arrlen(boxes) < count; i++) {
+    HMM_Vec2 pos = HMM_V2(
+      (i % columns) * 150.0f + bench_bvh_random(30),
+      (i / columns) * 120.0f + bench_bvh_random(30));
+    arrput(boxes, ((Box){pos, HMM_V2(30, 20)}));
+    for (int j = 0; j < 4; j++) {
+      HMM_Vec2 port = HMM_V2(j < 2 ? -30 : 30, j % 2 ? -10 : 10);
+      arrput(boxes, ((Box){HMM_AddV2(pos, port), HMM_V2(3, 3)}));
+    }
+    float length = 20 + bench_bvh_random(100);
+    arrput(
+      boxes, ((Box){HMM_V2(pos.X + 30 + length / 2, pos.Y + 10),
+                    HMM_V2(length / 2, 1)}));
+    arrput(
+      boxes, ((Box){HMM_V2(pos.X + 30 + length, pos.Y + 10 + length / 2),
+                    HMM_V2(1, length / 2)}));
+  }
+  arrsetlen(boxes, count);
+  return boxes;
+}
+
+// the summed perimeters of the internal nodes relative to the root's, which is
+// what the surface area heuristic minimises
+static float bench_bvh_cost(BVH *bvh) {
+  double sum = 0;
+  for (int i = 0; i < arrlen(bvh->nodes); i++) {
+    BVHNode *node = &bvh->nodes[i];
+    if (node->height > 0) {
+      sum += node->box.halfSize.X + node->box.halfSize.Y;
+    }
+  }
+  Box root = bvh->nodes[bvh->root].box;
+  return (float)(sum / (root.halfSize.X + root.halfSize.Y));
+}
+
+static void bench_bvh_queries(BVH *bvh, Box bounds, const char *name) {
+  arr(ID) result = NULL;
+  size_t hits = 0;
+  bench_bvh_rng = 0x9e3779b9;
+
+  // the second query on an unchanged tree collapses it to the wide layout
+  result = bvh_query(bvh, bounds, result);
+  uint64_t start = stm_now();
+  result = bvh_query(bvh, (Box){bounds.center, HMM_V2(1, 1)}, result);
+  double collapseMs = stm_ms(stm_since(start));
+
+  start = stm_now();
+  for (int i = 0; i < BENCH_BVH_HOVERS; i++) {
+    HMM_Vec2 pos = HMM_V2(
+      bounds.center.X + bench_bvh_random(2 * bounds.halfSize.X) -
+        bounds.halfSize.X,
+      bounds.center.Y + bench_bvh_random(2 * bounds.halfSize.Y) -
+        bounds.halfSize.Y);
+    arrsetlen(result, 0);
+    result = bvh_query(bvh, (Box){pos, HMM_V2(2, 2)}, result);
+    hits += arrlen(result);
+  }
+  double hoverNs = stm_ns(stm_since(start)) / BENCH_BVH_HOVERS;
+
+  start = stm_now();
+  for (int i = 0; i < BENCH_BVH_VIEWS; i++) {
+    HMM_Vec2 pos = HMM_V2(
+      bounds.center.X + bench_bvh_random(bounds.halfSize.X) -
+        bounds.halfSize.X / 2,
+      bounds.center.Y + bench_bvh_random(bounds.halfSize.Y) -
+        bounds.halfSize.Y / 2);
+    arrsetlen(result, 0);
+    result = bvh_query(bvh, (Box){pos, HMM_V2(960, 540)}, result);
+    hits += arrlen(result);
+  }
+  double viewUs = stm_us(stm_since(start)) / BENCH_BVH_VIEWS;
+
+  printf(
+    "  %-12s cost %8.1f, collapse %6.1fms, hover %7.1fns, viewport %8.1fus "
+    "(%zu hits)\n",
+    name, bench_bvh_cost(bvh), collapseMs, hoverNs, viewUs, hits);
+  arrfree(result);
+}
+
+// compares building by inserting leaves one at a time against the top down
+// binned SAH rebuild, for the build time and the quality of the tree
+UTEST(CoreBench, bvh_build) {
+  int sizes[] = {10000, 100000, 1000000};
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int count = sizes[s];
+    arr(Box) boxes = bench_bvh_boxes(count);
+
+    BVH bvh;
+    bvh_init(&bvh);
+    uint64_t start = stm_now();
+    for (int i = 0; i < count; i++) {
+      bvh_add(&bvh, i, boxes[i]);
+    }
+    double insertMs = stm_ms(stm_since(start));
+    Box bounds = bvh.nodes[bvh.root].box;
+
+    BVH bulk;
+    bvh_init(&bulk);
+    start = stm_now();
+    bvh_clear(&bulk);
+    for (int i = 0; i < count; i++) {
+      bvh_add(&bulk, i, boxes[i]);
+    }
+    bvh_rebuild(&bulk);
+    double rebuildMs = stm_ms(stm_since(start));
+
+    printf(
+      "bvh of %d leaves: insert %.1fms, binned SAH %.1fms\n", count, insertMs,
+      rebuildMs);
+    bench_bvh_queries(&bvh, bounds, "insert");
+    bench_bvh_queries(&bulk, bounds, "binned SAH");
+
+    ASSERT_EQ(bvh.leafCount, count);
+    ASSERT_EQ(bulk.leafCount, count);
+
+    bvh_free(&bulk);
+    bvh_free(&bvh);
+    arrfree(boxes);
+  }
+}
+
+#define BENCH_BVH_THREADS_LEAVES 1000000
+#define BENCH_BVH_REBUILDS 5
+
+UTEST(CoreBench, bvh_rebuild_threads) {
+  arr(Box) boxes = bench_bvh_boxes(BENCH_BVH_THREADS_LEAVES);
+  BVH bvh;
+  bvh_init(&bvh);
+  bvh_clear(&bvh);
+  for (int i = 0; i < BENCH_BVH_THREADS_LEAVES; i++) {
+    bvh_add(&bvh, i, boxes[i]);
+  }
+
+  double serialMs = 0;
+  for (int threads = 1; threads <= BVH_DEFAULT_THREADS; threads *= 2) {
+    bvh.threads = threads;
+    uint64_t start = stm_now();
+    for (int i = 0; i < BENCH_BVH_REBUILDS; i++) {
+      bvh_rebuild(&bvh);
+    }
+    double ms = stm_ms(stm_since(start)) / BENCH_BVH_REBUILDS;
+    if (threads == 1) {
+      serialMs = ms;
+    }
+    printf(
+      "rebuild of %d leaves on %d threads: %.1fms, %.2fx\n",
+      BENCH_BVH_THREADS_LEAVES, threads, ms, serialMs / ms);
+  }
+
+  ASSERT_EQ(bvh.leafCount, BENCH_BVH_THREADS_LEAVES);
+  bvh_free(&bvh);
+  arrfree(boxes);
+}
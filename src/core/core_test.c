@@ -138,6 +138,113 @@ UTEST(SparseMap, del_last) {
   smap_free(&smap);
 }
 
+static void count_calls(void *user, ID id, void *ptr) { (*(int *)user)++; }
+
+static void count_calls_many(void *user, ID *ids, void *ptr, uint32_t count) {
+  (*(int *)user)++;
+}
+
+UTEST(SparseMap, add_many) {
+  SparseMap smap;
+  int *data = NULL;
+  int creates = 0;
+  int createManys = 0;
+  smap_init(&smap, ID_COMPONENT);
+  smap_add_synced_array(&smap, (void **)&data, sizeof(int));
+  smap_on_create(
+    &smap, data, (SmapCallback){.user = &creates, .fn = count_calls});
+  smap_on_create(
+    &smap, data,
+    (SmapCallback){.user = &createManys, .fnMany = count_calls_many});
+
+  int values[20];
+  ID ids[20];
+  for (int i = 0; i < 20; i++) {
+    values[i] = i * 10;
+  }
+  ASSERT_TRUE(smap_add_many(&smap, values, 20, ids));
+
+  ASSERT_EQ(smap.length, 20);
+  ASSERT_EQ(smap.capacity, 32);
+  ASSERT_EQ(creates, 20);
+  ASSERT_EQ(createManys, 1);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(smap_index(&smap, ids[i]), i);
+    ASSERT_EQ(data[i], i * 10);
+  }
+
+  smap_free(&smap);
+}
+
+UTEST(SparseMap, track_dirty) {
+  SparseMap smap;
+  int *data = NULL;
+  int updates = 0;
+  smap_init(&smap, ID_COMPONENT);
+  smap_add_synced_array(&smap, (void **)&data, sizeof(int));
+  smap_on_update(
+    &smap, data, (SmapCallback){.user = &updates, .fn = count_calls});
+  smap_track_dirty(&smap, true);
+
+  int value = 0;
+  ID a = smap_add(&smap, &value);
+  ID b = smap_add(&smap, &value);
+  ID c = smap_add(&smap, &value);
+
+  smap_update_id(&smap, a);
+  smap_update_id(&smap, a);
+  smap_update_index(&smap, smap_index(&smap, a));
+  smap_update_id(&smap, b);
+  smap_update_id(&smap, c);
+  ASSERT_EQ(updates, 0);
+  ASSERT_EQ(smap.dirtyCount, 3);
+
+  // deleted elements are dropped from the dirty set
+  smap_del(&smap, b);
+  ASSERT_EQ(smap.dirtyCount, 2);
+
+  smap_flush_dirty(&smap);
+  ASSERT_EQ(updates, 2);
+  ASSERT_EQ(smap.dirtyCount, 0);
+
+  smap_flush_dirty(&smap);
+  ASSERT_EQ(updates, 2);
+
+  smap_track_dirty(&smap, false);
+  smap_update_id(&smap, c);
+  ASSERT_EQ(updates, 3);
+
+  smap_free(&smap);
+}
+
+#ifndef ID_64BIT // 64 bit IDs take too long to overflow
+UTEST(SparseMap, generation_overflow) {
+  SparseMap smap;
+  int *data = NULL;
+  smap_init(&smap, ID_COMPONENT);
+  smap_add_synced_array(&smap, (void **)&data, sizeof(int));
+
+  int value = 0;
+  ID first = smap_add(&smap, &value);
+  ID id = first;
+  for (int i = 0; i < ID_GEN_MASK; i++) {
+    smap_del(&smap, id);
+    id = smap_add(&smap, &value);
+    ASSERT_NE(id, first);
+  }
+
+  // the slot ran out of generations, so it was retired rather than wrapped
+  ASSERT_EQ(smap.genOverflows, 1);
+  ASSERT_EQ(smap.genWraps, 0);
+  ASSERT_NE(id_index(id), id_index(first));
+  ASSERT_EQ(id_gen(id), 1);
+  ASSERT_FALSE(smap_has(&smap, first));
+  ASSERT_TRUE(smap_has(&smap, id));
+
+  smap_free(&smap);
+}
+#endif
+
 UTEST(Circuit, add_component) {
   Circuit circuit;
   circuit_init(&circuit, circuit_component_descs());
@@ -150,6 +257,248 @@ UTEST(Circuit, add_component) {
   circuit_free(&circuit);
 }
 
+UTEST(Circuit, add_components) {
+  Circuit circuit;
+  circuit_init(&circuit, circuit_component_descs());
+  ComponentDescID descs[] = {COMP_AND, COMP_NOT, COMP_INPUT};
+  HMM_Vec2 positions[] = {HMM_V2(0, 0), HMM_V2(100, 0), HMM_V2(200, 0)};
+  ComponentID ids[3];
+  circuit_add_components(&circuit, descs, positions, 3, ids);
+
+  ASSERT_EQ(circuit_component_len(&circuit), 3);
+  ASSERT_EQ(circuit_port_len(&circuit), 6);
+  for (int i = 0; i < 3; i++) {
+    Component *comp = circuit_component_ptr(&circuit, ids[i]);
+    ASSERT_EQ(comp->desc, descs[i]);
+    ASSERT_EQ(comp->box.center.X, positions[i].X);
+
+    int numPorts = 0;
+    PortID portID = comp->portFirst;
+    while (circuit_has(&circuit, portID)) {
+      ASSERT_EQ(circuit_port_ptr(&circuit, portID)->component, ids[i]);
+      portID = circuit_port_ptr(&circuit, portID)->next;
+      numPorts++;
+    }
+    ASSERT_EQ(numPorts, circuit.componentDescs[descs[i]].numPorts);
+  }
+  circuit_free(&circuit);
+}
+
+UTEST(Circuit, snapshot) {
+  Circuit circuit;
+  Circuit snapshot;
+  circuit_init(&circuit, circuit_component_descs());
+  circuit_init(&snapshot, circuit_component_descs());
+
+  arr(ComponentID) ids = NULL;
+  for (int i = 0; i < SMAP_PAGE_SIZE * 3; i++) {
+    arrput(
+      ids, circuit_add_component(&circuit, COMP_AND, HMM_V2(i * 100, 0)));
+  }
+  circuit_snapshot(&snapshot, &circuit);
+
+  // only touch the first page of components
+  circuit_move_component(&circuit, ids[0], HMM_V2(10, 10));
+  circuit_del(&circuit, ids[1]);
+  circuit_add_component(&circuit, COMP_OR, HMM_V2(-100, 0));
+
+  // scribble on the snapshot in a page that did not change, which should not
+  // get copied again
+  int untouched = SMAP_PAGE_SIZE + 5;
+  snapshot.components[untouched].desc = COMP_XOR;
+
+  circuit_snapshot(&snapshot, &circuit);
+  ASSERT_EQ(snapshot.components[untouched].desc, COMP_XOR);
+  snapshot.components[untouched].desc = circuit.components[untouched].desc;
+
+  for (int type = ID_COMPONENT; type < ID_TYPE_COUNT; type++) {
+    SparseMap *a = &circuit.sparsemaps[type];
+    SparseMap *b = &snapshot.sparsemaps[type];
+    ASSERT_EQ(a->length, b->length);
+    ASSERT_EQ(arrlen(a->sparse), arrlen(b->sparse));
+    if (arrlen(a->sparse) == 0) {
+      continue;
+    }
+    ASSERT_EQ(
+      memcmp(
+        circuit.ptrs[type], snapshot.ptrs[type],
+        a->length * a->syncedArrays[0].elemSize),
+      0);
+    ASSERT_EQ(memcmp(a->ids, b->ids, a->length * sizeof(ID)), 0);
+    ASSERT_EQ(
+      memcmp(a->sparse, b->sparse, arrlen(a->sparse) * sizeof(ID)), 0);
+  }
+  ASSERT_EQ(arrlen(circuit.text), arrlen(snapshot.text));
+  ASSERT_EQ(memcmp(circuit.text, snapshot.text, arrlen(circuit.text)), 0);
+
+  // changing the snapshot makes the next one a full copy
+  circuit_del(&snapshot, ids[2]);
+  circuit_snapshot(&snapshot, &circuit);
+  ASSERT_EQ(
+    circuit_component_len(&snapshot), circuit_component_len(&circuit));
+  ASSERT_TRUE(circuit_has(&snapshot, ids[2]));
+
+  arrfree(ids);
+  circuit_free(&snapshot);
+  circuit_free(&circuit);
+}
+
+UTEST(Circuit, clone_from) {
+  Circuit circuit;
+  Circuit clone;
+  circuit_init(&circuit, circuit_component_descs());
+  circuit_init(&clone, circuit_component_descs());
+
+  ComponentID and = circuit_add_component(&circuit, COMP_AND, HMM_V2(0, 0));
+  ComponentID or = circuit_add_component(&circuit, COMP_OR, HMM_V2(100, 0));
+  NetID net = circuit_add_net(&circuit);
+  circuit_add_endpoint(
+    &circuit, net, circuit_component_ptr(&circuit, and)->portLast,
+    HMM_V2(0, 0));
+  circuit_add_endpoint(
+    &circuit, net, circuit_component_ptr(&circuit, or)->portFirst,
+    HMM_V2(0, 0));
+  for (int i = 0; i < 10; i++) {
+    arrput(circuit.wires, (Wire){.vertexCount = i});
+    arrput(circuit.vertices, HMM_V2(i, i * 2));
+  }
+
+  circuit_clone_from(&clone, &circuit);
+  Wire *wires = clone.wires;
+  HMM_Vec2 *vertices = clone.vertices;
+  Component *components = clone.components;
+
+  // clone twice to check the second one reuses the first one's memory
+  circuit_clone_from(&clone, &circuit);
+  ASSERT_EQ(clone.wires, wires);
+  ASSERT_EQ(clone.vertices, vertices);
+  ASSERT_EQ(clone.components, components);
+
+  // regression: the wires and vertices used to be copied by element count
+  // instead of byte count
+  ASSERT_EQ(arrlen(clone.wires), 10);
+  ASSERT_EQ(arrlen(clone.vertices), 10);
+  ASSERT_EQ(memcmp(clone.wires, circuit.wires, 10 * sizeof(Wire)), 0);
+  ASSERT_EQ(memcmp(clone.vertices, circuit.vertices, 10 * sizeof(HMM_Vec2)), 0);
+
+  ASSERT_EQ(circuit_component_len(&clone), 2);
+  ASSERT_EQ(circuit_port_len(&clone), circuit_port_len(&circuit));
+  ASSERT_EQ(circuit_endpoint_len(&clone), 2);
+  ASSERT_TRUE(circuit_has(&clone, and));
+  ASSERT_TRUE(circuit_has(&clone, or));
+  ASSERT_STREQ(
+    circuit_label_text(&clone, circuit_component_ptr(&clone, or)->nameLabel),
+    "X2");
+
+  // the name counters come along too
+  ComponentID xor = circuit_add_component(&clone, COMP_XOR, HMM_V2(0, 0));
+  ASSERT_STREQ(
+    circuit_label_text(&clone, circuit_component_ptr(&clone, xor)->nameLabel),
+    "X3");
+
+  circuit_free(&clone);
+  circuit_free(&circuit);
+}
+
+UTEST(Circuit, clone_into_arena) {
+  Circuit circuit;
+  Circuit clone;
+  circuit_init(&circuit, circuit_component_descs());
+  circuit_init(&clone, circuit_component_descs());
+  for (int i = 0; i < 100; i++) {
+    circuit_add_component(&circuit, COMP_AND, HMM_V2(i * 100, 0));
+  }
+
+  Arena arena;
+  arena_init(&arena, circuit_storage_size(&circuit));
+  Allocator allocator = arena_allocator(&arena);
+  circuit_set_allocator(&clone, &allocator);
+  circuit_clone_from(&clone, &circuit);
+
+  // everything fits in the one block sized from the hint
+  ASSERT_EQ(arena.blockCount, 1);
+  ASSERT_EQ(circuit_component_len(&clone), 100);
+  ASSERT_EQ(circuit_port_len(&clone), circuit_port_len(&circuit));
+  ASSERT_EQ(
+    memcmp(
+      clone.components, circuit.components,
+      circuit_component_len(&circuit) * sizeof(Component)),
+    0);
+
+  circuit_free(&clone);
+  arena_free(&arena);
+  circuit_free(&circuit);
+}
+
+UTEST(Circuit, net_index) {
+  Circuit circuit;
+  circuit_init(&circuit, circuit_component_descs());
+  NetID net1 = circuit_add_net(&circuit);
+  NetID net2 = circuit_add_net(&circuit);
+  EndpointID a = circuit_add_endpoint(&circuit, net1, NO_PORT, HMM_V2(1, 0));
+  EndpointID b = circuit_add_endpoint(&circuit, net2, NO_PORT, HMM_V2(2, 0));
+  EndpointID c = circuit_add_endpoint(&circuit, net1, NO_PORT, HMM_V2(3, 0));
+  circuit_add_waypoint(&circuit, net2, HMM_V2(4, 0));
+
+  NetIndex *index = circuit_net_index(&circuit);
+  ASSERT_TRUE(index->valid);
+  int i1 = circuit_index(&circuit, net1);
+  int i2 = circuit_index(&circuit, net2);
+  ASSERT_EQ(index->endpointStart[i1 + 1] - index->endpointStart[i1], 2);
+  ASSERT_EQ(index->endpointStart[i2 + 1] - index->endpointStart[i2], 1);
+  ASSERT_EQ(index->waypointStart[i1 + 1] - index->waypointStart[i1], 0);
+  ASSERT_EQ(index->waypointStart[i2 + 1] - index->waypointStart[i2], 1);
+  ASSERT_EQ(
+    circuit_endpoint_id(&circuit, index->endpoints[index->endpointStart[i1]]),
+    a);
+  ASSERT_EQ(
+    circuit_endpoint_id(
+      &circuit, index->endpoints[index->endpointStart[i1] + 1]),
+    c);
+  ASSERT_EQ(
+    circuit_endpoint_id(&circuit, index->endpoints[index->endpointStart[i2]]),
+    b);
+
+  // deleting moves the dense indices around, so the index is rebuilt
+  circuit_del(&circuit, a);
+  ASSERT_FALSE(circuit.netIndex.valid);
+  index = circuit_net_index(&circuit);
+  ASSERT_EQ(index->endpointStart[i1 + 1] - index->endpointStart[i1], 1);
+  ASSERT_EQ(
+    circuit_endpoint_id(&circuit, index->endpoints[index->endpointStart[i1]]),
+    c);
+  ASSERT_EQ(
+    circuit_endpoint_id(&circuit, index->endpoints[index->endpointStart[i2]]),
+    b);
+  circuit_free(&circuit);
+}
+
+UTEST(Arena, realloc_last_in_place) {
+  Arena arena;
+  arena_init(&arena, 1024);
+  Allocator allocator = arena_allocator(&arena);
+  char *a = allocator.realloc(allocator.user, NULL, 0, 64);
+  char *b = allocator.realloc(allocator.user, NULL, 0, 64);
+  memset(a, 'a', 64);
+  memset(b, 'b', 64);
+
+  // the last allocation grows in place, others move
+  ASSERT_EQ(allocator.realloc(allocator.user, b, 64, 128), b);
+  char *a2 = allocator.realloc(allocator.user, a, 64, 128);
+  ASSERT_NE(a2, a);
+  ASSERT_EQ(a2[63], 'a');
+  ASSERT_EQ(arena.used, 64 + 128 + 128);
+
+  // outgrowing the block adds another, and reset folds them into one
+  arena_alloc(&arena, 4096);
+  ASSERT_EQ(arena.blockCount, 2);
+  arena_reset(&arena);
+  ASSERT_EQ(arena.blockCount, 1);
+  ASSERT_EQ(arena.used, 0);
+  ASSERT_GE(arena.blocks->size, 64 + 128 + 128 + 4096);
+  arena_free(&arena);
+}
+
 UTEST(Circuit, add_net_no_ports) {
   Circuit circuit;
   circuit_init(&circuit, circuit_component_descs());
@@ -181,6 +530,382 @@ UTEST(Circuit, add_net_with_ports) {
   circuit_free(&circuit);
 }
 
+UTEST(Circuit, label_interning) {
+  Circuit circuit;
+  circuit_init(&circuit, circuit_component_descs());
+  LabelID a = circuit_add_label(&circuit, "A", (Box){0});
+  LabelID b = circuit_add_label(&circuit, "B", (Box){0});
+  LabelID a2 = circuit_add_label(&circuit, "A", (Box){0});
+  ASSERT_EQ(
+    circuit_label_ptr(&circuit, a)->textOffset,
+    circuit_label_ptr(&circuit, a2)->textOffset);
+  ASSERT_NE(
+    circuit_label_ptr(&circuit, a)->textOffset,
+    circuit_label_ptr(&circuit, b)->textOffset);
+  ASSERT_EQ(arrlen(circuit.text), 4);
+
+  // the text stays while any label still uses it
+  circuit_del(&circuit, a);
+  ASSERT_EQ(circuit.textGarbage, 0);
+  circuit_del(&circuit, a2);
+  ASSERT_EQ(circuit.textGarbage, 2);
+
+  // re-adding dead text revives it
+  a = circuit_add_label(&circuit, "A", (Box){0});
+  ASSERT_EQ(circuit.textGarbage, 0);
+  ASSERT_EQ(arrlen(circuit.text), 4);
+  circuit_free(&circuit);
+}
+
+UTEST(Circuit, label_compaction) {
+  Circuit circuit;
+  circuit_init(&circuit, circuit_component_descs());
+  LabelID ids[1000];
+  char buf[32];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(buf, sizeof(buf), "label%d", i);
+    ids[i] = circuit_add_label(&circuit, buf, (Box){0});
+  }
+  size_t fullLen = arrlen(circuit.text);
+  for (int i = 0; i < 1000; i++) {
+    if (i % 10 != 0) {
+      circuit_del(&circuit, ids[i]);
+    }
+  }
+
+  // the next add drops the garbage
+  LabelID extra = circuit_add_label(&circuit, "extra", (Box){0});
+  ASSERT_EQ(circuit.textGarbage, 0);
+  ASSERT_LT(arrlen(circuit.text), fullLen / 2);
+  ASSERT_STREQ(circuit_label_text(&circuit, extra), "extra");
+  for (int i = 0; i < 1000; i += 10) {
+    snprintf(buf, sizeof(buf), "label%d", i);
+    ASSERT_STREQ(circuit_label_text(&circuit, ids[i]), buf);
+  }
+
+  // and the interner still finds the survivors
+  size_t len = arrlen(circuit.text);
+  circuit_add_label(&circuit, "label500", (Box){0});
+  ASSERT_EQ(arrlen(circuit.text), len);
+  circuit_free(&circuit);
+}
+
+static uint32_t bvh_test_rng = 0x12345678;
+
+static float bvh_test_random(float max) {
+  bvh_test_rng ^= bvh_test_rng << 13;
+  bvh_test_rng ^= bvh_test_rng >> 17;
+  bvh_test_rng ^= bvh_test_rng << 5;
+  return (bvh_test_rng % 10000) * max / 10000.0f;
+}
+
+static Box bvh_test_box(void) {
+  return (Box){
+    .center = HMM_V2(bvh_test_random(1000), bvh_test_random(1000)),
+    .halfSize = HMM_V2(1 + bvh_test_random(20), 1 + bvh_test_random(20)),
+  };
+}
+
+// checks the links, heights and boxes of the subtree, returning its leaf count;
+// only incrementally built trees are height balanced
+static int
+bvh_test_check(BVH *bvh, uint32_t index, bool balanced, bool *ok) {
+  BVHNode *node = &bvh->nodes[index];
+  if (node->left == BVH_NULL) {
+    *ok = *ok && node->height == 0;
+    return 1;
+  }
+  BVHNode *left = &bvh->nodes[node->left];
+  BVHNode *right = &bvh->nodes[node->right];
+  *ok = *ok && left->parent == index && right->parent == index;
+  *ok = *ok && node->height == 1 + HMM_MAX(left->height, right->height);
+  *ok = *ok && (!balanced || abs(left->height - right->height) <= 1);
+  // box_union rounds, so allow a little slack
+  Box outer = {
+    node->box.center, HMM_AddV2(node->box.halfSize, HMM_V2(1e-3f, 1e-3f))};
+  *ok = *ok && box_contains_box(outer, left->box) &&
+        box_contains_box(outer, right->box);
+  return bvh_test_check(bvh, node->left, balanced, ok) +
+         bvh_test_check(bvh, node->right, balanced, ok);
+}
+
+// queries twice, since only the second query after a change uses the
+// collapsed tree
+static bool bvh_test_query_matches(BVH *bvh, Box *boxes, bool *live, int n) {
+  Box query = {HMM_V2(500, 500), HMM_V2(150, 100)};
+  int expected = 0;
+  for (int i = 0; i < n; i++) {
+    if (live[i] && box_intersect_box(query, boxes[i])) {
+      expected++;
+    }
+  }
+  bool ok = true;
+  for (int pass = 0; pass < 2; pass++) {
+    arr(ID) result = bvh_query(bvh, query, NULL);
+    ok = ok && arrlen(result) == expected;
+    for (int i = 0; i < arrlen(result); i++) {
+      int item = (int)result[i];
+      ok = ok && live[item] && box_intersect_box(query, boxes[item]);
+    }
+    arrfree(result);
+  }
+  return ok && bvh->wideVersion == bvh->version;
+}
+
+#define BVH_TEST_ITEMS 500
+
+UTEST(BVH, add_remove_update) {
+  BVH bvh;
+  bvh_init(&bvh);
+  Box boxes[BVH_TEST_ITEMS];
+  bool live[BVH_TEST_ITEMS];
+  for (int i = 0; i < BVH_TEST_ITEMS; i++) {
+    boxes[i] = bvh_test_box();
+    live[i] = true;
+    bvh_add(&bvh, i, boxes[i]);
+  }
+  bool ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, true, &ok), BVH_TEST_ITEMS);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+
+  // move some, remove some
+  for (int i = 0; i < BVH_TEST_ITEMS; i += 3) {
+    Box box = i % 2 ? box_translate(boxes[i], HMM_V2(0.5f, 0)) : bvh_test_box();
+    bvh_update(&bvh, i, boxes[i], box);
+    boxes[i] = box;
+  }
+  for (int i = 1; i < BVH_TEST_ITEMS; i += 4) {
+    bvh_remove(&bvh, i, boxes[i]);
+    live[i] = false;
+  }
+  ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, true, &ok), bvh.leafCount);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+
+  // a rebuild keeps the same leaves
+  bvh_rebuild(&bvh);
+  ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, false, &ok), bvh.leafCount);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+
+  // and the rebuilt tree can still be updated
+  for (int i = 0; i < BVH_TEST_ITEMS; i += 5) {
+    if (live[i]) {
+      Box box = bvh_test_box();
+      bvh_update(&bvh, i, boxes[i], box);
+      boxes[i] = box;
+    }
+  }
+  ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, false, &ok), bvh.leafCount);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+  bvh_free(&bvh);
+}
+
+UTEST(BVH, rebuild_bulk) {
+  BVH bvh;
+  bvh_init(&bvh);
+  Box boxes[BVH_TEST_ITEMS];
+  bool live[BVH_TEST_ITEMS];
+
+  // adds after a clear are only linked in by the rebuild
+  bvh_clear(&bvh);
+  for (int i = 0; i < BVH_TEST_ITEMS; i++) {
+    boxes[i] = bvh_test_box();
+    live[i] = true;
+    bvh_add(&bvh, i, boxes[i]);
+  }
+  bvh_rebuild(&bvh);
+  bool ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, false, &ok), BVH_TEST_ITEMS);
+  ASSERT_TRUE(ok);
+  ASSERT_EQ(arrlen(bvh.nodes), BVH_TEST_ITEMS * 2 - 1);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+
+  // stacked boxes can't be binned, so they split at the median
+  bvh_clear(&bvh);
+  Box box = bvh_test_box();
+  for (int i = 0; i < BVH_TEST_ITEMS; i++) {
+    boxes[i] = box;
+    bvh_add(&bvh, i, box);
+  }
+  bvh_rebuild(&bvh);
+  ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, true, &ok), BVH_TEST_ITEMS);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&bvh, boxes, live, BVH_TEST_ITEMS));
+  bvh_free(&bvh);
+}
+
+#define BVH_TEST_PARALLEL_ITEMS 40000
+
+UTEST(BVH, rebuild_parallel) {
+  BVH serial;
+  BVH parallel;
+  bvh_init(&serial);
+  bvh_init(&parallel);
+  serial.threads = 1;
+  parallel.threads = 4;
+  bvh_clear(&serial);
+  bvh_clear(&parallel);
+  for (int i = 0; i < BVH_TEST_PARALLEL_ITEMS; i++) {
+    Box box = bvh_test_box();
+    bvh_add(&serial, i, box);
+    bvh_add(&parallel, i, box);
+  }
+  bvh_rebuild(&serial);
+  bvh_rebuild(&parallel);
+
+  bool ok = true;
+  ASSERT_EQ(
+    bvh_test_check(&parallel, parallel.root, false, &ok),
+    BVH_TEST_PARALLEL_ITEMS);
+  ASSERT_TRUE(ok);
+
+  // the threads don't change the layout
+  ASSERT_EQ(parallel.root, serial.root);
+  ASSERT_EQ(arrlen(parallel.nodes), arrlen(serial.nodes));
+  for (int i = 0; i < arrlen(serial.nodes); i++) {
+    BVHNode *a = &serial.nodes[i];
+    BVHNode *b = &parallel.nodes[i];
+    ok = ok && box_equal(a->box, b->box) && a->parent == b->parent &&
+         a->left == b->left && a->right == b->right &&
+         a->height == b->height && a->item == b->item &&
+         a->nextLeaf == b->nextLeaf;
+  }
+  ASSERT_TRUE(ok);
+
+  bvh_free(&parallel);
+  bvh_free(&serial);
+}
+
+UTEST(BVH, set_boxes) {
+  BVH bvh;
+  bvh_init(&bvh);
+  Box boxes[3] = {bvh_test_box(), bvh_test_box(), bvh_test_box()};
+  bvh_add(&bvh, 1, bvh_test_box());
+  ASSERT_TRUE(bvh_set_boxes(&bvh, 7, boxes, 3));
+  ASSERT_FALSE(bvh_set_boxes(&bvh, 7, boxes, 3));
+  ASSERT_EQ(bvh.leafCount, 4);
+
+  boxes[1] = bvh_test_box();
+  ASSERT_TRUE(bvh_set_boxes(&bvh, 7, boxes, 3));
+  ASSERT_EQ(bvh.leafCount, 4);
+  arr(ID) result = bvh_query(&bvh, boxes[1], NULL);
+  bool found = false;
+  for (int i = 0; i < arrlen(result); i++) {
+    found = found || result[i] == 7;
+  }
+  ASSERT_TRUE(found);
+  arrfree(result);
+
+  ASSERT_TRUE(bvh_set_boxes(&bvh, 7, boxes, 1));
+  ASSERT_EQ(bvh.leafCount, 2);
+  ASSERT_TRUE(bvh_set_boxes(&bvh, 7, NULL, 0));
+  ASSERT_EQ(bvh.leafCount, 1);
+  bool ok = true;
+  ASSERT_EQ(bvh_test_check(&bvh, bvh.root, true, &ok), 1);
+  ASSERT_TRUE(ok);
+  bvh_free(&bvh);
+}
+
+UTEST(BVH, query_leaves) {
+  BVH bvh;
+  bvh_init(&bvh);
+  ID net = id_make(ID_NET, 1, 3);
+  ID other = id_make(ID_COMPONENT, 1, 3);
+  Box boxes[3] = {
+    {HMM_V2(0, 0), HMM_V2(10, 1)},
+    {HMM_V2(10, 5), HMM_V2(1, 5)},
+    {HMM_V2(20, 10), HMM_V2(10, 1)},
+  };
+  bvh_set_boxes(&bvh, net, boxes, 3);
+  bvh_add(&bvh, other, (Box){HMM_V2(10, 5), HMM_V2(2, 2)});
+
+  // the net is hit by all three segments, but only returned once, and the
+  // component with the same index isn't mistaken for it
+  Box query = {HMM_V2(10, 5), HMM_V2(20, 10)};
+  arr(ID) items = bvh_query(&bvh, query, NULL);
+  ASSERT_EQ(arrlen(items), 2);
+  ASSERT_TRUE(items[0] != items[1]);
+
+  arr(BVHHit) hits = bvh_query_leaves(&bvh, query, NULL);
+  ASSERT_EQ(arrlen(hits), 4);
+  uint32_t segments = 0;
+  for (int i = 0; i < arrlen(hits); i++) {
+    if (hits[i].item == net) {
+      ASSERT_TRUE(box_equal(hits[i].box, boxes[hits[i].segment]));
+      segments |= 1 << hits[i].segment;
+    }
+  }
+  ASSERT_EQ(segments, 7);
+
+  // moved segments keep their index
+  boxes[1] = (Box){HMM_V2(100, 100), HMM_V2(1, 5)};
+  bvh_set_boxes(&bvh, net, boxes, 3);
+  arrsetlen(hits, 0);
+  hits = bvh_query_leaves(&bvh, boxes[1], hits);
+  ASSERT_EQ(arrlen(hits), 1);
+  ASSERT_EQ(hits[0].segment, 1);
+
+  // stamps from before the epoch wraps don't hide items after it
+  bvh.epoch = UINT32_MAX - 1;
+  for (int i = 0; i < 3; i++) {
+    arrsetlen(items, 0);
+    items = bvh_query(&bvh, query, items);
+    ASSERT_EQ(arrlen(items), 2);
+  }
+
+  arrfree(hits);
+  arrfree(items);
+  bvh_free(&bvh);
+}
+
+UTEST(BVH, serialize) {
+  BVH bvh;
+  bvh_init(&bvh);
+  Box boxes[BVH_TEST_ITEMS];
+  bool live[BVH_TEST_ITEMS];
+  for (int i = 0; i < BVH_TEST_ITEMS; i++) {
+    boxes[i] = bvh_test_box();
+    live[i] = true;
+    bvh_add(&bvh, i, boxes[i]);
+  }
+  arr(uint8_t) buffer = bvh_serialize(&bvh, 42, NULL, NULL);
+
+  // loads into a tree that's been used for something else
+  BVH loaded;
+  bvh_init(&loaded);
+  bvh_add(&loaded, 7, bvh_test_box());
+  ASSERT_FALSE(bvh_deserialize(&loaded, 43, NULL, buffer, arrlen(buffer)));
+  ASSERT_EQ(loaded.leafCount, 1);
+  ASSERT_TRUE(bvh_deserialize(&loaded, 42, NULL, buffer, arrlen(buffer)));
+  ASSERT_EQ(loaded.leafCount, BVH_TEST_ITEMS);
+  ASSERT_EQ(hmlen(loaded.items), BVH_TEST_ITEMS);
+  bool ok = true;
+  ASSERT_EQ(bvh_test_check(&loaded, loaded.root, true, &ok), BVH_TEST_ITEMS);
+  ASSERT_TRUE(ok);
+  ASSERT_TRUE(bvh_test_query_matches(&loaded, boxes, live, BVH_TEST_ITEMS));
+
+  // and keeps working as a tree
+  bvh_remove_item(&loaded, 3);
+  live[3] = false;
+  ASSERT_TRUE(bvh_test_query_matches(&loaded, boxes, live, BVH_TEST_ITEMS));
+
+  // damage is caught
+  buffer[arrlen(buffer) / 2] ^= 1;
+  ASSERT_FALSE(bvh_deserialize(&loaded, 42, NULL, buffer, arrlen(buffer)));
+  ASSERT_FALSE(bvh_deserialize(&loaded, 42, NULL, buffer, arrlen(buffer) - 1));
+
+  arrfree(buffer);
+  bvh_free(&bvh);
+  bvh_free(&loaded);
+}
+
 UTEST(bv, setlen) {
   bv(uint64_t) bv = NULL;
   bv_setlen(bv, 100);
@@ -33,6 +33,11 @@ typedef struct LoadContext {
   yyjson_val *root;
   IDLookup *ids;
   int version;
+
+  // components are parsed first, then added to the circuit in one batch
+  arr(ComponentDescID) descs;
+  arr(HMM_Vec2) positions;
+  arr(ComponentID) componentIDs;
 } LoadContext;
 
 static bool circuit_deserialize(LoadContext *ctx) {
@@ -123,7 +128,19 @@ static bool circuit_deserialize(LoadContext *ctx) {
 
     log_debug("Adding component %s at %f %f", type, position.X, position.Y);
 
-    ComponentID componentID = circuit_add_component(circuit, descID, position);
+    arrput(ctx->descs, descID);
+    arrput(ctx->positions, position);
+  }
+
+  arrsetlen(ctx->componentIDs, arrlen(ctx->descs));
+  circuit_add_components(
+    circuit, ctx->descs, ctx->positions, arrlen(ctx->descs), ctx->componentIDs);
+
+  for (size_t i = 0; i < yyjson_arr_size(componentsVal); i++) {
+    yyjson_val *componentVal = yyjson_arr_get(componentsVal, i);
+    const char *idStr = yyjson_get_str(yyjson_obj_get(componentVal, "id"));
+
+    ComponentID componentID = ctx->componentIDs[i];
     shput(ctx->ids, idStr, componentID);
 
     Component *component = circuit_component_ptr(circuit, componentID);
@@ -238,8 +255,8 @@ static bool circuit_deserialize(LoadContext *ctx) {
       position.Y = yyjson_get_real(yyjson_arr_get(positionVal, 1));
 
       log_debug(
-        "Adding endpoint %s at %f %f to net %d", endpointIDStr, position.X,
-        position.Y, netID);
+        "Adding endpoint %s at %f %f to net %" PRIxID "", endpointIDStr,
+        position.X, position.Y, netID);
 
       EndpointID endpointID =
         circuit_add_endpoint(circuit, netID, portID, position);
@@ -294,8 +311,8 @@ static bool circuit_deserialize(LoadContext *ctx) {
       position.Y = yyjson_get_real(yyjson_arr_get(positionVal, 1));
 
       log_debug(
-        "Adding waypoint %s at %f %f to net %d", waypointIDStr, position.X,
-        position.Y, netID);
+        "Adding waypoint %s at %f %f to net %" PRIxID "", waypointIDStr,
+        position.X, position.Y, netID);
 
       EndpointID waypointID = circuit_add_waypoint(circuit, netID, position);
       shput(ctx->ids, waypointIDStr, waypointID);
@@ -347,6 +364,9 @@ bool circuit_load_file(Circuit *circuit, const char *filename) {
 
   yyjson_doc_free(doc);
   shfree(ctx.ids);
+  arrfree(ctx.descs);
+  arrfree(ctx.positions);
+  arrfree(ctx.componentIDs);
 
   return result;
 }
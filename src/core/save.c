@@ -23,7 +23,8 @@ static void
 save_id(yyjson_mut_doc *doc, yyjson_mut_val *obj, const char *key, ID id) {
   char idStr[128];
   int len = snprintf(
-    idStr, sizeof(idStr), "%x:%x:%x", id_type(id), id_gen(id), id_index(id));
+    idStr, sizeof(idStr), "%x:%x:%" PRIxID "", id_type(id), id_gen(id),
+    id_index(id));
 
   yyjson_mut_obj_add_strncpy(doc, obj, key, idStr, len);
 }
@@ -31,7 +32,8 @@ save_id(yyjson_mut_doc *doc, yyjson_mut_val *obj, const char *key, ID id) {
 static void save_id_arr(yyjson_mut_doc *doc, yyjson_mut_val *arr, ID id) {
   char idStr[128];
   int len = snprintf(
-    idStr, sizeof(idStr), "%x:%x:%x", id_type(id), id_gen(id), id_index(id));
+    idStr, sizeof(idStr), "%x:%x:%" PRIxID "", id_type(id), id_gen(id),
+    id_index(id));
 
   yyjson_mut_arr_add_strncpy(doc, arr, idStr, len);
 }
@@ -70,34 +72,35 @@ static void save_component(
 
 static void save_net(
   yyjson_mut_doc *doc, yyjson_mut_val *nets, Circuit *circuit, size_t i) {
-  Net *net = &circuit->nets[i];
   yyjson_mut_val *netNode = yyjson_mut_arr_add_obj(doc, nets);
 
   save_id(doc, netNode, "id", circuit_net_id(circuit, i));
 
+  NetIndex *index = circuit_net_index(circuit);
+
   yyjson_mut_val *endpoints = yyjson_mut_obj_add_arr(doc, netNode, "endpoints");
-  EndpointID endpointID = net->endpointFirst;
-  while (circuit_has(circuit, endpointID)) {
-    Endpoint *endpoint = circuit_endpoint_ptr(circuit, endpointID);
+  for (uint32_t j = index->endpointStart[i]; j < index->endpointStart[i + 1];
+       j++) {
+    uint32_t endpointIndex = index->endpoints[j];
+    Endpoint *endpoint = &circuit->endpoints[endpointIndex];
 
     yyjson_mut_val *endpointNode = yyjson_mut_arr_add_obj(doc, endpoints);
-    save_id(doc, endpointNode, "id", endpointID);
+    save_id(
+      doc, endpointNode, "id", circuit_endpoint_id(circuit, endpointIndex));
     save_vec2(doc, endpointNode, "position", endpoint->position);
     save_id(doc, endpointNode, "port", endpoint->port);
-
-    endpointID = endpoint->next;
   }
 
   yyjson_mut_val *waypoints = yyjson_mut_obj_add_arr(doc, netNode, "waypoints");
-  WaypointID waypointID = net->waypointFirst;
-  while (circuit_has(circuit, waypointID)) {
-    Waypoint *waypoint = circuit_waypoint_ptr(circuit, waypointID);
+  for (uint32_t j = index->waypointStart[i]; j < index->waypointStart[i + 1];
+       j++) {
+    uint32_t waypointIndex = index->waypoints[j];
+    Waypoint *waypoint = &circuit->waypoints[waypointIndex];
 
     yyjson_mut_val *waypointNode = yyjson_mut_arr_add_obj(doc, waypoints);
-    save_id(doc, waypointNode, "id", waypointID);
+    save_id(
+      doc, waypointNode, "id", circuit_waypoint_id(circuit, waypointIndex));
     save_vec2(doc, waypointNode, "position", waypoint->position);
-
-    waypointID = waypoint->next;
   }
 }
 
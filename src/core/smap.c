@@ -16,31 +16,79 @@
 
 #include "core.h"
 
+#define LOG_LEVEL LL_DEBUG
+#include "log.h"
+
 void smap_init(SparseMap *smap, IDType type) {
   *smap = (SparseMap){
     .type = type,
   };
 }
 
+static void *
+smap_realloc(SparseMap *smap, void *ptr, size_t oldSize, size_t newSize) {
+  if (smap->allocator) {
+    return smap->allocator->realloc(
+      smap->allocator->user, ptr, oldSize, newSize);
+  }
+  if (newSize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, newSize);
+}
+
+// Sets where the ids and synced arrays are allocated. Must be called before
+// anything is added to the map.
+void smap_set_allocator(SparseMap *smap, Allocator *allocator) {
+  assert(smap->capacity == 0);
+  smap->allocator = allocator;
+}
+
+// Returns how many bytes the ids and synced arrays take up at capacity.
+size_t smap_storage_size(SparseMap *smap, uint32_t capacity) {
+  size_t size = capacity * sizeof(ID);
+  for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
+    size += capacity * smap->syncedArrays[i].elemSize;
+  }
+  return size;
+}
+
+static void smap_notify(
+  SparseMap *smap, SyncedArray *syncedArray, arr(SmapCallback) callbacks,
+  uint32_t index, uint32_t count) {
+  for (int i = 0; i < arrlen(callbacks); i++) {
+    SmapCallback callback = callbacks[i];
+    if (callback.fnMany) {
+      callback.fnMany(
+        callback.user, &smap->ids[index],
+        ((char *)*syncedArray->ptr) + (index * syncedArray->elemSize), count);
+      continue;
+    }
+    for (uint32_t j = index; j < index + count; j++) {
+      callback.fn(
+        callback.user, smap->ids[j],
+        ((char *)*syncedArray->ptr) + (j * syncedArray->elemSize));
+    }
+  }
+}
+
 void smap_free(SparseMap *smap) {
   if (smap->capacity > 0) {
     for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
       SyncedArray *syncedArray = &smap->syncedArrays[i];
-      for (int j = 0; j < smap->length; j++) {
-        for (int k = 0; k < arrlen(syncedArray->delete); k++) {
-          syncedArray->delete[k].fn(
-            syncedArray->delete[k].user, smap->ids[j],
-            ((char *)*syncedArray->ptr) + (j * syncedArray->elemSize));
-        }
-      }
-      free(*syncedArray->ptr);
+      smap_notify(smap, syncedArray, syncedArray->delete, 0, smap->length);
+      smap_realloc(
+        smap, *syncedArray->ptr, smap->capacity * syncedArray->elemSize, 0);
       *syncedArray->ptr = NULL;
     }
-    free(smap->ids);
+    smap_realloc(smap, smap->ids, smap->capacity * sizeof(ID), 0);
   }
   arrfree(smap->syncedArrays);
   arrfree(smap->sparse);
   arrfree(smap->freeList);
+  arrfree(smap->dirty);
+  arrfree(smap->pageVersions);
 }
 
 void smap_clear(SparseMap *smap) {
@@ -92,7 +140,8 @@ void smap_on_delete(SparseMap *smap, void *array, SmapCallback callback) {
 }
 
 static bool smap_grow(SparseMap *smap, int wantedCapacity) {
-  if (wantedCapacity < smap->capacity) {
+  // cloning an empty map shouldn't allocate anything
+  if (wantedCapacity == 0 || wantedCapacity < smap->capacity) {
     return true;
   }
 
@@ -105,7 +154,8 @@ static bool smap_grow(SparseMap *smap, int wantedCapacity) {
     newCapacity *= 2;
   }
 
-  ID *newIds = realloc(smap->ids, newCapacity * sizeof(ID));
+  ID *newIds = smap_realloc(
+    smap, smap->ids, smap->capacity * sizeof(ID), newCapacity * sizeof(ID));
   if (newIds == NULL) {
     // todo: emit OOM error
     return false;
@@ -113,8 +163,10 @@ static bool smap_grow(SparseMap *smap, int wantedCapacity) {
   smap->ids = newIds;
 
   for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
-    void *newPtr = realloc(
-      *smap->syncedArrays[i].ptr, newCapacity * smap->syncedArrays[i].elemSize);
+    uint32_t elemSize = smap->syncedArrays[i].elemSize;
+    void *newPtr = smap_realloc(
+      smap, *smap->syncedArrays[i].ptr, smap->capacity * elemSize,
+      newCapacity * elemSize);
     if (newPtr == NULL) {
       // todo: emit OOM error
       return false;
@@ -127,17 +179,51 @@ static bool smap_grow(SparseMap *smap, int wantedCapacity) {
   return true;
 }
 
-ID smap_add(SparseMap *smap, void *value) {
-  if (!smap_grow(smap, smap->length + 1)) {
-    return NO_ID;
+bool smap_reserve(SparseMap *smap, uint32_t capacity) {
+  return smap_grow(smap, capacity);
+}
+
+// stamps the page of the element at index as changed in the current version
+static void smap_stamp(SparseMap *smap, uint32_t index) {
+  uint32_t page = index >> SMAP_PAGE_SHIFT;
+  while (arrlen(smap->pageVersions) <= page) {
+    arrput(smap->pageVersions, 0);
   }
+  smap->pageVersions[page] = smap->version;
 
-  int sparseIndex;
-  int gen = 0;
+  // once changed, this map no longer matches what it was a snapshot of
+  smap->snapshotOf = NULL;
+}
+
+void smap_touch(SparseMap *smap, uint32_t index) {
+  if (index < smap->length) {
+    smap_stamp(smap, index);
+  }
+}
+
+// allocates a handle for the element at the end of the dense arrays
+static ID smap_alloc_id(SparseMap *smap) {
+  uint32_t sparseIndex;
+  Gen gen = 0;
   if (arrlen(smap->freeList) > 0) {
-    int id = arrpop(smap->freeList);
+    ID id = arrpop(smap->freeList);
     gen = id_gen(id);
     sparseIndex = id_index(id);
+
+    if (gen == ID_GEN_MASK) {
+      smap->genOverflows++;
+      if (arrlen(smap->sparse) <= ID_INDEX_MASK) {
+        // retire the handle so that stale IDs to it stay stale forever
+        gen = 0;
+        sparseIndex = arrlen(smap->sparse);
+        arrput(smap->sparse, 0);
+      } else {
+        smap->genWraps++;
+        log_debug(
+          "Generation wrapped for %" PRIxID " in map of type %d", id,
+          smap->type);
+      }
+    }
   } else {
     sparseIndex = arrlen(smap->sparse);
     arrput(smap->sparse, 0);
@@ -145,12 +231,13 @@ ID smap_add(SparseMap *smap, void *value) {
 
   gen = (gen + 1) & ID_GEN_MASK;
   if (gen == 0) {
-    // todo: report the overflow for debugging
     gen = 1;
   }
 
   int denseIndex = smap->length;
   smap->length++;
+  smap_stamp(smap, denseIndex);
+  smap->sparseVersion = smap->version;
 
   ID sparseID = id_make(smap->type, gen, denseIndex);
   ID denseID = id_make(smap->type, gen, sparseIndex);
@@ -158,21 +245,61 @@ ID smap_add(SparseMap *smap, void *value) {
   smap->sparse[sparseIndex] = sparseID;
   smap->ids[denseIndex] = denseID;
 
+  return denseID;
+}
+
+static void
+smap_notify_create(SparseMap *smap, uint32_t index, uint32_t count) {
+  for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
+    SyncedArray *syncedArray = &smap->syncedArrays[i];
+    smap_notify(smap, syncedArray, syncedArray->create, index, count);
+  }
+}
+
+ID smap_add(SparseMap *smap, void *value) {
+  if (!smap_grow(smap, smap->length + 1)) {
+    return NO_ID;
+  }
+
+  int denseIndex = smap->length;
+  ID denseID = smap_alloc_id(smap);
+
   memcpy(
     (char *)*smap->syncedArrays[0].ptr +
       denseIndex * smap->syncedArrays[0].elemSize,
     value, smap->syncedArrays[0].elemSize);
 
-  for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
-    SyncedArray *syncedArray = &smap->syncedArrays[i];
-    for (int j = 0; j < arrlen(syncedArray->create); j++) {
-      syncedArray->create[j].fn(
-        syncedArray->create[j].user, denseID,
-        ((char *)*syncedArray->ptr) + denseIndex * syncedArray->elemSize);
+  smap_notify_create(smap, denseIndex, 1);
+
+  return denseID;
+}
+
+bool smap_add_many(SparseMap *smap, void *values, uint32_t count, ID *ids) {
+  if (count == 0) {
+    return true;
+  }
+  if (!smap_grow(smap, smap->length + count)) {
+    return false;
+  }
+
+  int denseIndex = smap->length;
+  for (uint32_t i = 0; i < count; i++) {
+    ID id = smap_alloc_id(smap);
+    if (ids) {
+      ids[i] = id;
     }
   }
 
-  return denseID;
+  memcpy(
+    (char *)*smap->syncedArrays[0].ptr +
+      denseIndex * smap->syncedArrays[0].elemSize,
+    values, count * smap->syncedArrays[0].elemSize);
+
+  // callbacks run once per element unless they accept the whole range, and
+  // they all see the fully populated range
+  smap_notify_create(smap, denseIndex, count);
+
+  return true;
 }
 
 void smap_del(SparseMap *smap, ID id) {
@@ -185,15 +312,21 @@ void smap_del(SparseMap *smap, ID id) {
 
   for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
     SyncedArray *syncedArray = &smap->syncedArrays[i];
-    for (int j = 0; j < arrlen(syncedArray->delete); j++) {
-      syncedArray->delete[j].fn(
-        syncedArray->delete[j].user, id,
-        ((char *)*syncedArray->ptr) + denseIndex * syncedArray->elemSize);
-    }
+    smap_notify(smap, syncedArray, syncedArray->delete, denseIndex, 1);
+  }
+
+  if (
+    (sparseIndex >> 6) < arrlen(smap->dirty) &&
+    bv_is_set(smap->dirty, sparseIndex)) {
+    bv_clear(smap->dirty, sparseIndex);
+    smap->dirtyCount--;
   }
 
   int lastDenseIndex = smap->length - 1;
 
+  smap_stamp(smap, denseIndex);
+  smap->sparseVersion = smap->version;
+
   smap->sparse[sparseIndex] = NO_ID;
   arrput(smap->freeList, id);
 
@@ -215,21 +348,33 @@ void smap_del(SparseMap *smap, ID id) {
   smap->length--;
 }
 
+static void smap_mark_dirty(SparseMap *smap, uint32_t sparseIndex) {
+  while (arrlen(smap->dirty) <= (sparseIndex >> 6)) {
+    arrput(smap->dirty, 0);
+  }
+  if (!bv_is_set(smap->dirty, sparseIndex)) {
+    bv_set(smap->dirty, sparseIndex);
+    smap->dirtyCount++;
+  }
+}
+
 void smap_update_id(SparseMap *smap, ID id) {
   if (!smap_has(smap, id)) {
     return;
   }
 
   int sparseIndex = id_index(id);
+  smap_stamp(smap, id_index(smap->sparse[sparseIndex]));
+  if (smap->trackDirty) {
+    smap_mark_dirty(smap, sparseIndex);
+    return;
+  }
+
   int denseIndex = id_index(smap->sparse[sparseIndex]);
 
   for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
     SyncedArray *syncedArray = &smap->syncedArrays[i];
-    for (int j = 0; j < arrlen(syncedArray->update); j++) {
-      syncedArray->update[j].fn(
-        syncedArray->update[j].user, id,
-        ((char *)*syncedArray->ptr) + denseIndex * syncedArray->elemSize);
-    }
+    smap_notify(smap, syncedArray, syncedArray->update, denseIndex, 1);
   }
 }
 
@@ -238,34 +383,141 @@ void smap_update_index(SparseMap *smap, uint32_t index) {
     return;
   }
 
+  smap_stamp(smap, index);
+  if (smap->trackDirty) {
+    smap_mark_dirty(smap, id_index(smap->ids[index]));
+    return;
+  }
+
   for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
     SyncedArray *syncedArray = &smap->syncedArrays[i];
-    for (int j = 0; j < arrlen(syncedArray->update); j++) {
-      syncedArray->update[j].fn(
-        syncedArray->update[j].user, smap->ids[index],
-        ((char *)*syncedArray->ptr) + index * syncedArray->elemSize);
+    smap_notify(smap, syncedArray, syncedArray->update, index, 1);
+  }
+}
+
+void smap_track_dirty(SparseMap *smap, bool enabled) {
+  if (!enabled) {
+    smap_flush_dirty(smap);
+  }
+  smap->trackDirty = enabled;
+}
+
+void smap_flush_dirty(SparseMap *smap) {
+  // callbacks may mark more elements dirty, including ones already flushed,
+  // so keep going until everything is clean
+  while (smap->dirtyCount > 0) {
+    for (int word = 0; word < arrlen(smap->dirty); word++) {
+      if (smap->dirty[word] == 0) {
+        continue;
+      }
+      for (int bit = 0; bit < 64; bit++) {
+        uint32_t sparseIndex = (word << 6) | bit;
+        if (!bv_is_set(smap->dirty, sparseIndex)) {
+          continue;
+        }
+        bv_clear(smap->dirty, sparseIndex);
+        smap->dirtyCount--;
+
+        int denseIndex = id_index(smap->sparse[sparseIndex]);
+        for (int i = 0; i < arrlen(smap->syncedArrays); i++) {
+          SyncedArray *syncedArray = &smap->syncedArrays[i];
+          smap_notify(smap, syncedArray, syncedArray->update, denseIndex, 1);
+        }
+      }
     }
   }
 }
 
-void smap_clone_from(SparseMap *dst, SparseMap *src) {
-  smap_clear(dst);
+void smap_snapshot(SparseMap *dst, SparseMap *src) {
+  if (dst->snapshotOf != src) {
+    // not a snapshot of src (any more), so everything needs to be copied
+    dst->snapshotVersion = 0;
+  }
   smap_grow(dst, src->length);
 
   dst->type = src->type;
   dst->length = src->length;
 
-  for (int i = 0; i < arrlen(dst->syncedArrays); i++) {
-    void *srcPtr = *src->syncedArrays[i].ptr;
-    void *dstPtr = *dst->syncedArrays[i].ptr;
-    memcpy(dstPtr, srcPtr, src->length * src->syncedArrays[i].elemSize);
+  uint32_t pageCount = (src->length + SMAP_PAGE_SIZE - 1) >> SMAP_PAGE_SHIFT;
+  for (uint32_t page = 0; page < pageCount; page++) {
+    if (
+      page < arrlen(src->pageVersions) &&
+      src->pageVersions[page] < dst->snapshotVersion) {
+      continue;
+    }
+
+    uint32_t start = page << SMAP_PAGE_SHIFT;
+    uint32_t count = HMM_MIN(SMAP_PAGE_SIZE, src->length - start);
+    for (int i = 0; i < arrlen(dst->syncedArrays); i++) {
+      uint32_t elemSize = src->syncedArrays[i].elemSize;
+      memcpy(
+        (char *)*dst->syncedArrays[i].ptr + start * elemSize,
+        (char *)*src->syncedArrays[i].ptr + start * elemSize,
+        count * elemSize);
+    }
+    memcpy(dst->ids + start, src->ids + start, count * sizeof(ID));
   }
 
-  memcpy(dst->ids, src->ids, src->length * sizeof(ID));
+  if (src->sparseVersion >= dst->snapshotVersion) {
+    arrsetlen(dst->sparse, arrlen(src->sparse));
+    if (arrlen(src->sparse) > 0) {
+      memcpy(dst->sparse, src->sparse, arrlen(src->sparse) * sizeof(ID));
+    }
+
+    arrsetlen(dst->freeList, arrlen(src->freeList));
+    if (arrlen(src->freeList) > 0) {
+      memcpy(
+        dst->freeList, src->freeList, arrlen(src->freeList) * sizeof(ID));
+    }
+  }
+
+  // anything changed in src from here on is newer than this snapshot
+  src->version++;
+  dst->snapshotOf = src;
+  dst->snapshotVersion = src->version;
+}
+
+// Copies all of src into dst without calling any callbacks, reusing the
+// capacity dst already has. Synced arrays are matched up by the order they were
+// added in.
+void smap_clone_from(SparseMap *dst, SparseMap *src) {
+  smap_grow(dst, src->length);
+
+  dst->type = src->type;
+  dst->length = src->length;
+
+  if (src->length > 0) {
+    int arrayCount =
+      HMM_MIN(arrlen(dst->syncedArrays), arrlen(src->syncedArrays));
+    for (int i = 0; i < arrayCount; i++) {
+      assert(dst->syncedArrays[i].elemSize == src->syncedArrays[i].elemSize);
+      memcpy(
+        *dst->syncedArrays[i].ptr, *src->syncedArrays[i].ptr,
+        src->length * src->syncedArrays[i].elemSize);
+    }
+    memcpy(dst->ids, src->ids, src->length * sizeof(ID));
+  }
 
   arrsetlen(dst->sparse, arrlen(src->sparse));
-  memcpy(dst->sparse, src->sparse, arrlen(src->sparse) * sizeof(ID));
+  if (arrlen(src->sparse) > 0) {
+    memcpy(dst->sparse, src->sparse, arrlen(src->sparse) * sizeof(ID));
+  }
 
   arrsetlen(dst->freeList, arrlen(src->freeList));
-  memcpy(dst->freeList, src->freeList, arrlen(src->freeList) * sizeof(ID));
+  if (arrlen(src->freeList) > 0) {
+    memcpy(dst->freeList, src->freeList, arrlen(src->freeList) * sizeof(ID));
+  }
+
+  // nothing that was pending in dst applies any more
+  if (dst->dirtyCount > 0) {
+    bv_clear_all(dst->dirty);
+    dst->dirtyCount = 0;
+  }
+
+  // everything in dst changed as far as snapshots of dst are concerned
+  for (uint32_t i = 0; i < dst->length; i += SMAP_PAGE_SIZE) {
+    smap_stamp(dst, i);
+  }
+  dst->sparseVersion = dst->version;
+  dst->snapshotOf = NULL;
 }
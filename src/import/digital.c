@@ -175,6 +175,9 @@ void import_digital(CircuitUX *ux, char *buffer) {
   arr(PortID) outPorts = 0;
   arr(HMM_Vec2) waypoints = 0;
   arr(uint32_t) netWires = 0;
+  arr(ComponentDescID) descIDs = 0;
+  arr(HMM_Vec2) positions = 0;
+  arr(ComponentID) componentIDs = 0;
 
   arr(DigWire) digWires = 0;
 
@@ -318,67 +321,78 @@ void import_digital(CircuitUX *ux, char *buffer) {
       }
 
       log_debug("Adding component %s at %d, %d\n", typeName, x, y);
-      ComponentID componentID =
-        circuit_add_component(&ux->view.circuit, descID, HMM_V2(x, y));
-
-      // digital's components are placed relative to the first port
-      Component *component =
-        circuit_component_ptr(&ux->view.circuit, componentID);
-
-      PortID firstPort = component->portFirst;
-      Port *port = circuit_port_ptr(&ux->view.circuit, firstPort);
-      circuit_move_component(
-        &ux->view.circuit, componentID,
-        HMM_SubV2(HMM_V2(0, 0), port->position));
-
-      HMM_Vec2 portPos = HMM_AddV2(component->box.center, port->position);
-      log_debug("Moved: %f == %d, %f == %d\n", portPos.X, x, portPos.Y, y);
-
-      const ComponentDesc *desc = &ux->view.circuit.componentDescs[descID];
-      switch (descID) {
-      case COMP_INPUT:
-      case COMP_OUTPUT: {
-        PortID portID = firstPort;
-        log_debug("Adding port %s at %d, %d\n", desc->ports[0].name, x, y);
-        replace_wire_end_with_port(
-          digWires, digWireEnds, portID, (IVec2){x, y}, descID == COMP_OUTPUT);
-        break;
+      arrput(descIDs, descID);
+      arrput(positions, HMM_V2(x, y));
+    }
+  }
+
+  arrsetlen(componentIDs, arrlen(descIDs));
+  circuit_add_components(
+    &ux->view.circuit, descIDs, positions, arrlen(descIDs), componentIDs);
+
+  for (int i = 0; i < arrlen(componentIDs); i++) {
+    ComponentID componentID = componentIDs[i];
+    ComponentDescID descID = descIDs[i];
+    int x = (int)positions[i].X;
+    int y = (int)positions[i].Y;
+
+    // digital's components are placed relative to the first port
+    Component *component =
+      circuit_component_ptr(&ux->view.circuit, componentID);
+
+    PortID firstPort = component->portFirst;
+    Port *port = circuit_port_ptr(&ux->view.circuit, firstPort);
+    circuit_move_component(
+      &ux->view.circuit, componentID,
+      HMM_SubV2(HMM_V2(0, 0), port->position));
+
+    HMM_Vec2 portPos = HMM_AddV2(component->box.center, port->position);
+    log_debug("Moved: %f == %d, %f == %d\n", portPos.X, x, portPos.Y, y);
+
+    const ComponentDesc *desc = &ux->view.circuit.componentDescs[descID];
+    switch (descID) {
+    case COMP_INPUT:
+    case COMP_OUTPUT: {
+      PortID portID = firstPort;
+      log_debug("Adding port %s at %d, %d\n", desc->ports[0].name, x, y);
+      replace_wire_end_with_port(
+        digWires, digWireEnds, portID, (IVec2){x, y}, descID == COMP_OUTPUT);
+      break;
+    }
+    case COMP_AND:
+    case COMP_OR:
+    case COMP_XOR:
+    case COMP_NOT: {
+      IVec2 nextInput = {x, y};
+      IVec2 nextOutput = {x + 4 * 20, y + 20};
+      if (descID == COMP_NOT) {
+        nextOutput = (IVec2){x + 2 * 20, y};
       }
-      case COMP_AND:
-      case COMP_OR:
-      case COMP_XOR:
-      case COMP_NOT: {
-        IVec2 nextInput = {x, y};
-        IVec2 nextOutput = {x + 4 * 20, y + 20};
-        if (descID == COMP_NOT) {
-          nextOutput = (IVec2){x + 2 * 20, y};
+      PortID portID = component->portFirst;
+      int j = 0;
+      while (circuit_has(&ux->view.circuit, portID)) {
+        IVec2 pos = nextInput;
+        if (desc->ports[j].direction == PORT_OUT) {
+          pos = nextOutput;
+          nextOutput.y += 20;
+        } else {
+          nextInput.y += 40;
         }
-        PortID portID = component->portFirst;
-        int j = 0;
-        while (circuit_has(&ux->view.circuit, portID)) {
-          IVec2 pos = nextInput;
-          if (desc->ports[j].direction == PORT_OUT) {
-            pos = nextOutput;
-            nextOutput.y += 20;
-          } else {
-            nextInput.y += 40;
-          }
-          log_debug(
-            "Adding port %s at %d, %d\n", desc->ports[j].name, pos.x, pos.y);
-          replace_wire_end_with_port(
-            digWires, digWireEnds, portID, pos,
-            desc->ports[j].direction == PORT_IN);
+        log_debug(
+          "Adding port %s at %d, %d\n", desc->ports[j].name, pos.x, pos.y);
+        replace_wire_end_with_port(
+          digWires, digWireEnds, portID, pos,
+          desc->ports[j].direction == PORT_IN);
 
-          portID = circuit_port_ptr(&ux->view.circuit, portID)->next;
-          j++;
-        }
-        break;
-      }
-      default:
-        log_debug("Unknown component type %d\n", descID);
-        assert(0);
-        break;
+        portID = circuit_port_ptr(&ux->view.circuit, portID)->next;
+        j++;
       }
+      break;
+    }
+    default:
+      log_debug("Unknown component type %d\n", descID);
+      assert(0);
+      break;
     }
   }
 
@@ -618,10 +632,10 @@ void import_digital(CircuitUX *ux, char *buffer) {
     }
 
     NetID netID = circuit_add_net(&ux->view.circuit);
-    log_debug("Net %d", netID);
+    log_debug("Net %" PRIxID "", netID);
 
     for (int j = 0; j < arrlen(inPorts); j++) {
-      log_debug("  * In port %d", inPorts[j]);
+      log_debug("  * In port %" PRIxID "", inPorts[j]);
       circuit_add_endpoint(&ux->view.circuit, netID, inPorts[j], HMM_V2(0, 0));
     }
     for (int j = 0; j < arrlen(waypoints); j++) {
@@ -629,7 +643,7 @@ void import_digital(CircuitUX *ux, char *buffer) {
       circuit_add_waypoint(&ux->view.circuit, netID, waypoints[j]);
     }
     for (int j = 0; j < arrlen(outPorts); j++) {
-      log_debug("  * Out port %d", outPorts[j]);
+      log_debug("  * Out port %" PRIxID "", outPorts[j]);
       circuit_add_endpoint(&ux->view.circuit, netID, outPorts[j], HMM_V2(0, 0));
     }
 
@@ -645,6 +659,9 @@ fail:
   arrfree(outPorts);
   arrfree(netWires);
   arrfree(waypoints);
+  arrfree(descIDs);
+  arrfree(positions);
+  arrfree(componentIDs);
   arrfree(digWires);
   for (int i = 0; i < hmlen(digWireEnds); i++) {
     arrfree(digWireEnds[i].value);
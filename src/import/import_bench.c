@@ -0,0 +1,125 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdlib.h>
+
+#include "core/core.h"
+#include "import/import.h"
+#include "sokol_time.h"
+#include "utest.h"
+#include "ux/ux.h"
+
+typedef struct CountingAllocator {
+  uint32_t allocs;
+  size_t used;
+  size_t peak;
+} CountingAllocator;
+
+// heap allocator that counts how often the sparse maps go to the heap
+static void *
+counting_realloc(void *user, void *ptr, size_t oldSize, size_t newSize) {
+  CountingAllocator *counter = user;
+  counter->used += newSize - oldSize;
+  counter->peak = HMM_MAX(counter->peak, counter->used);
+  if (newSize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  counter->allocs++;
+  return realloc(ptr, newSize);
+}
+
+static char *read_file(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buffer = malloc(size + 1);
+  size_t read = fread(buffer, 1, size, fp);
+  buffer[read] = 0;
+  fclose(fp);
+  return buffer;
+}
+
+static const char *testCircuits[] = {
+  "res/assets/testdata/simple_test.dig",
+  "res/assets/testdata/alu_1bit_2gatemux.dig",
+  "res/assets/testdata/alu_1bit_2inpgate.dig",
+};
+
+// run from the root of the repo so the test circuits can be found
+UTEST(ImportBench, storage) {
+  for (int i = 0; i < sizeof(testCircuits) / sizeof(testCircuits[0]); i++) {
+    char *buffer = read_file(testCircuits[i]);
+    if (!buffer) {
+      UTEST_SKIP("test circuits not found");
+    }
+
+    // load onto the heap, counting allocations
+    CountingAllocator counter = {0};
+    Allocator heap = {.realloc = counting_realloc, .user = &counter};
+    CircuitUX ux;
+    ux_init(&ux, circuit_component_descs(), NULL, NULL);
+    circuit_set_allocator(&ux.view.circuit, &heap);
+    uint64_t start = stm_now();
+    import_digital(&ux, buffer);
+    double loadMs = stm_ms(stm_since(start));
+
+    // load again into an arena with no size hint
+    Arena loadArena;
+    arena_init(&loadArena, 0);
+    Allocator loadAllocator = arena_allocator(&loadArena);
+    CircuitUX arenaUX;
+    ux_init(&arenaUX, circuit_component_descs(), NULL, NULL);
+    circuit_set_allocator(&arenaUX.view.circuit, &loadAllocator);
+    start = stm_now();
+    import_digital(&arenaUX, buffer);
+    double arenaLoadMs = stm_ms(stm_since(start));
+
+    // and clone into an arena sized from the loaded circuit
+    Arena cloneArena;
+    arena_init(&cloneArena, circuit_storage_size(&ux.view.circuit));
+    Allocator cloneAllocator = arena_allocator(&cloneArena);
+    Circuit clone;
+    circuit_init(&clone, circuit_component_descs());
+    circuit_set_allocator(&clone, &cloneAllocator);
+    start = stm_now();
+    circuit_clone_from(&clone, &ux.view.circuit);
+    double cloneMs = stm_ms(stm_since(start));
+
+    printf(
+      "%s: heap %u allocs, peak %zu KiB, %.3fms; "
+      "arena %u blocks, peak %zu KiB, %.3fms; "
+      "clone %u blocks, %zu KiB, %.3fms\n",
+      testCircuits[i], counter.allocs, counter.peak / 1024, loadMs,
+      loadArena.blockCount, loadArena.peak / 1024, arenaLoadMs,
+      cloneArena.blockCount, cloneArena.peak / 1024, cloneMs);
+
+    ASSERT_EQ(cloneArena.blockCount, 1);
+    ASSERT_EQ(
+      circuit_component_len(&clone), circuit_component_len(&ux.view.circuit));
+
+    circuit_free(&clone);
+    arena_free(&cloneArena);
+    ux_free(&arenaUX);
+    arena_free(&loadArena);
+    ux_free(&ux);
+    free(buffer);
+  }
+}
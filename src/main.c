@@ -311,7 +311,7 @@ void frame(void *user_data) {
           circuit_load_file(
             &app->circuit.ux.view.circuit, platform_autosave_path());
           ux_route(&app->circuit.ux);
-          ux_build_bvh(&app->circuit.ux);
+          ui_load_bvh(&app->circuit, platform_autosave_path());
           app->loaded = true;
         }
       }
@@ -333,6 +333,7 @@ void frame(void *user_data) {
 
   draw_begin_frame(&app->draw);
   app->circuit.ux.input.frameDuration = sapp_frame_duration();
+  app->circuit.ux.view.screenSize = HMM_V2((float)width, (float)height);
   ui_draw(&app->circuit);
   app->circuit.ux.input.scroll = HMM_V2(0, 0);
   app->circuit.ux.input.mouseDelta = HMM_V2(0, 0);
@@ -366,10 +367,12 @@ void frame(void *user_data) {
       buff, sizeof(buff),
       "Routing: Build: %.3fms min, %.3fms avg, %.3fms max; Pathing: %.3fms "
       "min, %.3fms "
-      "avg, %.3fms max; Samples: %d",
+      "avg, %.3fms max; Samples: %d; Graphs: %d; Nets: %d/%d; Retries: %d",
       stm_ms(rtStats.build.min), stm_ms(rtStats.build.avg),
       stm_ms(rtStats.build.max), stm_ms(rtStats.route.min),
-      stm_ms(rtStats.route.avg), stm_ms(rtStats.route.max), rtStats.samples);
+      stm_ms(rtStats.route.avg), stm_ms(rtStats.route.max), rtStats.samples,
+      rtStats.graphBuilds, rtStats.routedNets, rtStats.totalNets,
+      rtStats.retries);
 
     box = draw_text_bounds(
       &app->draw, HMM_V2(0, (float)height - (box.halfSize.Y * 2 + 8)), buff,
@@ -377,6 +380,18 @@ void frame(void *user_data) {
     draw_screen_text(
       &app->draw, box, buff, strlen(buff), 20.0, &app->fonsFont,
       HMM_V4(1, 1, 1, 1), HMM_V4(0, 0, 0, 0));
+
+    snprintf(
+      buff, sizeof(buff), "Drawn: %u Culled: %u",
+      app->circuit.ux.view.drawStats.drawn,
+      app->circuit.ux.view.drawStats.culled);
+
+    box = draw_text_bounds(
+      &app->draw, HMM_V2(0, box.center.Y - (box.halfSize.Y + 8)), buff,
+      strlen(buff), ALIGN_LEFT, ALIGN_BOTTOM, 20.0, &app->fonsFont);
+    draw_screen_text(
+      &app->draw, box, buff, strlen(buff), 20.0, &app->fonsFont,
+      HMM_V4(1, 1, 1, 1), HMM_V4(0, 0, 0, 0));
   }
 
   sg_pass pass = {
@@ -21,6 +21,9 @@
 #define SOKOL_IMPL
 #include "sokol_time.h"
 
+#define THREAD_IMPLEMENTATION
+#include "thread.h"
+
 #include "utest.h"
 
 #ifndef _WIN32
@@ -33,6 +36,7 @@ int main(int argc, const char *const argv[]) {
 #ifndef _WIN32
   init_exceptions((char *)argv[0]);
 #endif
+  stm_setup();
   ux_global_init();
   return utest_main(argc, argv);
 }
\ No newline at end of file
@@ -36,7 +36,42 @@ void ui_init(
   thread_mutex_init(&ui->saveMutex);
 }
 
-void ui_free(CircuitUI *ui) { ux_free(&ui->ux); }
+void ui_free(CircuitUI *ui) {
+  ux_free(&ui->ux);
+  arrfree(ui->saveBVH);
+}
+
+// the BVH of a circuit is saved in a sidecar file next to it
+static void ui_bvh_filename(const char *filename, char *bvhFilename) {
+  snprintf(bvhFilename, 1024, "%s.bvh", filename);
+}
+
+// Sets up the BVH for a circuit just loaded from filename, from its sidecar if
+// that's still up to date, which skips building it for big circuits.
+void ui_load_bvh(CircuitUI *ui, const char *filename) {
+  char bvhFilename[1024];
+  ui_bvh_filename(filename, bvhFilename);
+
+  arr(uint8_t) data = NULL;
+  FILE *fp = fopen(bvhFilename, "rb");
+  if (fp) {
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size > 0) {
+      arrsetlen(data, size);
+      if (fread(data, 1, size, fp) != (size_t)size) {
+        arrsetlen(data, 0);
+      }
+    }
+    fclose(fp);
+  }
+
+  if (!ux_load_bvh(&ui->ux, data, arrlen(data))) {
+    log_info("No up to date BVH in %s, built it instead", bvhFilename);
+  }
+  arrfree(data);
+}
 
 bool ui_open_file_browser(CircuitUI *ui, bool saving, char *filename) {
   const char *filters = ".dlc;.dig";
@@ -103,7 +138,7 @@ static void ui_menu_bar(CircuitUI *ui, struct nk_context *ctx, float width) {
           circuit_clear(&ui->ux.view.circuit);
           circuit_load_file(&ui->ux.view.circuit, loadfile);
           ux_route(&ui->ux);
-          ux_build_bvh(&ui->ux);
+          ui_load_bvh(ui, loadfile);
         }
       }
       if (nk_menu_item_label(ctx, "Save", NK_TEXT_LEFT)) {
@@ -245,7 +280,17 @@ void ui_draw(CircuitUI *ui) { ux_draw(&ui->ux); }
 static int ui_do_save(void *data) {
   CircuitUI *ui = (CircuitUI *)data;
   thread_mutex_lock(&ui->saveMutex);
-  circuit_save_file(&ui->saveCopy, ui->saveFilename);
+  if (circuit_save_file(&ui->saveCopy, ui->saveFilename)) {
+    ux_stamp_bvh(&ui->saveCopy, &ui->saveTheme, ui->saveBVH);
+
+    char bvhFilename[1024];
+    ui_bvh_filename(ui->saveFilename, bvhFilename);
+    FILE *fp = fopen(bvhFilename, "wb");
+    if (fp) {
+      fwrite(ui->saveBVH, 1, arrlen(ui->saveBVH), fp);
+      fclose(fp);
+    }
+  }
   thread_atomic_int_store(&ui->saveThreadBusy, 0);
   thread_mutex_unlock(&ui->saveMutex);
   return 0;
@@ -257,7 +302,10 @@ bool ui_background_save(
     return false;
   }
   thread_mutex_lock(&ui->saveMutex);
-  circuit_clone_from(&ui->saveCopy, &ui->ux.view.circuit);
+  arrsetlen(ui->saveBVH, 0);
+  ui->saveBVH = ux_snapshot_bvh(&ui->ux, ui->saveBVH);
+  ui->saveTheme = ui->ux.view.theme;
+  circuit_snapshot(&ui->saveCopy, &ui->ux.view.circuit);
   memcpy(ui->saveFilename, filename, 1024);
   thread_atomic_int_store(&ui->saveThreadBusy, 1);
   thread_mutex_unlock(&ui->saveMutex);
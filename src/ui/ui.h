@@ -51,6 +51,10 @@ typedef struct CircuitUI {
   bool showAbout;
 
   Circuit saveCopy;
+  // the BVH to go in the sidecar next to saveCopy, see ui_load_bvh. it's only
+  // copied on the UI thread, and stamped for saveCopy on the save thread.
+  arr(uint8_t) saveBVH;
+  Theme saveTheme;
   thread_atomic_int_t saveThreadBusy;
   char saveFilename[1024];
   thread_mutex_t saveMutex;
@@ -65,5 +69,6 @@ void ui_update(
   CircuitUI *ui, struct nk_context *ctx, float width, float height);
 void ui_draw(CircuitUI *ui);
 bool ui_background_save(CircuitUI *ui, const char *filename, bool skipWhenBusy);
+void ui_load_bvh(CircuitUI *ui, const char *filename);
 
 #endif // UI_H
\ No newline at end of file
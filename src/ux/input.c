@@ -207,14 +207,14 @@ static void ux_mouse_down_state_machine(CircuitUX *ux, HMM_Vec2 worldMousePos) {
         break;
 
       case STATE_MOVE_SELECTION:
-        // rebuild the BVH after moving things
-        ux_build_bvh(ux);
+        // update the BVH after moving things
+        ux_update_bvh(ux);
         break;
 
       case STATE_CLICK_WIRING:
       case STATE_DRAG_WIRING:
-        // rebuild the BVH after wiring things
-        ux_build_bvh(ux);
+        // update the BVH after wiring things
+        ux_update_bvh(ux);
         break;
 
       case STATE_ADD_COMPONENT: {
@@ -231,8 +231,8 @@ static void ux_mouse_down_state_machine(CircuitUX *ux, HMM_Vec2 worldMousePos) {
               });
         ux_start_adding_component(ux, descID);
 
-        // rebuild the BVH after adding things
-        ux_build_bvh(ux);
+        // update the BVH after adding things
+        ux_update_bvh(ux);
       } break;
 
       default:
@@ -362,53 +362,125 @@ static void ux_mouse_down_state_machine(CircuitUX *ux, HMM_Vec2 worldMousePos) {
   ux->mouseDownState = state;
 }
 
-static void ux_handle_mouse(CircuitUX *ux) {
-  ux->view.hovered = NO_ID;
-  ux->view.hoveredPort = NO_PORT;
+// hover picking prefers ports, then waypoints, then wires, then components.
+// ports are picked into hoveredPort and the rest into hovered, and the mouse
+// state machine checks hoveredPort first.
+typedef enum HoverPriority {
+  HOVER_NONE,
+  HOVER_COMPONENT,
+  HOVER_WIRE,
+  HOVER_WAYPOINT,
+  HOVER_PORT,
+} HoverPriority;
+
+typedef struct HoverPick {
+  ID id;
+  HoverPriority priority;
+  float distance;
+  float centerDistance;
+} HoverPick;
+
+// prefers the higher priority, then the box the mouse is nearest to (or
+// inside), then the box whose center is nearest
+static void ux_consider_pick(HoverPick *best, HoverPick pick) {
+  if (
+    pick.priority > best->priority ||
+    (pick.priority == best->priority &&
+     (pick.distance < best->distance ||
+      (pick.distance == best->distance &&
+       pick.centerDistance < best->centerDistance)))) {
+    *best = pick;
+  }
+}
 
-  HMM_Vec2 worldMousePos =
-    draw_screen_to_world(ux->view.drawCtx, ux->input.mousePos);
+static HoverPick
+ux_hover_pick(ID id, HoverPriority priority, Box box, HMM_Vec2 pos) {
+  HMM_Vec2 delta = HMM_SubV2(pos, box.center);
+  float dx = HMM_MAX(HMM_ABS(delta.X) - box.halfSize.X, 0);
+  float dy = HMM_MAX(HMM_ABS(delta.Y) - box.halfSize.Y, 0);
+  return (HoverPick){
+    .id = id,
+    .priority = priority,
+    .distance = dx * dx + dy * dy,
+    .centerDistance = HMM_LenSqrV2(delta),
+  };
+}
 
+// Works out what's under the mouse from the BVH alone, so it costs the same
+// however big the circuit is.
+void ux_update_hover(CircuitUX *ux, HMM_Vec2 worldMousePos) {
   Box mouseBox = {
     .center = worldMousePos,
     .halfSize = HMM_V2(MOUSE_FUDGE, MOUSE_FUDGE),
   };
 
-  arrsetlen(ux->view.hovered2, 0);
-  ux->view.hovered2 = bvh_query(&ux->bvh, mouseBox, ux->view.hovered2);
+  // waypoints can be grabbed from further away than their boxes in the BVH,
+  // so look wide enough for them and test each hit properly below
+  Box queryBox = {
+    .center = worldMousePos,
+    .halfSize =
+      HMM_V2(MOUSE_FUDGE + MOUSE_WP_FUDGE, MOUSE_FUDGE + MOUSE_WP_FUDGE),
+  };
+  arrsetlen(ux->hoverHits, 0);
+  ux->hoverHits = bvh_query_leaves(&ux->bvh, queryBox, ux->hoverHits);
 
-  for (size_t i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
-    Component *component = &ux->view.circuit.components[i];
-    if (box_intersect_box(component->box, mouseBox)) {
-      ux->view.hovered = circuit_component_id(&ux->view.circuit, i);
+  HoverPick port = {.id = NO_PORT};
+  HoverPick item = {.id = NO_ID};
+  arrsetlen(ux->view.hovered2, 0);
+  for (int i = 0; i < arrlen(ux->hoverHits); i++) {
+    BVHHit *hit = &ux->hoverHits[i];
+    if (!circuit_has(&ux->view.circuit, hit->item)) {
+      // deleted since the BVH was last updated
+      continue;
+    }
+    Box box = hit->box;
+    HoverPriority priority = HOVER_NONE;
+    switch (id_type(hit->item)) {
+    case ID_COMPONENT:
+      priority = HOVER_COMPONENT;
+      break;
+    case ID_NET:
+      priority = HOVER_WIRE;
+      break;
+    case ID_WAYPOINT:
+      priority = HOVER_WAYPOINT;
+      box.halfSize = HMM_V2(MOUSE_WP_FUDGE, MOUSE_WP_FUDGE);
+      break;
+    case ID_PORT:
+      priority = HOVER_PORT;
+      break;
+    default:
+      break;
+    }
+    if (!box_intersect_box(box, mouseBox)) {
+      continue;
     }
-    PortID portID = ux->view.circuit.components[i].portFirst;
-    while (circuit_has(&ux->view.circuit, portID)) {
-      Port *port = circuit_port_ptr(&ux->view.circuit, portID);
-      Box portBox = {
-        .center = HMM_AddV2(port->position, component->box.center),
-        .halfSize = HMM_V2(
-          ux->view.theme.portWidth / 2.0f, ux->view.theme.portWidth / 2.0f),
-      };
-      if (box_intersect_box(portBox, mouseBox)) {
-        ux->view.hoveredPort = portID;
-      }
 
-      portID = circuit_port_ptr(&ux->view.circuit, portID)->next;
+    // nets are hit once per wire segment
+    bool seen = false;
+    for (int j = 0; j < arrlen(ux->view.hovered2); j++) {
+      seen = seen || ux->view.hovered2[j] == hit->item;
+    }
+    if (!seen) {
+      arrput(ux->view.hovered2, hit->item);
     }
-  }
 
-  for (size_t i = 0; i < circuit_waypoint_len(&ux->view.circuit); i++) {
-    Waypoint *waypoint = &ux->view.circuit.waypoints[i];
-    Box waypointBox = {
-      .center = waypoint->position,
-      .halfSize = HMM_V2(MOUSE_WP_FUDGE, MOUSE_WP_FUDGE),
-    };
-    if (box_intersect_box(waypointBox, mouseBox)) {
-      ux->view.hovered = circuit_waypoint_id(&ux->view.circuit, i);
+    HoverPick pick = ux_hover_pick(hit->item, priority, box, worldMousePos);
+    if (priority == HOVER_PORT) {
+      ux_consider_pick(&port, pick);
+    } else if (priority != HOVER_NONE) {
+      ux_consider_pick(&item, pick);
     }
   }
 
+  ux->view.hovered = item.id;
+  ux->view.hoveredPort = port.id;
+}
+
+static void ux_handle_mouse(CircuitUX *ux) {
+  HMM_Vec2 worldMousePos =
+    draw_screen_to_world(ux->view.drawCtx, ux->input.mousePos);
+  ux_update_hover(ux, worldMousePos);
   ux_mouse_down_state_machine(ux, worldMousePos);
 }
 
@@ -441,6 +513,10 @@ static void ux_zoom(CircuitUX *ux) {
 #define WASD_PIXELS_PER_SECOND 1000.0f
 
 void ux_update(CircuitUX *ux) {
+  if (autoroute_poll(ux->router)) {
+    ux->view.wiresUnindexed = true;
+  }
+
   float dt = (float)ux->input.frameDuration;
   HMM_Vec2 panDelta = HMM_V2(0, 0);
   if (bv_is_set(ux->input.keysDown, KEYCODE_W)) {
@@ -505,6 +581,12 @@ void ux_update(CircuitUX *ux) {
     ux_route(ux);
   }
 
+  if (bv_is_set(ux->input.keysPressed, KEYCODE_R)) {
+    ux->asyncRouting = !ux->asyncRouting;
+    printf("Background routing: %s\n", ux->asyncRouting ? "on" : "off");
+    ux_route(ux);
+  }
+
   if (bv_is_set(ux->input.keysPressed, KEYCODE_V)) {
     ux->bvhDebugLines = !ux->bvhDebugLines;
     printf("BVH debug lines: %s\n", ux->bvhDebugLines ? "on" : "off");
@@ -541,6 +623,9 @@ void ux_update(CircuitUX *ux) {
   }
 
   ux_handle_mouse(ux);
+
+  // send all the changes made this frame before drawing
+  circuit_flush_dirty(&ux->view.circuit);
 }
 
 void ux_start_adding_component(CircuitUX *ux, ComponentDescID descID) {
@@ -15,78 +15,291 @@
 */
 
 #include "handmade_math.h"
+#include "stb_ds.h"
 #include "ux.h"
 
+#include <float.h>
+#include <stdlib.h>
+
 #define SNAP_DISTANCE_THRESHOLD 500
 #define SNAP_DISTANCE 8
 
-HMM_Vec2 ux_calc_snap(CircuitUX *ux, HMM_Vec2 newCenter) {
-  ID selected = ux->view.selected[0];
-  HMM_Vec2 oldCenter;
-  HMM_Vec2 halfSize;
-
-  float snapDistance = SNAP_DISTANCE / draw_get_zoom(ux->view.drawCtx);
-
-  if (id_type(selected) == ID_COMPONENT) {
-    Component *component = circuit_component_ptr(&ux->view.circuit, selected);
-    oldCenter = component->box.center;
-    halfSize = component->box.halfSize;
-
-  } else if (id_type(selected) == ID_WAYPOINT) {
-    Waypoint *waypoint = circuit_waypoint_ptr(&ux->view.circuit, selected);
-    oldCenter = waypoint->position;
-    halfSize = HMM_V2(0, 0);
-  } else {
-    return newCenter;
+static int ux_compare_snap_edges(const void *a, const void *b) {
+  float valueA = ((const SnapEdge *)a)->value;
+  float valueB = ((const SnapEdge *)b)->value;
+  return valueA < valueB ? -1 : valueA > valueB;
+}
+
+// first edge with a value of at least value
+static int ux_snap_lower_bound(arr(SnapEdge) edges, float value) {
+  int lo = 0;
+  int hi = arrlen(edges);
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (edges[mid].value < value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static SnapEdge ux_snap_edge(Box box, ComponentID id, int axis, int kind) {
+  float value = box.center.Elements[axis];
+  if (kind == SNAP_MIN) {
+    value -= box.halfSize.Elements[axis];
+  } else if (kind == SNAP_MAX) {
+    value += box.halfSize.Elements[axis];
   }
+  return (SnapEdge){.value = value, .center = box.center, .id = id};
+}
 
-  HMM_Vec2 movedCenter = newCenter;
+// what's in SnapIndex.stale for components that were never in the edges
+static const Box ux_snap_unindexed = {.halfSize = {.X = -1, .Y = -1}};
 
-  float top = movedCenter.Y - halfSize.Y;
-  float left = movedCenter.X - halfSize.X;
-  float bottom = movedCenter.Y + halfSize.Y;
-  float right = movedCenter.X + halfSize.X;
+static bool ux_snap_indexed(Box box) { return box.halfSize.X >= 0; }
 
-  float snapDistanceThreshold =
-    SNAP_DISTANCE_THRESHOLD / draw_get_zoom(ux->view.drawCtx);
-  for (size_t i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
-    Component *component = &ux->view.circuit.components[i];
-    if (circuit_component_id(&ux->view.circuit, i) == selected) {
-      continue;
+static void ux_snap_component_created(void *user, ComponentID id, void *ptr) {
+  CircuitUX *ux = user;
+  if (ux->snapIndex.valid) {
+    hmput(ux->snapIndex.stale, id, ux_snap_unindexed);
+  }
+}
+
+// Notes that a component's edges are out of date, keeping the box they went in
+// with so they can be found again.
+static void ux_snap_component_changed(void *user, ComponentID id, void *ptr) {
+  CircuitUX *ux = user;
+  SnapIndex *index = &ux->snapIndex;
+  if (index->valid && hmgeti(index->stale, id) < 0) {
+    int i = circuit_index(&ux->view.circuit, id);
+    hmput(index->stale, id, index->boxes[i]);
+  }
+}
+
+void ux_snap_init(CircuitUX *ux) {
+  Circuit *circuit = &ux->view.circuit;
+  smap_add_synced_array(
+    &circuit->sm.components, (void **)&ux->snapIndex.boxes,
+    sizeof(*ux->snapIndex.boxes));
+  circuit_on_component_create(circuit, ux, ux_snap_component_created);
+  circuit_on_component_update(circuit, ux, ux_snap_component_changed);
+  circuit_on_component_delete(circuit, ux, ux_snap_component_changed);
+}
+
+static void ux_build_snap_index(CircuitUX *ux) {
+  SnapIndex *index = &ux->snapIndex;
+  Circuit *circuit = &ux->view.circuit;
+  int count = circuit_component_len(circuit);
+
+  for (int i = 0; i < count; i++) {
+    index->boxes[i] = circuit->components[i].box;
+  }
+
+  for (int axis = 0; axis < 2; axis++) {
+    for (int kind = 0; kind < SNAP_EDGE_KIND_COUNT; kind++) {
+      arr(SnapEdge) *edges = &index->edges[axis][kind];
+      arrsetlen(*edges, count);
+      for (int i = 0; i < count; i++) {
+        (*edges)[i] = ux_snap_edge(
+          index->boxes[i], circuit_component_id(circuit, i), axis, kind);
+      }
+      if (count > 1) {
+        qsort(*edges, count, sizeof(SnapEdge), ux_compare_snap_edges);
+      }
     }
+  }
 
-    if (
-      HMM_LenV2(HMM_SubV2(oldCenter, component->box.center)) >
-      snapDistanceThreshold) {
-      continue;
+  hmfree(index->stale);
+  index->valid = true;
+}
+
+// Takes the edges of the removed components out of edges and merges in the
+// ones of the added components, in one pass each.
+static void ux_update_snap_edges(
+  CircuitUX *ux, arr(SnapEdge) * edges, int axis, int kind,
+  arr(ComponentID) removed, arr(ComponentID) added) {
+  SnapIndex *index = &ux->snapIndex;
+  Circuit *circuit = &ux->view.circuit;
+
+  // the old edges are found by the box they went in with
+  for (int i = 0; i < arrlen(removed); i++) {
+    Box box = hmget(index->stale, removed[i]);
+    SnapEdge old = ux_snap_edge(box, removed[i], axis, kind);
+    for (int j = ux_snap_lower_bound(*edges, old.value);
+         j < arrlen(*edges) && (*edges)[j].value == old.value; j++) {
+      if ((*edges)[j].id == old.id) {
+        (*edges)[j].id = NO_COMPONENT;
+        break;
+      }
+    }
+  }
+  int kept = 0;
+  for (int i = 0; i < arrlen(*edges); i++) {
+    if ((*edges)[i].id != NO_COMPONENT) {
+      (*edges)[kept++] = (*edges)[i];
     }
+  }
 
-    float componentTop = component->box.center.Y - component->box.halfSize.Y;
-    float componentLeft = component->box.center.X - component->box.halfSize.X;
-    float componentBottom = component->box.center.Y + component->box.halfSize.Y;
-    float componentRight = component->box.center.X + component->box.halfSize.X;
+  arr(SnapEdge) fresh = NULL;
+  for (int i = 0; i < arrlen(added); i++) {
+    Box box = index->boxes[circuit_index(circuit, added[i])];
+    arrput(fresh, ux_snap_edge(box, added[i], axis, kind));
+  }
+  if (arrlen(fresh) > 1) {
+    qsort(fresh, arrlen(fresh), sizeof(SnapEdge), ux_compare_snap_edges);
+  }
 
-    if (HMM_ABS(top - componentTop) < SNAP_DISTANCE) {
-      newCenter.Y = componentTop + halfSize.Y;
+  // merge from the back so nothing is overwritten before it's moved
+  arrsetlen(*edges, kept + arrlen(fresh));
+  int i = kept - 1;
+  int j = (int)arrlen(fresh) - 1;
+  for (int k = (int)arrlen(*edges) - 1; j >= 0; k--) {
+    if (i >= 0 && (*edges)[i].value > fresh[j].value) {
+      (*edges)[k] = (*edges)[i--];
+    } else {
+      (*edges)[k] = fresh[j--];
     }
-    if (HMM_ABS(left - componentLeft) < SNAP_DISTANCE) {
-      newCenter.X = componentLeft + halfSize.X;
+  }
+  arrfree(fresh);
+}
+
+// Brings the snap index up to date with the components that changed since it
+// was last used. The selection is skipped while snapping, so its edges aren't
+// touched until it's let go of, and a drag doesn't have to pay for them.
+static void ux_update_snap_index(CircuitUX *ux) {
+  SnapIndex *index = &ux->snapIndex;
+  Circuit *circuit = &ux->view.circuit;
+  circuit_flush_dirty(circuit);
+  if (
+    !index->valid ||
+    hmlen(index->stale) > circuit_component_len(circuit) / 4 + 64) {
+    ux_build_snap_index(ux);
+    return;
+  }
+
+  arr(ComponentID) removed = NULL;
+  arr(ComponentID) added = NULL;
+  int heldUnindexed = 0;
+  for (ptrdiff_t i = 0; i < hmlen(index->stale); i++) {
+    ComponentID id = index->stale[i].key;
+    bool indexed = ux_snap_indexed(index->stale[i].value);
+    bool exists = circuit_has(circuit, id);
+    if (exists && hmgeti(ux->snapSkip, id) >= 0) {
+      heldUnindexed += !indexed;
+      continue;
     }
-    if (HMM_ABS(bottom - componentBottom) < SNAP_DISTANCE) {
-      newCenter.Y = componentBottom - halfSize.Y;
+    if (indexed) {
+      arrput(removed, id);
     }
-    if (HMM_ABS(right - componentRight) < SNAP_DISTANCE) {
-      newCenter.X = componentRight - halfSize.X;
+    if (exists) {
+      index->boxes[circuit_index(circuit, id)] =
+        circuit_component_ptr(circuit, id)->box;
+      arrput(added, id);
     }
+  }
 
-    if (HMM_ABS(movedCenter.Y - component->box.center.Y) < snapDistance) {
-      newCenter.Y = component->box.center.Y;
+  if (arrlen(removed) > 0 || arrlen(added) > 0) {
+    for (int axis = 0; axis < 2; axis++) {
+      for (int kind = 0; kind < SNAP_EDGE_KIND_COUNT; kind++) {
+        ux_update_snap_edges(
+          ux, &index->edges[axis][kind], axis, kind, removed, added);
+      }
+    }
+    for (int i = 0; i < arrlen(removed); i++) {
+      hmdel(index->stale, removed[i]);
+    }
+    for (int i = 0; i < arrlen(added); i++) {
+      hmdel(index->stale, added[i]);
     }
+  }
+  arrfree(removed);
+  arrfree(added);
+
+  // clearing the circuit drops components without telling anyone
+  int expected = circuit_component_len(circuit) - heldUnindexed;
+  if (arrlen(index->edges[0][0]) != expected) {
+    ux_build_snap_index(ux);
+  }
+}
 
-    if (HMM_ABS(movedCenter.X - component->box.center.X) < snapDistance) {
-      newCenter.X = component->box.center.X;
+// Finds the smallest move along axis that lines up the selection's min edge,
+// center or max edge with the same line of a nearby component that isn't part
+// of the selection. Returns 0 if there's nothing within reach.
+static float ux_snap_axis(
+  CircuitUX *ux, int axis, HMM_Vec2 movedCenter, HMM_Vec2 halfSize,
+  HMM_Vec2 oldCenter) {
+  float zoom = draw_get_zoom(ux->view.drawCtx);
+  float threshold = SNAP_DISTANCE_THRESHOLD / zoom;
+  float thresholdSqr = threshold * threshold;
+
+  float best = 0;
+  float bestDistance = FLT_MAX;
+  for (int kind = 0; kind < SNAP_EDGE_KIND_COUNT; kind++) {
+    float offset = kind == SNAP_MIN   ? -halfSize.Elements[axis]
+                   : kind == SNAP_MAX ? halfSize.Elements[axis]
+                                      : 0;
+    float value = movedCenter.Elements[axis] + offset;
+    // centers snap from further away the further out the view is zoomed
+    float reach = kind == SNAP_CENTER ? SNAP_DISTANCE / zoom : SNAP_DISTANCE;
+
+    arr(SnapEdge) edges = ux->snapIndex.edges[axis][kind];
+    for (int i = ux_snap_lower_bound(edges, value - reach);
+         i < arrlen(edges) && edges[i].value < value + reach; i++) {
+      SnapEdge *edge = &edges[i];
+      float distance = HMM_ABS(edge->value - value);
+      if (
+        distance >= reach || distance >= bestDistance ||
+        HMM_LenSqrV2(HMM_SubV2(oldCenter, edge->center)) > thresholdSqr ||
+        hmgeti(ux->snapSkip, edge->id) >= 0) {
+        continue;
+      }
+      best = edge->value - value;
+      bestDistance = distance;
     }
   }
+  return best;
+}
+
+// Snaps the selection, moved so its center is at newCenter, to line up its
+// bounds or center with the components around it. Returns the snapped center.
+HMM_Vec2 ux_calc_snap(CircuitUX *ux, HMM_Vec2 newCenter) {
+  Circuit *circuit = &ux->view.circuit;
+
+  // snap the bounds of the whole selection, which are offset from the center
+  // the selection is moved by
+  HMM_Vec2 min = HMM_V2(FLT_MAX, FLT_MAX);
+  HMM_Vec2 max = HMM_V2(-FLT_MAX, -FLT_MAX);
+  hmfree(ux->snapSkip);
+  for (size_t i = 0; i < arrlen(ux->view.selected); i++) {
+    ID id = ux->view.selected[i];
+    Box box;
+    if (id_type(id) == ID_COMPONENT) {
+      box = circuit_component_ptr(circuit, id)->box;
+    } else if (id_type(id) == ID_WAYPOINT) {
+      box = (Box){circuit_waypoint_ptr(circuit, id)->position, HMM_V2(0, 0)};
+    } else {
+      continue;
+    }
+    min.X = HMM_MIN(min.X, box.center.X - box.halfSize.X);
+    min.Y = HMM_MIN(min.Y, box.center.Y - box.halfSize.Y);
+    max.X = HMM_MAX(max.X, box.center.X + box.halfSize.X);
+    max.Y = HMM_MAX(max.Y, box.center.Y + box.halfSize.Y);
+    hmput(ux->snapSkip, id, 1);
+  }
+  if (min.X > max.X) {
+    return newCenter;
+  }
+  ux_update_snap_index(ux);
+
+  Box bounds = box_from_tlbr(min, max);
+  HMM_Vec2 offset = HMM_SubV2(bounds.center, ux_calc_selection_center(ux));
+  HMM_Vec2 movedCenter = HMM_AddV2(newCenter, offset);
 
+  newCenter.X +=
+    ux_snap_axis(ux, 0, movedCenter, bounds.halfSize, bounds.center);
+  newCenter.Y +=
+    ux_snap_axis(ux, 1, movedCenter, bounds.halfSize, bounds.center);
   return newCenter;
-}
\ No newline at end of file
+}
@@ -18,14 +18,199 @@
 #include "handmade_math.h"
 #include "stb_ds.h"
 #include "view/view.h"
+#include <stdlib.h>
+#include <string.h>
 
 #include "ux.h"
 
 #define LOG_LEVEL LL_INFO
 #include "log.h"
 
+// waypoints are selected if the area comes within this of them
+#define AREA_WP_FUDGE 5.0f
+
+static bool ux_area_selects(CircuitUX *ux, ID id, Box area) {
+  switch (id_type(id)) {
+  case ID_COMPONENT: {
+    Component *component = circuit_component_ptr(&ux->view.circuit, id);
+    return box_intersect_box(component->box, area);
+  }
+  case ID_WAYPOINT: {
+    Waypoint *waypoint = circuit_waypoint_ptr(&ux->view.circuit, id);
+    Box box = {waypoint->position, HMM_V2(AREA_WP_FUDGE, AREA_WP_FUDGE)};
+    return box_intersect_box(box, area);
+  }
+  default:
+    return false;
+  }
+}
+
+// Splits the part of area that's outside old into up to four strips, returning
+// how many there are.
+static int ux_area_growth(Box area, Box old, Box *strips) {
+  if (!box_intersect_box(area, old)) {
+    strips[0] = area;
+    return 1;
+  }
+  HMM_Vec2 amin = box_top_left(area);
+  HMM_Vec2 amax = box_bottom_right(area);
+  HMM_Vec2 omin = box_top_left(old);
+  HMM_Vec2 omax = box_bottom_right(old);
+  int count = 0;
+  if (amin.X < omin.X) {
+    strips[count++] = box_from_tlbr(amin, HMM_V2(omin.X, amax.Y));
+  }
+  if (amax.X > omax.X) {
+    strips[count++] = box_from_tlbr(HMM_V2(omax.X, amin.Y), amax);
+  }
+  float minX = HMM_MAX(amin.X, omin.X);
+  float maxX = HMM_MIN(amax.X, omax.X);
+  if (amin.Y < omin.Y) {
+    strips[count++] =
+      box_from_tlbr(HMM_V2(minX, amin.Y), HMM_V2(maxX, omin.Y));
+  }
+  if (amax.Y > omax.Y) {
+    strips[count++] =
+      box_from_tlbr(HMM_V2(minX, omax.Y), HMM_V2(maxX, amax.Y));
+  }
+  return count;
+}
+
+static int ux_compare_ids(const void *a, const void *b) {
+  ID idA = *(const ID *)a;
+  ID idB = *(const ID *)b;
+  return idA < idB ? -1 : idA > idB;
+}
+
+static uint32_t *ux_area_slot(CircuitUX *ux, ID id) {
+  arr(uint32_t) *slots = &ux->areaSlots[id_type(id)];
+  size_t index = id_index(id);
+  size_t len = arrlen(*slots);
+  if (index >= len) {
+    arrsetlen(*slots, index + 1);
+    memset(*slots + len, 0, (index + 1 - len) * sizeof(uint32_t));
+  }
+  return &(*slots)[index];
+}
+
+static void ux_area_add(CircuitUX *ux, ID id) {
+  *ux_area_slot(ux, id) = arrlen(ux->view.selected) + 1;
+  arrput(ux->view.selected, id);
+}
+
+// swap removes id from the selection
+static void ux_area_drop(CircuitUX *ux, ID id) {
+  uint32_t *slot = ux_area_slot(ux, id);
+  size_t pos = *slot - 1;
+  *slot = 0;
+  if (pos >= arrlen(ux->view.selected) || ux->view.selected[pos] != id) {
+    // the slot is stale, so look for it the slow way
+    for (pos = 0; pos < arrlen(ux->view.selected); pos++) {
+      if (ux->view.selected[pos] == id) {
+        break;
+      }
+    }
+    if (pos == arrlen(ux->view.selected)) {
+      return;
+    }
+  }
+  ID last = arrpop(ux->view.selected);
+  if (pos < arrlen(ux->view.selected)) {
+    ux->view.selected[pos] = last;
+    *ux_area_slot(ux, last) = pos + 1;
+  }
+}
+
+// Collects what could be selected in strips into areaHits, sorted by ID and
+// without duplicates, since things can straddle strips.
+static void ux_area_query(CircuitUX *ux, Box *strips, int count) {
+  HMM_Vec2 fudge = HMM_V2(AREA_WP_FUDGE, AREA_WP_FUDGE);
+  arrsetlen(ux->areaHits, 0);
+  for (int i = 0; i < count; i++) {
+    Box query = {strips[i].center, HMM_AddV2(strips[i].halfSize, fudge)};
+    ux->areaHits = bvh_query(&ux->bvh, query, ux->areaHits);
+  }
+
+  int unique = 0;
+  for (int i = 0; i < arrlen(ux->areaHits); i++) {
+    IDType type = id_type(ux->areaHits[i]);
+    if (
+      (type == ID_COMPONENT || type == ID_WAYPOINT) &&
+      circuit_has(&ux->view.circuit, ux->areaHits[i])) {
+      ux->areaHits[unique++] = ux->areaHits[i];
+    }
+  }
+  arrsetlen(ux->areaHits, unique);
+  if (unique > 1) {
+    qsort(ux->areaHits, unique, sizeof(ID), ux_compare_ids);
+  }
+
+  unique = 0;
+  for (int i = 0; i < arrlen(ux->areaHits); i++) {
+    if (unique == 0 || ux->areaHits[unique - 1] != ux->areaHits[i]) {
+      ux->areaHits[unique++] = ux->areaHits[i];
+    }
+  }
+  arrsetlen(ux->areaHits, unique);
+}
+
+// Selects everything in area with BVH queries. If the selection is still the
+// one picked for the previous area, only the strips the area grew into or
+// shrank away from are queried, so the cost follows the size of the change
+// rather than the size of the circuit.
+static void ux_select_area(CircuitUX *ux, Box area) {
+  if (ux->bvh.root == BVH_NULL) {
+    ux_build_bvh(ux);
+  }
+  Box old = ux->view.selectionBox;
+  bool incremental =
+    ux->areaSelection && ux->areaVersion == ux->bvh.version;
+  Box strips[4];
+
+  if (!incremental) {
+    arrsetlen(ux->view.selected, 0);
+    ux_area_query(ux, &area, 1);
+    for (int i = 0; i < arrlen(ux->areaHits); i++) {
+      if (ux_area_selects(ux, ux->areaHits[i], area)) {
+        ux_area_add(ux, ux->areaHits[i]);
+      }
+    }
+  } else {
+    // drop what the area shrank away from
+    int stripCount = ux_area_growth(old, area, strips);
+    if (stripCount > 0) {
+      ux_area_query(ux, strips, stripCount);
+      for (int i = 0; i < arrlen(ux->areaHits); i++) {
+        ID id = ux->areaHits[i];
+        if (ux_area_selects(ux, id, old) && !ux_area_selects(ux, id, area)) {
+          ux_area_drop(ux, id);
+        }
+      }
+    }
+
+    // and add what it grew into
+    stripCount = ux_area_growth(area, old, strips);
+    if (stripCount > 0) {
+      ux_area_query(ux, strips, stripCount);
+      for (int i = 0; i < arrlen(ux->areaHits); i++) {
+        ID id = ux->areaHits[i];
+        if (ux_area_selects(ux, id, area) && !ux_area_selects(ux, id, old)) {
+          ux_area_add(ux, id);
+        }
+      }
+    }
+  }
+
+  ux->view.selectionBox = area;
+  ux->areaSelection = true;
+  ux->areaVersion = ux->bvh.version;
+}
+
 static void ux_perform_command(CircuitUX *ux, UndoCommand command) {
   ux->changed = true;
+  if (command.verb != UNDO_SELECT_AREA) {
+    ux->areaSelection = false;
+  }
 
   switch (command.verb) {
   case UNDO_NONE:
@@ -37,7 +222,7 @@ static void ux_perform_command(CircuitUX *ux, UndoCommand command) {
     HMM_Vec2 initialDelta = HMM_SubV2(command.newCenter, command.oldCenter);
     HMM_Vec2 newCenter = command.newCenter;
     HMM_Vec2 delta = initialDelta;
-    if (arrlen(ux->view.selected) == 1 && command.snap) {
+    if (arrlen(ux->view.selected) > 0 && command.snap) {
       newCenter = ux_calc_snap(ux, command.newCenter);
     }
 
@@ -60,31 +245,17 @@ static void ux_perform_command(CircuitUX *ux, UndoCommand command) {
     break;
   }
   case UNDO_SELECT_ITEM:
-    log_debug("Performing select item: %x", command.itemID);
+    log_debug("Performing select item: %" PRIxID "", command.itemID);
     arrput(ux->view.selected, command.itemID);
     break;
   case UNDO_SELECT_AREA:
     log_debug(
       "Performing select area: %f %f %f %f", command.area.center.X,
       command.area.center.Y, command.area.halfSize.X, command.area.halfSize.Y);
-    ux->view.selectionBox = command.area;
-    arrsetlen(ux->view.selected, 0);
-    for (size_t i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
-      Component *component = &ux->view.circuit.components[i];
-      if (box_intersect_box(component->box, command.area)) {
-        arrput(ux->view.selected, circuit_component_id(&ux->view.circuit, i));
-      }
-    }
-    for (size_t i = 0; i < circuit_waypoint_len(&ux->view.circuit); i++) {
-      Waypoint *waypoint = &ux->view.circuit.waypoints[i];
-      Box box = (Box){.center = waypoint->position, .halfSize = HMM_V2(5, 5)};
-      if (box_intersect_box(box, command.area)) {
-        arrput(ux->view.selected, circuit_waypoint_id(&ux->view.circuit, i));
-      }
-    }
+    ux_select_area(ux, command.area);
     break;
   case UNDO_DESELECT_ITEM:
-    log_debug("Performing deselect item: %x", command.itemID);
+    log_debug("Performing deselect item: %" PRIxID "", command.itemID);
     for (size_t i = 0; i < arrlen(ux->view.selected); i++) {
       if (ux->view.selected[i] == command.itemID) {
         arrdel(ux->view.selected, i);
@@ -101,8 +272,8 @@ static void ux_perform_command(CircuitUX *ux, UndoCommand command) {
     break;
   case UNDO_ADD_COMPONENT:
     log_debug(
-      "Performing add component: %x %d %f %f", command.itemID, command.descID,
-      command.newCenter.X, command.newCenter.Y);
+      "Performing add component: %" PRIxID " %d %f %f", command.itemID,
+      command.descID, command.newCenter.X, command.newCenter.Y);
     if (!circuit_has(&ux->view.circuit, command.itemID)) {
       ID id = circuit_add_component(
         &ux->view.circuit, command.descID, command.newCenter);
@@ -120,7 +291,7 @@ static void ux_perform_command(CircuitUX *ux, UndoCommand command) {
     break;
 
   case UNDO_DEL_COMPONENT:
-    log_debug("Performing del component: %x", command.itemID);
+    log_debug("Performing del component: %" PRIxID "", command.itemID);
     if (circuit_has(&ux->view.circuit, command.itemID)) {
       // todo: if adding component, replace it with the component removed
       // and delete the adding component instead
@@ -226,6 +397,7 @@ UndoCommand ux_undo(CircuitUX *ux) {
   arrput(ux->redoStack, redoCmd);
 
   ux_perform_command(ux, redoCmd);
+  ux_update_bvh(ux);
   return cmd;
 }
 
@@ -241,5 +413,6 @@ UndoCommand ux_redo(CircuitUX *ux) {
   arrput(ux->undoStack, undoCmd);
 
   ux_perform_command(ux, undoCmd);
+  ux_update_bvh(ux);
   return cmd;
 }
@@ -17,6 +17,7 @@
 #include "autoroute/autoroute.h"
 #include "core/core.h"
 #include "handmade_math.h"
+#include "sokol_time.h"
 #include "stb_ds.h"
 #include "view/view.h"
 #include <float.h>
@@ -28,6 +29,24 @@
 
 void ux_global_init() { autoroute_global_init(); }
 
+static void ux_bvh_changed(void *user, ID id, void *ptr) {
+  CircuitUX *ux = user;
+  hmput(ux->bvhDirty, id, 1);
+}
+
+static void ux_bvh_component_changed(void *user, ComponentID id, void *ptr) {
+  CircuitUX *ux = user;
+  Component *component = ptr;
+  hmput(ux->bvhDirty, id, 1);
+
+  // the ports move with the component without being updated themselves
+  PortID portID = component->portFirst;
+  while (circuit_has(&ux->view.circuit, portID)) {
+    hmput(ux->bvhDirty, portID, 1);
+    portID = circuit_port_ptr(&ux->view.circuit, portID)->next;
+  }
+}
+
 void ux_init(
   CircuitUX *ux, const ComponentDesc *componentDescs, DrawContext *drawCtx,
   FontHandle font) {
@@ -42,37 +61,87 @@ void ux_init(
 
   view_init(&ux->view, componentDescs, drawCtx, font);
   bvh_init(&ux->bvh);
+  ux->view.bvh = &ux->bvh;
 
   ux->router = autoroute_create(&ux->view.circuit);
+
+  Circuit *circuit = &ux->view.circuit;
+  circuit_on_component_create(circuit, ux, ux_bvh_component_changed);
+  circuit_on_component_update(circuit, ux, ux_bvh_component_changed);
+  circuit_on_component_delete(circuit, ux, ux_bvh_changed);
+  circuit_on_port_create(circuit, ux, ux_bvh_changed);
+  circuit_on_port_update(circuit, ux, ux_bvh_changed);
+  circuit_on_port_delete(circuit, ux, ux_bvh_changed);
+  circuit_on_endpoint_create(circuit, ux, ux_bvh_changed);
+  circuit_on_endpoint_update(circuit, ux, ux_bvh_changed);
+  circuit_on_endpoint_delete(circuit, ux, ux_bvh_changed);
+  circuit_on_waypoint_create(circuit, ux, ux_bvh_changed);
+  circuit_on_waypoint_update(circuit, ux, ux_bvh_changed);
+  circuit_on_waypoint_delete(circuit, ux, ux_bvh_changed);
+  circuit_on_net_delete(circuit, ux, ux_bvh_changed);
+  ux_snap_init(ux);
+
+  // updates are coalesced and flushed once per frame, see ux_update
+  circuit_track_dirty(&ux->view.circuit, true);
 }
 
 void ux_free(CircuitUX *ux) {
   view_free(&ux->view);
+  hmfree(ux->bvhDirty);
   bv_free(ux->input.keysDown);
   bv_free(ux->input.keysPressed);
   arrfree(ux->undoStack);
   arrfree(ux->redoStack);
   autoroute_free(ux->router);
+  bvh_free(&ux->bvh);
+  arrfree(ux->hoverHits);
+  arrfree(ux->areaHits);
+  for (int i = 0; i < ID_TYPE_COUNT; i++) {
+    arrfree(ux->areaSlots[i]);
+  }
+  for (int axis = 0; axis < 2; axis++) {
+    for (int kind = 0; kind < SNAP_EDGE_KIND_COUNT; kind++) {
+      arrfree(ux->snapIndex.edges[axis][kind]);
+    }
+  }
+  hmfree(ux->snapIndex.stale);
+  hmfree(ux->snapSkip);
 }
 
+// The center of the components and waypoints in the selection. Selected nets
+// follow their endpoints and waypoints, so they don't count.
 HMM_Vec2 ux_calc_selection_center(CircuitUX *ux) {
   HMM_Vec2 center = HMM_V2(0, 0);
   assert(arrlen(ux->view.selected) > 0);
+  int count = 0;
   for (size_t i = 0; i < arrlen(ux->view.selected); i++) {
     ID id = ux->view.selected[i];
     if (id_type(id) == ID_COMPONENT) {
       Component *component = circuit_component_ptr(&ux->view.circuit, id);
       center = HMM_AddV2(center, component->box.center);
+      count++;
     } else if (id_type(id) == ID_WAYPOINT) {
       Waypoint *waypoint = circuit_waypoint_ptr(&ux->view.circuit, id);
       center = HMM_AddV2(center, waypoint->position);
+      count++;
     }
   }
-  center = HMM_DivV2F(center, (float)arrlen(ux->view.selected));
+  if (count > 0) {
+    center = HMM_DivV2F(center, (float)count);
+  }
   return center;
 }
 
-void ux_route(CircuitUX *ux) { autoroute_route(ux->router, ux->routingConfig); }
+void ux_route(CircuitUX *ux) {
+  circuit_flush_dirty(&ux->view.circuit);
+  if (ux->asyncRouting) {
+    // the wires change when ux_update picks up the result
+    autoroute_route_async(ux->router, ux->routingConfig);
+    return;
+  }
+  autoroute_route(ux->router, ux->routingConfig);
+  ux->view.wiresUnindexed = true;
+}
 
 void ux_select_none(CircuitUX *ux) {
   if (HMM_LenSqrV2(ux->view.selectionBox.halfSize) > 0.001f) {
@@ -96,9 +165,8 @@ void ux_select_all(CircuitUX *ux) {
   HMM_Vec2 min = HMM_V2(FLT_MAX, FLT_MAX);
   HMM_Vec2 max = HMM_V2(-FLT_MAX, -FLT_MAX);
   for (size_t i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
-    Component *component = &ux->view.circuit.components[i];
-    HMM_Vec2 cmin = box_top_left(component->box);
-    HMM_Vec2 cmax = box_bottom_right(component->box);
+    HMM_Vec2 cmin = box_top_left(ux->view.componentBoxes[i]);
+    HMM_Vec2 cmax = box_bottom_right(ux->view.componentBoxes[i]);
     min.X = HMM_MIN(min.X, cmin.X);
     min.Y = HMM_MIN(min.Y, cmin.Y);
     max.X = HMM_MAX(max.X, cmax.X);
@@ -134,29 +202,106 @@ void ux_draw(CircuitUX *ux) {
   }
 }
 
+// appends the boxes of each wire segment of a net to boxes
+static arr(Box) ux_net_wire_boxes(
+  Circuit *circuit, const Theme *theme, int netIdx, arr(Box) boxes) {
+  Net *net = &circuit->nets[netIdx];
+  if (net->wireCount == 0) {
+    // not routed yet
+    return boxes;
+  }
+
+  VertexIndex vertexOffset = net->vertexOffset;
+  assert(vertexOffset < arrlen(circuit->vertices));
+
+  for (int wireIdx = net->wireOffset;
+       wireIdx < net->wireOffset + net->wireCount; wireIdx++) {
+    assert(wireIdx < arrlen(circuit->wires));
+    Wire *wire = &circuit->wires[wireIdx];
+
+    for (int vertIdx = 1;
+         vertIdx < circuit_wire_vertex_count(wire->vertexCount); vertIdx++) {
+      HMM_Vec2 p1 = circuit->vertices[vertexOffset + vertIdx - 1];
+      HMM_Vec2 p2 = circuit->vertices[vertexOffset + vertIdx];
+      Box box;
+      if (p1.X == p2.X) {
+        box = (Box){
+          HMM_V2(p1.X, (p1.Y + p2.Y) / 2),
+          HMM_V2(theme->wireThickness / 2, HMM_ABS(p1.Y - p2.Y) / 2)};
+      } else {
+        box = (Box){
+          HMM_V2((p1.X + p2.X) / 2, p1.Y),
+          HMM_V2(HMM_ABS(p1.X - p2.X) / 2, theme->wireThickness / 2)};
+      }
+      arrput(boxes, box);
+    }
+
+    vertexOffset += circuit_wire_vertex_count(wire->vertexCount);
+  }
+  return boxes;
+}
+
+// Appends the boxes id has in the BVH to boxes, none for things that aren't
+// in it. These come from the circuit alone, the same as the view's positions,
+// so that they can be had for a copy of it too.
+static arr(Box) ux_bvh_item_boxes(
+  Circuit *circuit, const Theme *theme, ID id, arr(Box) boxes) {
+  HMM_Vec2 portHalfSize = HMM_V2(theme->portWidth / 2, theme->portWidth / 2);
+  int index = circuit_index(circuit, id);
+  switch (id_type(id)) {
+  case ID_COMPONENT:
+    arrput(boxes, circuit->components[index].box);
+    break;
+  case ID_PORT: {
+    Port *port = &circuit->ports[index];
+    Component *component = circuit_component_ptr(circuit, port->component);
+    HMM_Vec2 position = HMM_AddV2(component->box.center, port->position);
+    arrput(boxes, ((Box){position, portHalfSize}));
+    break;
+  }
+  case ID_ENDPOINT:
+    arrput(boxes, ((Box){circuit->endpoints[index].position, portHalfSize}));
+    break;
+  case ID_WAYPOINT:
+    arrput(boxes, ((Box){circuit->waypoints[index].position, portHalfSize}));
+    break;
+  case ID_NET:
+    boxes = ux_net_wire_boxes(circuit, theme, index, boxes);
+    break;
+  default:
+    break;
+  }
+  return boxes;
+}
+
+// Forgets what changed, once the BVH has caught up with it.
+static void ux_bvh_synced(CircuitUX *ux) {
+  hmfree(ux->bvhDirty);
+  arr(NetID) nets = autoroute_changed_nets(ux->router, NULL);
+  arrfree(nets);
+  view_index_synced(&ux->view);
+}
+
 void ux_build_bvh(CircuitUX *ux) {
+  circuit_flush_dirty(&ux->view.circuit);
   bvh_clear(&ux->bvh);
   for (int i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
-    Component *component = &ux->view.circuit.components[i];
     bvh_add(
-      &ux->bvh, circuit_component_id(&ux->view.circuit, i), component->box);
+      &ux->bvh, circuit_component_id(&ux->view.circuit, i),
+      ux->view.componentBoxes[i]);
   }
   HMM_Vec2 portHalfSize =
     HMM_V2(ux->view.theme.portWidth / 2, ux->view.theme.portWidth / 2);
   for (int i = 0; i < circuit_port_len(&ux->view.circuit); i++) {
-    Port *port = &ux->view.circuit.ports[i];
-    Component *component =
-      circuit_component_ptr(&ux->view.circuit, port->component);
     bvh_add(
       &ux->bvh, circuit_port_id(&ux->view.circuit, i),
-      (Box){HMM_AddV2(component->box.center, port->position), portHalfSize});
+      (Box){ux->view.portPositions[i], portHalfSize});
   }
 
   for (int i = 0; i < circuit_endpoint_len(&ux->view.circuit); i++) {
-    Endpoint *endpoint = &ux->view.circuit.endpoints[i];
     bvh_add(
       &ux->bvh, circuit_endpoint_id(&ux->view.circuit, i),
-      (Box){endpoint->position, portHalfSize});
+      (Box){ux->view.endpointPositions[i], portHalfSize});
   }
 
   for (int i = 0; i < circuit_waypoint_len(&ux->view.circuit); i++) {
@@ -166,41 +311,178 @@ void ux_build_bvh(CircuitUX *ux) {
       (Box){waypoint->position, portHalfSize});
   }
 
+  arr(Box) boxes = NULL;
   for (int netIdx = 0; netIdx < circuit_net_len(&ux->view.circuit); netIdx++) {
-    Net *net = &ux->view.circuit.nets[netIdx];
-
-    VertexIndex vertexOffset = net->vertexOffset;
-    assert(vertexOffset < arrlen(ux->view.circuit.vertices));
-
-    for (int wireIdx = net->wireOffset;
-         wireIdx < net->wireOffset + net->wireCount; wireIdx++) {
-      assert(wireIdx < arrlen(ux->view.circuit.wires));
-      Wire *wire = &ux->view.circuit.wires[wireIdx];
-
-      for (int vertIdx = 1;
-           vertIdx < circuit_wire_vertex_count(wire->vertexCount); vertIdx++) {
-        HMM_Vec2 p1 = ux->view.circuit.vertices[vertexOffset + vertIdx - 1];
-        HMM_Vec2 p2 = ux->view.circuit.vertices[vertexOffset + vertIdx];
-        Box box;
-        if (p1.X == p2.X) {
-          box = (Box){
-            HMM_V2(p1.X, (p1.Y + p2.Y) / 2),
-            HMM_V2(ux->view.theme.wireThickness / 2, HMM_ABS(p1.Y - p2.Y) / 2)};
-        } else {
-          box = (Box){
-            HMM_V2((p1.X + p2.X) / 2, p1.Y),
-            HMM_V2(HMM_ABS(p1.X - p2.X) / 2, ux->view.theme.wireThickness / 2)};
-        }
-        bvh_add(&ux->bvh, circuit_net_id(&ux->view.circuit, netIdx), box);
-      }
-
-      vertexOffset += circuit_wire_vertex_count(wire->vertexCount);
+    arrsetlen(boxes, 0);
+    boxes =
+      ux_net_wire_boxes(&ux->view.circuit, &ux->view.theme, netIdx, boxes);
+    for (int i = 0; i < arrlen(boxes); i++) {
+      bvh_add(&ux->bvh, circuit_net_id(&ux->view.circuit, netIdx), boxes[i]);
     }
   }
+  arrfree(boxes);
 
-  log_debug("Added %td items to BVH", arrlen(ux->bvh.leaves));
+  log_debug("Added %u items to BVH", ux->bvh.leafCount);
 
   bvh_rebuild(&ux->bvh);
+  ux_bvh_synced(ux);
+}
+
+// Brings the BVH up to date with the circuit by only touching the leaves of
+// what changed, ie, the ones of a selection that was just moved, rather than
+// rebuilding the whole thing.
+void ux_update_bvh(CircuitUX *ux) {
+  if (ux->bvh.needsRebuild || ux->bvh.root == BVH_NULL) {
+    ux_build_bvh(ux);
+    return;
+  }
+  circuit_flush_dirty(&ux->view.circuit);
+  Circuit *circuit = &ux->view.circuit;
+
+  // routing doesn't go through the callbacks, so it says which wires changed
+  arr(NetID) nets = autoroute_changed_nets(ux->router, NULL);
+  for (int i = 0; i < arrlen(nets); i++) {
+    hmput(ux->bvhDirty, nets[i], 1);
+  }
+  arrfree(nets);
+
+  arr(Box) boxes = NULL;
+  for (ptrdiff_t i = 0; i < hmlen(ux->bvhDirty); i++) {
+    ID id = ux->bvhDirty[i].key;
+    if (!circuit_has(circuit, id)) {
+      bvh_remove_item(&ux->bvh, id);
+      continue;
+    }
+
+    arrsetlen(boxes, 0);
+    boxes = ux_bvh_item_boxes(circuit, &ux->view.theme, id, boxes);
+    bvh_set_boxes(&ux->bvh, id, boxes, arrlen(boxes));
+  }
+  arrfree(boxes);
+  ux_bvh_synced(ux);
+}
+
+static uint64_t ux_hash_bytes(const void *data, size_t size, uint64_t hash) {
+  return size > 0 ? stbds_hash_bytes((void *)data, size, hash) : hash;
+}
+
+// Appends everything in the BVH to ids, in the order circuit_save_file writes
+// it, which is also the order circuit_load_file makes it in. Unlike the IDs,
+// where something is in this order is the same from one session to the next.
+static arr(ID) ux_bvh_save_order(Circuit *circuit, arr(ID) ids) {
+  for (int i = 0; i < circuit_component_len(circuit); i++) {
+    Component *component = &circuit->components[i];
+    arrput(ids, circuit_component_id(circuit, i));
+    PortID portID = component->portFirst;
+    while (circuit_has(circuit, portID)) {
+      arrput(ids, portID);
+      portID = circuit_port_ptr(circuit, portID)->next;
+    }
+  }
+
+  NetIndex *index = circuit_net_index(circuit);
+  for (int i = 0; i < circuit_net_len(circuit); i++) {
+    arrput(ids, circuit_net_id(circuit, i));
+    for (uint32_t j = index->endpointStart[i]; j < index->endpointStart[i + 1];
+         j++) {
+      arrput(ids, circuit_endpoint_id(circuit, index->endpoints[j]));
+    }
+    for (uint32_t j = index->waypointStart[i]; j < index->waypointStart[i + 1];
+         j++) {
+      arrput(ids, circuit_waypoint_id(circuit, index->waypoints[j]));
+    }
+  }
+  return ids;
+}
+
+// Maps the IDs of everything in the BVH to where it is in the save order, as
+// an ID of the same type with that as its index, or back if toSaved is false.
+static BVHIDMap *ux_bvh_saved_ids(Circuit *circuit, bool toSaved) {
+  arr(ID) ids = ux_bvh_save_order(circuit, NULL);
+  uint32_t counts[ID_TYPE_COUNT] = {0};
+  BVHIDMap *map = NULL;
+  for (int i = 0; i < arrlen(ids); i++) {
+    IDType type = id_type(ids[i]);
+    ID saved = id_make(type, 0, counts[type]++);
+    if (toSaved) {
+      hmput(map, ids[i], saved);
+    } else {
+      hmput(map, saved, ids[i]);
+    }
+  }
+  arrfree(ids);
+  return map;
+}
+
+// Hashes everything the BVH is built from: the type and boxes of everything
+// in it, in the save order, so it comes out the same for the circuit loaded
+// again and routed.
+static uint64_t ux_bvh_circuit_hash(Circuit *circuit, const Theme *theme) {
+  arr(ID) ids = ux_bvh_save_order(circuit, NULL);
+  arr(Box) boxes = NULL;
+  uint64_t hash = 0;
+  for (int i = 0; i < arrlen(ids); i++) {
+    arrsetlen(boxes, 0);
+    boxes = ux_bvh_item_boxes(circuit, theme, ids[i], boxes);
+    uint32_t header[2] = {id_type(ids[i]), arrlen(boxes)};
+    hash = ux_hash_bytes(header, sizeof(header), hash);
+    hash = ux_hash_bytes(boxes, arrlen(boxes) * sizeof(Box), hash);
+  }
+  arrfree(boxes);
+  arrfree(ids);
+  return hash;
+}
+
+uint64_t ux_bvh_hash(CircuitUX *ux) {
+  circuit_flush_dirty(&ux->view.circuit);
+  return ux_bvh_circuit_hash(&ux->view.circuit, &ux->view.theme);
+}
+
+// Brings the BVH up to date and appends a copy of it to buffer, to be finished
+// off by ux_stamp_bvh. This is all a save needs from the UI thread.
+arr(uint8_t) ux_snapshot_bvh(CircuitUX *ux, arr(uint8_t) buffer) {
+  ux_update_bvh(ux);
+  return bvh_snapshot(&ux->bvh, buffer);
+}
+
+// Stamps the BVH copy from ux_snapshot_bvh at data with the hash of what it
+// was built from and puts it in save order, for ux_load_bvh to pick up again.
+// circuit is what the copy was taken of, or a snapshot of it, so this can run
+// on the save thread.
+void ux_stamp_bvh(Circuit *circuit, const Theme *theme, uint8_t *data) {
+  BVHIDMap *ids = ux_bvh_saved_ids(circuit, true);
+  bvh_stamp(data, ux_bvh_circuit_hash(circuit, theme), ids);
+  hmfree(ids);
+}
+
+// Brings the BVH up to date and appends it to buffer, ready to be saved.
+arr(uint8_t) ux_save_bvh(CircuitUX *ux, arr(uint8_t) buffer) {
+  size_t start = arrlen(buffer);
+  buffer = ux_snapshot_bvh(ux, buffer);
+  ux_stamp_bvh(&ux->view.circuit, &ux->view.theme, buffer + start);
+  return buffer;
+}
+
+// Loads a BVH saved by ux_save_bvh, if it was built from the circuit as it is
+// now, instead of building it from scratch. Builds it if not, or if data is
+// NULL, and returns whether it was loaded.
+bool ux_load_bvh(CircuitUX *ux, const uint8_t *data, size_t size) {
+  if (data) {
+    uint64_t start = stm_now();
+    circuit_flush_dirty(&ux->view.circuit);
+    BVHIDMap *ids = ux_bvh_saved_ids(&ux->view.circuit, false);
+    bool loaded = bvh_deserialize(&ux->bvh, ux_bvh_hash(ux), ids, data, size);
+    hmfree(ids);
+    if (loaded) {
+      ux_bvh_synced(ux);
+      log_info(
+        "Loaded BVH with %u leaves in %.3fms", ux->bvh.leafCount,
+        stm_ms(stm_since(start)));
+      return true;
+    }
+  }
+  ux_build_bvh(ux);
+  return false;
 }
 
 typedef void *Context;
@@ -222,14 +504,12 @@ static const HMM_Vec4 bvhLevelColors[] = {
 };
 
 static void ux_bvh_draw_node(
-  BVH *bvh, DrawContext *drawCtx, int node, int level, int drawLevel) {
-  int left = 2 * node + 1;
-  int right = 2 * node + 2;
-  if (node >= arrlen(bvh->nodeHeap)) {
+  BVH *bvh, DrawContext *drawCtx, uint32_t node, int level, int drawLevel) {
+  if (node == BVH_NULL) {
     return;
   }
 
-  BVHNode *bvhNode = &bvh->nodeHeap[node];
+  BVHNode *bvhNode = &bvh->nodes[node];
 
   if (level == drawLevel) {
     draw_stroked_rect(
@@ -239,10 +519,10 @@ static void ux_bvh_draw_node(
         [level % (sizeof(bvhLevelColors) / sizeof(bvhLevelColors[0]))]);
   }
 
-  ux_bvh_draw_node(bvh, drawCtx, left, level + 1, drawLevel);
-  ux_bvh_draw_node(bvh, drawCtx, right, level + 1, drawLevel);
+  ux_bvh_draw_node(bvh, drawCtx, bvhNode->left, level + 1, drawLevel);
+  ux_bvh_draw_node(bvh, drawCtx, bvhNode->right, level + 1, drawLevel);
 }
 
 static void ux_bvh_draw(BVH *bvh, DrawContext *drawCtx, int drawLevel) {
-  ux_bvh_draw_node(bvh, drawCtx, 0, 0, drawLevel);
+  ux_bvh_draw_node(bvh, drawCtx, bvh->root, 0, drawLevel);
 }
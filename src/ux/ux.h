@@ -212,6 +212,35 @@ typedef struct UndoCommand {
 
 typedef void AvoidRouter;
 
+typedef enum SnapEdgeKind {
+  SNAP_MIN,
+  SNAP_CENTER,
+  SNAP_MAX,
+  SNAP_EDGE_KIND_COUNT,
+} SnapEdgeKind;
+
+typedef struct SnapEdge {
+  float value;
+  HMM_Vec2 center;
+  ComponentID id;
+} SnapEdge;
+
+// The left/center/right and top/center/bottom coordinates of every component,
+// each sorted so snapping only looks at the lines within reach.
+typedef struct SnapIndex {
+  arr(SnapEdge) edges[2][SNAP_EDGE_KIND_COUNT];
+  // the box each component is in the edges with, synced with the components
+  Box *boxes;
+  // components created, moved or deleted since they went in the edges, with
+  // the box they went in with. the ones being dragged stay here until they're
+  // let go of.
+  struct {
+    ComponentID key;
+    Box value;
+  } *stale;
+  bool valid;
+} SnapIndex;
+
 typedef struct CircuitUX {
   CircuitView view;
   Input input;
@@ -239,11 +268,38 @@ typedef struct CircuitUX {
 
   bool rtDebugLines;
   RoutingConfig routingConfig;
+  // route on a worker thread, drawing the last finished wires meanwhile
+  bool asyncRouting;
   bool showFPS;
 
   BVH bvh;
+  // what was made, moved or deleted since the BVH was last updated, so
+  // ux_update_bvh only touches those leaves
+  struct {
+    ID key;
+    char value;
+  } *bvhDirty;
   bool bvhDebugLines;
   int bvhDebugLevel;
+  arr(BVHHit) hoverHits;
+
+  // set while the selection is exactly what UNDO_SELECT_AREA picked for
+  // view.selectionBox against BVH version areaVersion, so that dragging the
+  // area out only needs to look at what changed
+  bool areaSelection;
+  uint32_t areaVersion;
+  arr(ID) areaHits;
+  // per ID type and indexed by ID index, 1 + where area selection put the
+  // item in view.selected, so it can be dropped again in O(1). may be stale,
+  // so check view.selected before trusting it.
+  arr(uint32_t) areaSlots[ID_TYPE_COUNT];
+
+  SnapIndex snapIndex;
+  // the selection as a set, while snapping
+  struct {
+    ID key;
+    char value;
+  } *snapSkip;
 } CircuitUX;
 
 void ux_global_init();
@@ -254,9 +310,11 @@ void ux_init(
 void ux_free(CircuitUX *ux);
 
 HMM_Vec2 ux_calc_snap(CircuitUX *ux, HMM_Vec2 newCenter);
+void ux_snap_init(CircuitUX *ux);
 HMM_Vec2 ux_calc_selection_center(CircuitUX *ux);
 
 void ux_update(CircuitUX *ux);
+void ux_update_hover(CircuitUX *ux, HMM_Vec2 worldMousePos);
 void ux_draw(CircuitUX *ux);
 void ux_do(CircuitUX *ux, UndoCommand command);
 UndoCommand ux_undo(CircuitUX *ux);
@@ -274,5 +332,11 @@ void ux_connect_wire(CircuitUX *ux, PortID portID);
 
 void ux_route(CircuitUX *ux);
 void ux_build_bvh(CircuitUX *ux);
+void ux_update_bvh(CircuitUX *ux);
+uint64_t ux_bvh_hash(CircuitUX *ux);
+arr(uint8_t) ux_snapshot_bvh(CircuitUX *ux, arr(uint8_t) buffer);
+void ux_stamp_bvh(Circuit *circuit, const Theme *theme, uint8_t *data);
+arr(uint8_t) ux_save_bvh(CircuitUX *ux, arr(uint8_t) buffer);
+bool ux_load_bvh(CircuitUX *ux, const uint8_t *data, size_t size);
 
 #endif // UX_H
\ No newline at end of file
@@ -0,0 +1,344 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core/core.h"
+#include "render/draw_test.h"
+#include "sokol_time.h"
+#include "stb_ds.h"
+#include "utest.h"
+
+#include "ux.h"
+
+#define BENCH_HOVERS 100000
+
+static uint32_t bench_hover_rng = 0x12345678;
+
+static float bench_hover_random(float max) {
+  bench_hover_rng ^= bench_hover_rng << 13;
+  bench_hover_rng ^= bench_hover_rng >> 17;
+  bench_hover_rng ^= bench_hover_rng << 5;
+  return (bench_hover_rng % 10000) * max / 10000.0f;
+}
+
+// hover picking should cost about the same per frame however big the circuit
+// gets, unlike the scans over every component and port it replaced
+UTEST(UXBench, hover) {
+  int sizes[] = {1000, 10000, 100000};
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int count = sizes[s];
+    CircuitUX ux;
+    ux_init(&ux, circuit_component_descs(), NULL, NULL);
+    Circuit *circuit = &ux.view.circuit;
+
+    arr(ComponentDescID) descs = NULL;
+    arr(HMM_Vec2) positions = NULL;
+    for (int i = 0; i < count; i++) {
+      arrput(descs, COMP_AND + (i % (COMP_COUNT - COMP_AND)));
+      arrput(positions, HMM_V2((i % 100) * 100.0f, (i / 100) * 100.0f));
+    }
+    circuit_add_components(circuit, descs, positions, count, NULL);
+    ux_build_bvh(&ux);
+    float width = 100 * 100.0f;
+    float height = (count / 100) * 100.0f;
+
+    // the first two hovers collapse the BVH for queries
+    ux_update_hover(&ux, HMM_V2(0, 0));
+    ux_update_hover(&ux, HMM_V2(0, 0));
+
+    int hits = 0;
+    bench_hover_rng = 0x12345678;
+    uint64_t start = stm_now();
+    for (int i = 0; i < BENCH_HOVERS; i++) {
+      HMM_Vec2 pos =
+        HMM_V2(bench_hover_random(width), bench_hover_random(height));
+      ux_update_hover(&ux, pos);
+      hits += ux.view.hovered != NO_ID || ux.view.hoveredPort != NO_PORT;
+    }
+    double bvhNs = stm_ns(stm_since(start)) / BENCH_HOVERS;
+
+    // the old way: every component box and every port box, every frame
+    int scanHits = 0;
+    int scans = BENCH_HOVERS / 100;
+    HMM_Vec2 portHalfSize =
+      HMM_V2(ux.view.theme.portWidth / 2.0f, ux.view.theme.portWidth / 2.0f);
+    bench_hover_rng = 0x12345678;
+    start = stm_now();
+    for (int i = 0; i < scans; i++) {
+      HMM_Vec2 pos =
+        HMM_V2(bench_hover_random(width), bench_hover_random(height));
+      Box mouseBox = {pos, HMM_V2(3, 3)};
+      bool hit = false;
+      for (int j = 0; j < circuit_component_len(circuit); j++) {
+        hit = hit || box_intersect_box(ux.view.componentBoxes[j], mouseBox);
+      }
+      for (int j = 0; j < circuit_port_len(circuit); j++) {
+        Box portBox = {ux.view.portPositions[j], portHalfSize};
+        hit = hit || box_intersect_box(portBox, mouseBox);
+      }
+      scanHits += hit;
+    }
+    double scanNs = stm_ns(stm_since(start)) / scans;
+
+    printf(
+      "hover over %d components (%u leaves): bvh %.0fns, scan %.0fns, %d%% "
+      "hit\n",
+      count, ux.bvh.leafCount, bvhNs, scanNs, hits * 100 / BENCH_HOVERS);
+
+    ASSERT_GT(hits, 0);
+    ASSERT_GT(scanHits, 0);
+
+    arrfree(descs);
+    arrfree(positions);
+    ux_free(&ux);
+  }
+}
+
+#define BENCH_AREA_COMPONENTS 100000
+#define BENCH_AREA_STEPS 1500
+
+// drags a marquee out from one corner of a big circuit and back, one select
+// area command per mouse move, the way a rubber band selection does
+UTEST(UXBench, select_area) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  arr(ComponentDescID) descs = NULL;
+  arr(HMM_Vec2) positions = NULL;
+  for (int i = 0; i < BENCH_AREA_COMPONENTS; i++) {
+    arrput(descs, COMP_AND + (i % (COMP_COUNT - COMP_AND)));
+    arrput(positions, HMM_V2((i % 300) * 100.0f, (i / 300) * 100.0f));
+  }
+  circuit_add_components(
+    circuit, descs, positions, BENCH_AREA_COMPONENTS, NULL);
+  ux_build_bvh(&ux);
+
+  // hovering before the drag collapses the BVH for queries
+  ux_update_hover(&ux, HMM_V2(0, 0));
+  ux_update_hover(&ux, HMM_V2(0, 0));
+
+  HMM_Vec2 start = HMM_V2(0, 0);
+  HMM_Vec2 end = HMM_V2(300 * 100.0f, (BENCH_AREA_COMPONENTS / 300) * 100.0f);
+  size_t selected = 0;
+  uint64_t now = stm_now();
+  uint64_t growTime = 0;
+  for (int i = 0; i < BENCH_AREA_STEPS; i++) {
+    if (i == BENCH_AREA_STEPS * 2 / 3) {
+      growTime = stm_since(now);
+    }
+    // out to the far corner and halfway back
+    float t = i < BENCH_AREA_STEPS * 2 / 3
+                ? (float)i / (BENCH_AREA_STEPS * 2 / 3)
+                : 1.0f - (float)(i - BENCH_AREA_STEPS * 2 / 3) /
+                           (BENCH_AREA_STEPS * 2 / 3);
+    HMM_Vec2 corner = HMM_LerpV2(start, t, end);
+    ux_do(
+      &ux, (UndoCommand){
+             .verb = UNDO_SELECT_AREA,
+             .area = box_from_tlbr(start, corner),
+           });
+    selected += arrlen(ux.view.selected);
+  }
+  int growSteps = BENCH_AREA_STEPS * 2 / 3;
+  double growUs = stm_us(growTime) / growSteps;
+  double shrinkUs = stm_us(stm_since(now) - growTime) /
+                    (BENCH_AREA_STEPS - growSteps);
+
+  // what every step used to cost
+  size_t scanned = 0;
+  Box area = box_from_tlbr(start, HMM_LerpV2(start, 0.5f, end));
+  now = stm_now();
+  for (int i = 0; i < BENCH_AREA_STEPS / 10; i++) {
+    for (int j = 0; j < circuit_component_len(circuit); j++) {
+      scanned += box_intersect_box(circuit->components[j].box, area);
+    }
+    for (int j = 0; j < circuit_waypoint_len(circuit); j++) {
+      Box box = {circuit->waypoints[j].position, HMM_V2(5, 5)};
+      scanned += box_intersect_box(box, area);
+    }
+  }
+  double scanUs = stm_us(stm_since(now)) / (BENCH_AREA_STEPS / 10);
+
+  printf(
+    "select area over %d components: %.1fus per step growing, %.1fus "
+    "shrinking, %zu selected on average, scan %.1fus\n",
+    BENCH_AREA_COMPONENTS, growUs, shrinkUs, selected / BENCH_AREA_STEPS,
+    scanUs);
+
+  ASSERT_GT(selected, 0);
+  ASSERT_GT(scanned, 0);
+
+  arrfree(descs);
+  arrfree(positions);
+  ux_free(&ux);
+}
+
+#define BENCH_SNAP_COMPONENTS 100000
+#define BENCH_SNAP_MOVES 10000
+
+// one snap per mouse move while dragging a component around a big circuit,
+// against the scan over every component it replaced
+UTEST(UXBench, snap) {
+  DrawContext *draw = draw_create();
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), draw, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  arr(ComponentDescID) descs = NULL;
+  arr(HMM_Vec2) positions = NULL;
+  for (int i = 0; i < BENCH_SNAP_COMPONENTS; i++) {
+    arrput(descs, COMP_AND + (i % (COMP_COUNT - COMP_AND)));
+    arrput(positions, HMM_V2((i % 300) * 100.0f, (i / 300) * 100.0f));
+  }
+  circuit_add_components(
+    circuit, descs, positions, BENCH_SNAP_COMPONENTS, NULL);
+  ux_build_bvh(&ux);
+
+  // drag one from the middle of the circuit around where it started
+  ComponentID selected =
+    circuit_component_id(circuit, BENCH_SNAP_COMPONENTS / 2 + 150);
+  HMM_Vec2 origin = circuit_component_ptr(circuit, selected)->box.center;
+  origin = HMM_SubV2(origin, HMM_V2(400, 400));
+  arrput(ux.view.selected, selected);
+
+  // the first snap builds the index
+  uint64_t start = stm_now();
+  ux_calc_snap(&ux, origin);
+  double buildMs = stm_ms(stm_since(start));
+
+  int snaps = 0;
+  bench_hover_rng = 0x12345678;
+  start = stm_now();
+  for (int i = 0; i < BENCH_SNAP_MOVES; i++) {
+    HMM_Vec2 pos = HMM_AddV2(
+      origin, HMM_V2(bench_hover_random(800), bench_hover_random(800)));
+    HMM_Vec2 snapped = ux_calc_snap(&ux, pos);
+    snaps += snapped.X != pos.X || snapped.Y != pos.Y;
+  }
+  double indexNs = stm_ns(stm_since(start)) / BENCH_SNAP_MOVES;
+
+  // the old way, minus the check against the snap threshold
+  int scanSnaps = 0;
+  int scans = BENCH_SNAP_MOVES / 100;
+  HMM_Vec2 halfSize = circuit_component_ptr(circuit, selected)->box.halfSize;
+  bench_hover_rng = 0x12345678;
+  start = stm_now();
+  for (int i = 0; i < scans; i++) {
+    HMM_Vec2 pos = HMM_AddV2(
+      origin, HMM_V2(bench_hover_random(800), bench_hover_random(800)));
+    HMM_Vec2 snapped = pos;
+    for (int j = 0; j < circuit_component_len(circuit); j++) {
+      Box box = ux.view.componentBoxes[j];
+      if (circuit_component_id(circuit, j) == selected) {
+        continue;
+      }
+      float top = box.center.Y - box.halfSize.Y;
+      float left = box.center.X - box.halfSize.X;
+      if (HMM_ABS(pos.Y - halfSize.Y - top) < 8) {
+        snapped.Y = top + halfSize.Y;
+      }
+      if (HMM_ABS(pos.X - halfSize.X - left) < 8) {
+        snapped.X = left + halfSize.X;
+      }
+      if (HMM_ABS(pos.Y - box.center.Y) < 8) {
+        snapped.Y = box.center.Y;
+      }
+      if (HMM_ABS(pos.X - box.center.X) < 8) {
+        snapped.X = box.center.X;
+      }
+    }
+    scanSnaps += snapped.X != pos.X || snapped.Y != pos.Y;
+  }
+  double scanNs = stm_ns(stm_since(start)) / scans;
+
+  // let go of it somewhere else and start dragging its neighbour, which only
+  // has to put the one that moved back in the index
+  circuit_move_component(circuit, selected, HMM_V2(30, 30));
+  arrsetlen(ux.view.selected, 0);
+  arrput(
+    ux.view.selected,
+    circuit_component_id(circuit, BENCH_SNAP_COMPONENTS / 2 + 151));
+  start = stm_now();
+  ux_calc_snap(&ux, origin);
+  double nextDragUs = stm_us(stm_since(start));
+
+  printf(
+    "snap among %d components: index build %.1fms, next drag %.0fus, %.0fns "
+    "per snap, scan %.0fns, %d%% snapped\n",
+    BENCH_SNAP_COMPONENTS, buildMs, nextDragUs, indexNs, scanNs,
+    snaps * 100 / BENCH_SNAP_MOVES);
+
+  ASSERT_GT(snaps, 0);
+  ASSERT_GT(scanSnaps, 0);
+
+  arrfree(descs);
+  arrfree(positions);
+  ux_free(&ux);
+  draw_free(draw);
+}
+
+#define BENCH_LOAD_COMPONENTS 100000
+
+// reopening a big circuit, with and without the BVH saved next to it
+UTEST(UXBench, load_bvh) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  arr(ComponentDescID) descs = NULL;
+  arr(HMM_Vec2) positions = NULL;
+  for (int i = 0; i < BENCH_LOAD_COMPONENTS; i++) {
+    arrput(descs, COMP_AND + (i % (COMP_COUNT - COMP_AND)));
+    arrput(positions, HMM_V2((i % 300) * 100.0f, (i / 300) * 100.0f));
+  }
+  circuit_add_components(
+    circuit, descs, positions, BENCH_LOAD_COMPONENTS, NULL);
+
+  uint64_t start = stm_now();
+  ux_build_bvh(&ux);
+  double buildMs = stm_ms(stm_since(start));
+
+  // a background save only copies the tree on the UI thread
+  start = stm_now();
+  arr(uint8_t) buffer = ux_snapshot_bvh(&ux, NULL);
+  double copyMs = stm_ms(stm_since(start));
+
+  start = stm_now();
+  ux_stamp_bvh(&ux.view.circuit, &ux.view.theme, buffer);
+  double stampMs = stm_ms(stm_since(start));
+
+  start = stm_now();
+  uint64_t hash = ux_bvh_hash(&ux);
+  double hashMs = stm_ms(stm_since(start));
+
+  start = stm_now();
+  bool loaded = ux_load_bvh(&ux, buffer, arrlen(buffer));
+  double loadMs = stm_ms(stm_since(start));
+
+  printf(
+    "bvh of %d components (%u leaves, %.1fMB): build %.1fms, save %.1fms "
+    "(copy %.1fms, stamp %.1fms), load %.1fms (hash %.1fms)\n",
+    BENCH_LOAD_COMPONENTS, ux.bvh.leafCount, arrlen(buffer) / 1e6, buildMs,
+    copyMs + stampMs, copyMs, stampMs, loadMs, hashMs);
+
+  ASSERT_TRUE(loaded);
+  ASSERT_NE(hash, 0);
+
+  arrfree(buffer);
+  arrfree(descs);
+  arrfree(positions);
+  ux_free(&ux);
+}
@@ -15,6 +15,7 @@
 */
 
 #include "core/core.h"
+#include "render/draw_test.h"
 #include "utest.h"
 
 #include "ux.h"
@@ -54,3 +55,658 @@ UTEST(CircuitUX, adding_components) {
 
   ux_free(&ux);
 }
+
+UTEST(CircuitUX, update_bvh) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+
+  ComponentID a =
+    circuit_add_component(&ux.view.circuit, COMP_AND, HMM_V2(100, 100));
+  circuit_add_component(&ux.view.circuit, COMP_OR, HMM_V2(400, 100));
+  ux_build_bvh(&ux);
+  uint32_t leafCount = ux.bvh.leafCount;
+
+  circuit_move_component_to(&ux.view.circuit, a, HMM_V2(100, 300));
+
+  // only the moved component and its ports need their leaves updated
+  circuit_flush_dirty(&ux.view.circuit);
+  Component *component = circuit_component_ptr(&ux.view.circuit, a);
+  ASSERT_EQ(
+    hmlen(ux.bvhDirty),
+    1 + circuit_component_port_count(&ux.view.circuit, component));
+
+  ux_update_bvh(&ux);
+  ASSERT_EQ(ux.bvh.leafCount, leafCount);
+  ASSERT_EQ(hmlen(ux.bvhDirty), 0);
+
+  Box probe = {HMM_V2(100, 300), HMM_V2(1, 1)};
+  arr(ID) hits = bvh_query(&ux.bvh, probe, NULL);
+  ASSERT_EQ(arrlen(hits), 1);
+  ASSERT_EQ(hits[0], a);
+  arrsetlen(hits, 0);
+  hits = bvh_query(&ux.bvh, (Box){HMM_V2(100, 100), HMM_V2(1, 1)}, hits);
+  ASSERT_EQ(arrlen(hits), 0);
+
+  // deleted things are dropped from the BVH
+  circuit_del(&ux.view.circuit, a);
+  ux_update_bvh(&ux);
+  arrsetlen(hits, 0);
+  hits = bvh_query(&ux.bvh, probe, hits);
+  ASSERT_EQ(arrlen(hits), 0);
+  ASSERT_LT(ux.bvh.leafCount, leafCount);
+
+  arrfree(hits);
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, hover_priority) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  ComponentID a = circuit_add_component(circuit, COMP_AND, HMM_V2(100, 100));
+  circuit_add_component(circuit, COMP_OR, HMM_V2(400, 100));
+  ux_build_bvh(&ux);
+
+  ux_update_hover(&ux, HMM_V2(100, 100));
+  ASSERT_EQ(ux.view.hovered, a);
+  ASSERT_EQ(ux.view.hoveredPort, NO_PORT);
+
+  ux_update_hover(&ux, HMM_V2(250, 100));
+  ASSERT_EQ(ux.view.hovered, NO_ID);
+  ASSERT_EQ(arrlen(ux.view.hovered2), 0);
+
+  // a port wins over its component
+  Component *component = circuit_component_ptr(circuit, a);
+  PortID port = component->portFirst;
+  HMM_Vec2 portPos =
+    ux.view.portPositions[circuit_index(circuit, port)];
+  ux_update_hover(&ux, portPos);
+  ASSERT_EQ(ux.view.hoveredPort, port);
+
+  // a waypoint over the component wins, and the nearest of two waypoints
+  NetID net = circuit_add_net(circuit);
+  circuit_add_waypoint(circuit, net, HMM_V2(100, 100));
+  WaypointID near = circuit_add_waypoint(circuit, net, HMM_V2(104, 100));
+  ux_update_bvh(&ux);
+  ux_update_hover(&ux, HMM_V2(103, 100));
+  ASSERT_EQ(ux.view.hovered, near);
+
+  ux_free(&ux);
+}
+
+static bool ux_test_area_matches(CircuitUX *ux, Box area) {
+  int expected = 0;
+  for (int i = 0; i < circuit_component_len(&ux->view.circuit); i++) {
+    if (box_intersect_box(ux->view.circuit.components[i].box, area)) {
+      expected++;
+    }
+  }
+  bool ok = arrlen(ux->view.selected) == expected;
+  for (int i = 0; i < arrlen(ux->view.selected); i++) {
+    Component *component =
+      circuit_component_ptr(&ux->view.circuit, ux->view.selected[i]);
+    ok = ok && box_intersect_box(component->box, area);
+    for (int j = 0; j < i; j++) {
+      ok = ok && ux->view.selected[i] != ux->view.selected[j];
+    }
+  }
+  return ok;
+}
+
+UTEST(CircuitUX, select_area) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  for (int i = 0; i < 400; i++) {
+    circuit_add_component(
+      &ux.view.circuit, COMP_AND,
+      HMM_V2((i % 20) * 100.0f, (i / 20) * 100.0f));
+  }
+  ux_build_bvh(&ux);
+
+  // drag out a marquee that grows, shrinks and crosses back over its start
+  Box areas[] = {
+    {HMM_V2(500, 500), HMM_V2(10, 10)},   {HMM_V2(550, 520), HMM_V2(60, 30)},
+    {HMM_V2(700, 650), HMM_V2(210, 160)}, {HMM_V2(600, 600), HMM_V2(110, 110)},
+    {HMM_V2(450, 600), HMM_V2(40, 110)},  {HMM_V2(300, 400), HMM_V2(200, 90)},
+  };
+  for (int i = 0; i < sizeof(areas) / sizeof(areas[0]); i++) {
+    ux_do(&ux, (UndoCommand){.verb = UNDO_SELECT_AREA, .area = areas[i]});
+    ASSERT_TRUE(ux.areaSelection);
+    ASSERT_TRUE(ux_test_area_matches(&ux, areas[i]));
+  }
+
+  // the drag merged into one command, which undoes and redoes as a whole
+  ASSERT_EQ(arrlen(ux.undoStack), 1);
+  ux_undo(&ux);
+  ASSERT_EQ(arrlen(ux.view.selected), 0);
+  ux_redo(&ux);
+  ASSERT_TRUE(ux_test_area_matches(&ux, areas[5]));
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, snap) {
+  DrawContext *draw = draw_create();
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), draw, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  ComponentID a = circuit_add_component(circuit, COMP_AND, HMM_V2(100, 100));
+  ComponentID b = circuit_add_component(circuit, COMP_AND, HMM_V2(300, 103));
+  ComponentID c = circuit_add_component(circuit, COMP_AND, HMM_V2(300, 300));
+  ux_build_bvh(&ux);
+
+  // a single component lines up with its neighbour, but not with itself
+  arrput(ux.view.selected, b);
+  HMM_Vec2 snapped = ux_calc_snap(&ux, HMM_V2(300, 104));
+  ASSERT_EQ(snapped.X, 300);
+  ASSERT_EQ(snapped.Y, 100);
+  snapped = ux_calc_snap(&ux, HMM_V2(300, 130));
+  ASSERT_EQ(snapped.Y, 130);
+
+  // a multi-selection snaps its outer bounds, offset from its center
+  arrput(ux.view.selected, c);
+  HMM_Vec2 center = ux_calc_selection_center(&ux);
+  snapped = ux_calc_snap(&ux, HMM_AddV2(center, HMM_V2(0, 2)));
+  ASSERT_EQ(snapped.X, center.X);
+  ASSERT_EQ(snapped.Y, center.Y - 3);
+
+  // the index follows components that moved
+  circuit_move_component(circuit, a, HMM_V2(0, 50));
+  ux_update_bvh(&ux);
+  snapped = ux_calc_snap(&ux, HMM_AddV2(center, HMM_V2(0, 2)));
+  ASSERT_EQ(snapped.Y, center.Y + 2);
+
+  ux_free(&ux);
+  draw_free(draw);
+}
+
+UTEST(CircuitUX, snap_index_follows_edits) {
+  DrawContext *draw = draw_create();
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), draw, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  ComponentID a = circuit_add_component(circuit, COMP_AND, HMM_V2(100, 100));
+  ComponentID b = circuit_add_component(circuit, COMP_AND, HMM_V2(300, 300));
+  ComponentID c = circuit_add_component(circuit, COMP_AND, HMM_V2(250, 380));
+
+  // dragging b only puts it back in the index once it's let go of
+  arrput(ux.view.selected, b);
+  ux_calc_snap(&ux, HMM_V2(300, 300));
+  circuit_move_component_to(circuit, b, HMM_V2(300, 250));
+  ux_calc_snap(&ux, HMM_V2(300, 250));
+  ASSERT_EQ(hmlen(ux.snapIndex.stale), 1);
+  arrsetlen(ux.view.selected, 0);
+
+  arrput(ux.view.selected, a);
+  HMM_Vec2 snapped = ux_calc_snap(&ux, HMM_V2(100, 253));
+  ASSERT_EQ(snapped.Y, 250);
+  ASSERT_EQ(hmlen(ux.snapIndex.stale), 0);
+  snapped = ux_calc_snap(&ux, HMM_V2(100, 303));
+  ASSERT_EQ(snapped.Y, 303);
+
+  // added and deleted components come and go
+  ComponentID d = circuit_add_component(circuit, COMP_AND, HMM_V2(350, 180));
+  snapped = ux_calc_snap(&ux, HMM_V2(100, 183));
+  ASSERT_EQ(snapped.Y, 180);
+  snapped = ux_calc_snap(&ux, HMM_V2(100, 383));
+  ASSERT_EQ(snapped.Y, 380);
+  circuit_del(circuit, c);
+  circuit_del(circuit, d);
+  snapped = ux_calc_snap(&ux, HMM_V2(100, 183));
+  ASSERT_EQ(snapped.Y, 183);
+  snapped = ux_calc_snap(&ux, HMM_V2(100, 383));
+  ASSERT_EQ(snapped.Y, 383);
+  for (int axis = 0; axis < 2; axis++) {
+    ASSERT_EQ(arrlen(ux.snapIndex.edges[axis][SNAP_CENTER]), 2);
+  }
+
+  ux_free(&ux);
+  draw_free(draw);
+}
+
+UTEST(CircuitUX, cull_draw) {
+  DrawContext *draw = draw_create();
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), draw, NULL);
+  Circuit *circuit = &ux.view.circuit;
+
+  circuit_add_component(circuit, COMP_AND, HMM_V2(100, 100));
+  ComponentID far =
+    circuit_add_component(circuit, COMP_OR, HMM_V2(1000, 1000));
+  circuit_add_component(circuit, COMP_XOR, HMM_V2(5000, 5000));
+  ux_build_bvh(&ux);
+
+  // nothing is culled until the window size is known
+  view_draw(&ux.view);
+  ASSERT_EQ(ux.view.drawStats.drawn, 3);
+  ASSERT_EQ(ux.view.drawStats.culled, 0);
+
+  ux.view.screenSize = HMM_V2(600, 600);
+  view_draw(&ux.view);
+  ASSERT_EQ(ux.view.drawStats.drawn, 1);
+  ASSERT_EQ(ux.view.drawStats.culled, 2);
+
+  // something dragged into the window shows up before the index catches up
+  circuit_move_component(circuit, far, HMM_V2(-700, -700));
+  circuit_flush_dirty(circuit);
+  view_draw(&ux.view);
+  ASSERT_EQ(ux.view.drawStats.drawn, 2);
+  ASSERT_EQ(hmlen(ux.view.unindexed), 1);
+
+  ux_update_bvh(&ux);
+  ASSERT_EQ(hmlen(ux.view.unindexed), 0);
+  view_draw(&ux.view);
+  ASSERT_EQ(ux.view.drawStats.drawn, 2);
+  ASSERT_EQ(ux.view.drawStats.culled, 1);
+
+  ux_free(&ux);
+  draw_free(draw);
+}
+
+static void ux_test_bvh_circuit(CircuitUX *ux, float offset) {
+  ux_init(ux, circuit_component_descs(), NULL, NULL);
+  for (int i = 0; i < 100; i++) {
+    circuit_add_component(
+      &ux->view.circuit, COMP_AND,
+      HMM_V2((i % 10) * 100.0f + offset, (i / 10) * 100.0f));
+  }
+}
+
+UTEST(CircuitUX, save_bvh) {
+  CircuitUX ux;
+  ux_test_bvh_circuit(&ux, 0);
+  ux_build_bvh(&ux);
+  arr(uint8_t) buffer = ux_save_bvh(&ux, NULL);
+
+  // the same circuit loaded again picks up the saved BVH
+  CircuitUX loaded;
+  ux_test_bvh_circuit(&loaded, 0);
+  ASSERT_EQ(ux_bvh_hash(&loaded), ux_bvh_hash(&ux));
+  ASSERT_TRUE(ux_load_bvh(&loaded, buffer, arrlen(buffer)));
+  ASSERT_EQ(loaded.bvh.leafCount, ux.bvh.leafCount);
+  ux_update_hover(&loaded, HMM_V2(100, 100));
+  ASSERT_NE(loaded.view.hovered, NO_ID);
+  ux_free(&loaded);
+
+  // but one that changed builds a new one
+  ux_test_bvh_circuit(&loaded, 1);
+  ASSERT_FALSE(ux_load_bvh(&loaded, buffer, arrlen(buffer)));
+  ASSERT_EQ(loaded.bvh.leafCount, ux.bvh.leafCount);
+  ASSERT_FALSE(loaded.bvh.needsRebuild);
+  ux_free(&loaded);
+
+  arrfree(buffer);
+  ux_free(&ux);
+}
+
+static NetID ux_test_connect(Circuit *circuit, ComponentID a, ComponentID b) {
+  NetID net = circuit_add_net(circuit);
+  circuit_add_endpoint(
+    circuit, net, circuit_component_ptr(circuit, a)->portFirst, HMM_V2(0, 0));
+  circuit_add_endpoint(
+    circuit, net, circuit_component_ptr(circuit, b)->portFirst, HMM_V2(0, 0));
+  return net;
+}
+
+static void ux_test_route_circuit(CircuitUX *ux, HMM_Vec2 moved) {
+  ux_init(ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux->view.circuit;
+  ComponentID a = circuit_add_component(circuit, COMP_AND, moved);
+  ComponentID b = circuit_add_component(circuit, COMP_OR, HMM_V2(300, 100));
+  ComponentID c = circuit_add_component(circuit, COMP_AND, HMM_V2(2000, 2000));
+  ComponentID d = circuit_add_component(circuit, COMP_OR, HMM_V2(2200, 2000));
+  ux_test_connect(circuit, a, b);
+  ux_test_connect(circuit, c, d);
+}
+
+static bool
+ux_test_same_wires(Circuit *circuit, Net *net, Circuit *other, Net *otherNet) {
+  if (net->wireCount != otherNet->wireCount) {
+    return false;
+  }
+  size_t vertexCount = 0;
+  for (size_t i = 0; i < net->wireCount; i++) {
+    Wire wire = circuit->wires[net->wireOffset + i];
+    Wire otherWire = other->wires[otherNet->wireOffset + i];
+    if (wire.vertexCount != otherWire.vertexCount) {
+      return false;
+    }
+    vertexCount += circuit_wire_vertex_count(wire.vertexCount);
+  }
+  return memcmp(
+           &circuit->vertices[net->vertexOffset],
+           &other->vertices[otherNet->vertexOffset],
+           vertexCount * sizeof(HMM_Vec2)) == 0;
+}
+
+UTEST(CircuitUX, incremental_route) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ux_route(&ux);
+  ASSERT_EQ(autoroute_stats(ux.router).routedNets, 2);
+
+  // keep a copy of the far net's wires from before the move
+  Circuit before = {0};
+  circuit_init(&before, circuit_component_descs());
+  circuit_clone_from(&before, circuit);
+
+  ComponentID a = circuit_component_id(circuit, 0);
+  circuit_move_component_to(circuit, a, HMM_V2(100, 140));
+  ux_route(&ux);
+
+  // only the net of the moved component was routed again
+  RouteTimeStats stats = autoroute_stats(ux.router);
+  ASSERT_EQ(stats.routedNets, 1);
+  ASSERT_EQ(stats.totalNets, 2);
+  ASSERT_TRUE(
+    ux_test_same_wires(circuit, &circuit->nets[1], &before, &before.nets[1]));
+
+  // and the wires are the same as routing everything from scratch
+  CircuitUX full;
+  ux_test_route_circuit(&full, HMM_V2(100, 140));
+  ux_route(&full);
+  for (int i = 0; i < circuit_net_len(circuit); i++) {
+    ASSERT_TRUE(ux_test_same_wires(
+      circuit, &circuit->nets[i], &full.view.circuit,
+      &full.view.circuit.nets[i]));
+  }
+
+  ux_free(&full);
+  circuit_free(&before);
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, async_route) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ux.asyncRouting = true;
+  ux_route(&ux);
+  ASSERT_TRUE(autoroute_wait(ux.router));
+  ASSERT_FALSE(autoroute_poll(ux.router));
+
+  // requests pile up faster than the worker finishes them, only the newest
+  // one has to make it
+  ComponentID a = circuit_component_id(circuit, 0);
+  for (int i = 1; i <= 20; i++) {
+    circuit_move_component_to(circuit, a, HMM_V2(100, 100 + i * 2));
+    ux_route(&ux);
+  }
+  autoroute_wait(ux.router);
+
+  CircuitUX full;
+  ux_test_route_circuit(&full, HMM_V2(100, 140));
+  ux_route(&full);
+  ASSERT_EQ(circuit_net_len(circuit), circuit_net_len(&full.view.circuit));
+  for (int i = 0; i < circuit_net_len(circuit); i++) {
+    ASSERT_TRUE(ux_test_same_wires(
+      circuit, &circuit->nets[i], &full.view.circuit,
+      &full.view.circuit.nets[i]));
+  }
+
+  // a net made while a route is in flight waits for the next one
+  Component *b = &circuit->components[1];
+  Component *c = &circuit->components[2];
+  PortID from = circuit_port_ptr(circuit, b->portFirst)->next;
+  PortID to = circuit_port_ptr(circuit, c->portFirst)->next;
+  ux_route(&ux);
+  NetID net = circuit_add_net(circuit);
+  circuit_add_endpoint(circuit, net, from, HMM_V2(0, 0));
+  circuit_add_endpoint(circuit, net, to, HMM_V2(0, 0));
+  circuit_flush_dirty(circuit);
+  autoroute_wait(ux.router);
+  ASSERT_EQ(circuit_net_ptr(circuit, net)->wireCount, 0);
+  ux_route(&ux);
+  autoroute_wait(ux.router);
+  ASSERT_GT(circuit_net_ptr(circuit, net)->wireCount, 0);
+
+  ux_free(&full);
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, route_anchors) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ASSERT_TRUE(autoroute_check_anchors(ux.router));
+
+  circuit_move_component_to(
+    circuit, circuit_component_id(circuit, 1), HMM_V2(300, 200));
+  circuit_flush_dirty(circuit);
+  ASSERT_TRUE(autoroute_check_anchors(ux.router));
+
+  // a wire being dragged out has a floating end until it's connected
+  PortID from =
+    circuit_port_ptr(circuit, circuit->components[2].portFirst)->next;
+  PortID to = circuit_port_ptr(circuit, circuit->components[3].portFirst)->next;
+  NetID net = circuit_add_net(circuit);
+  circuit_add_endpoint(circuit, net, from, HMM_V2(0, 0));
+  EndpointID end = circuit_add_endpoint(circuit, net, NO_PORT, HMM_V2(0, 0));
+  circuit_move_endpoint_to(circuit, end, HMM_V2(2100, 2100));
+  WaypointID waypoint = circuit_add_waypoint(circuit, net, HMM_V2(2100, 1900));
+  circuit_flush_dirty(circuit);
+  ASSERT_TRUE(autoroute_check_anchors(ux.router));
+
+  circuit_endpoint_connect(circuit, end, to);
+  circuit_flush_dirty(circuit);
+  ASSERT_TRUE(autoroute_check_anchors(ux.router));
+
+  // deleting moves the last component and its anchors into the gap
+  circuit_del(circuit, circuit_component_id(circuit, 0));
+  circuit_del(circuit, waypoint);
+  circuit_flush_dirty(circuit);
+  ASSERT_TRUE(autoroute_check_anchors(ux.router));
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, route_first_pass) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+  for (int i = 0; i < 2000; i++) {
+    ComponentID a =
+      circuit_add_component(circuit, COMP_AND, HMM_V2(i * 300, 100));
+    ComponentID b =
+      circuit_add_component(circuit, COMP_OR, HMM_V2(i * 300 + 150, 300));
+    ux_test_connect(circuit, a, b);
+  }
+
+  // the output is sized up front, so even the first route fits in one go
+  ux_route(&ux);
+  ASSERT_EQ(autoroute_stats(ux.router).retries, 0);
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, route_reuses_graph) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ux_route(&ux);
+  ASSERT_EQ(autoroute_stats(ux.router).graphBuilds, 1);
+
+  // a new net between ports that already exist leaves the obstacles alone
+  ComponentID a = circuit_component_id(circuit, 0);
+  ComponentID c = circuit_component_id(circuit, 2);
+  NetID net = circuit_add_net(circuit);
+  circuit_add_endpoint(
+    circuit, net,
+    circuit_port_ptr(circuit, circuit_component_ptr(circuit, a)->portFirst)
+      ->next,
+    HMM_V2(0, 0));
+  circuit_add_endpoint(
+    circuit, net,
+    circuit_port_ptr(circuit, circuit_component_ptr(circuit, c)->portFirst)
+      ->next,
+    HMM_V2(0, 0));
+  ux_route(&ux);
+  RouteTimeStats stats = autoroute_stats(ux.router);
+  ASSERT_EQ(stats.samples, 2);
+  ASSERT_EQ(stats.graphBuilds, 1);
+  ASSERT_GT(circuit_net_ptr(circuit, net)->wireCount, 0);
+
+  // moving a component does
+  circuit_move_component_to(circuit, a, HMM_V2(100, 140));
+  ux_route(&ux);
+  ASSERT_EQ(autoroute_stats(ux.router).graphBuilds, 2);
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, move_selection_with_net) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ux_route(&ux);
+
+  // wires can be hovered and selected along with components
+  ComponentID a = circuit_component_id(circuit, 0);
+  NetID net = circuit_net_id(circuit, 0);
+  ux_do(&ux, (UndoCommand){.verb = UNDO_SELECT_ITEM, .itemID = a});
+  ux_do(&ux, (UndoCommand){.verb = UNDO_SELECT_ITEM, .itemID = net});
+  HMM_Vec2 start = circuit_component_ptr(circuit, a)->box.center;
+  ux.selectionCenter = ux_calc_selection_center(&ux);
+  ASSERT_EQ(ux.selectionCenter.X, start.X);
+  ASSERT_EQ(ux.selectionCenter.Y, start.Y);
+
+  // dragging over several frames keeps the component under the mouse
+  for (int i = 0; i < 4; i++) {
+    HMM_Vec2 oldCenter = ux.selectionCenter;
+    ux_do(
+      &ux, (UndoCommand){
+             .verb = UNDO_MOVE_SELECTION,
+             .oldCenter = oldCenter,
+             .newCenter = HMM_AddV2(oldCenter, HMM_V2(25, 10)),
+           });
+  }
+  HMM_Vec2 end = circuit_component_ptr(circuit, a)->box.center;
+  ASSERT_EQ(end.X, start.X + 100);
+  ASSERT_EQ(end.Y, start.Y + 40);
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, update_bvh_wires) {
+  CircuitUX ux;
+  ux_test_route_circuit(&ux, HMM_V2(100, 100));
+  Circuit *circuit = &ux.view.circuit;
+  ux_route(&ux);
+  ux_build_bvh(&ux);
+
+  // the wires of the rerouted net follow the component
+  ComponentID a = circuit_component_id(circuit, 0);
+  circuit_move_component_to(circuit, a, HMM_V2(100, 140));
+  ux_route(&ux);
+  ux_update_bvh(&ux);
+  for (int i = 0; i < circuit_net_len(circuit); i++) {
+    Net *net = &circuit->nets[i];
+    Box probe = {circuit->vertices[net->vertexOffset], HMM_V2(1, 1)};
+    arr(ID) hits = bvh_query(&ux.bvh, probe, NULL);
+    bool found = false;
+    for (int j = 0; j < arrlen(hits); j++) {
+      found = found || hits[j] == circuit_net_id(circuit, i);
+    }
+    arrfree(hits);
+    ASSERT_TRUE(found);
+  }
+
+  // and it ends up the same as building it from scratch
+  uint32_t leafCount = ux.bvh.leafCount;
+  ux_build_bvh(&ux);
+  ASSERT_EQ(ux.bvh.leafCount, leafCount);
+
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, save_bvh_round_trip) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+  ComponentID ids[6];
+  for (int i = 0; i < 6; i++) {
+    ids[i] = circuit_add_component(
+      circuit, i % 2 ? COMP_OR : COMP_AND, HMM_V2(i * 300, (i % 3) * 200));
+  }
+  ux_test_connect(circuit, ids[0], ids[1]);
+  NetID net = ux_test_connect(circuit, ids[4], ids[5]);
+  circuit_add_waypoint(circuit, net, HMM_V2(1300, 500));
+  ux_route(&ux);
+  ux_build_bvh(&ux);
+
+  // edits reuse indices and reorder things, so the IDs end up different from
+  // the ones loading the file gives out
+  circuit_del(circuit, ids[2]);
+  ComponentID added =
+    circuit_add_component(circuit, COMP_XOR, HMM_V2(900, 700));
+  circuit_move_component_to(circuit, ids[3], HMM_V2(600, 900));
+  ux_route(&ux);
+
+  arr(uint8_t) buffer = ux_save_bvh(&ux, NULL);
+  ASSERT_TRUE(circuit_save_file(circuit, "save_bvh_test.dlc"));
+  circuit_clear(circuit);
+  ASSERT_TRUE(circuit_load_file(circuit, "save_bvh_test.dlc"));
+  remove("save_bvh_test.dlc");
+  ux_route(&ux);
+  ASSERT_FALSE(circuit_has(circuit, added));
+
+  ASSERT_TRUE(ux_load_bvh(&ux, buffer, arrlen(buffer)));
+  uint32_t leafCount = ux.bvh.leafCount;
+  for (int i = 0; i < circuit_component_len(circuit); i++) {
+    Box probe = {circuit->components[i].box.center, HMM_V2(1, 1)};
+    arr(ID) hits = bvh_query(&ux.bvh, probe, NULL);
+    bool found = false;
+    for (int j = 0; j < arrlen(hits); j++) {
+      found = found || hits[j] == circuit_component_id(circuit, i);
+    }
+    arrfree(hits);
+    ASSERT_TRUE(found);
+  }
+  ux_build_bvh(&ux);
+  ASSERT_EQ(ux.bvh.leafCount, leafCount);
+
+  arrfree(buffer);
+  ux_free(&ux);
+}
+
+UTEST(CircuitUX, save_bvh_from_snapshot) {
+  CircuitUX ux;
+  ux_init(&ux, circuit_component_descs(), NULL, NULL);
+  Circuit *circuit = &ux.view.circuit;
+  ComponentID ids[4];
+  for (int i = 0; i < 4; i++) {
+    ids[i] = circuit_add_component(
+      circuit, i % 2 ? COMP_OR : COMP_AND, HMM_V2(i * 300, (i % 2) * 200));
+  }
+  ux_test_connect(circuit, ids[0], ids[1]);
+  ux_test_connect(circuit, ids[2], ids[3]);
+  ux_route(&ux);
+  ux_build_bvh(&ux);
+
+  // what a background save does: copy on this thread, stamp on the other one
+  // while the circuit carries on changing
+  Circuit copy;
+  circuit_init(&copy, circuit_component_descs());
+  arr(uint8_t) buffer = ux_snapshot_bvh(&ux, NULL);
+  circuit_snapshot(&copy, circuit);
+  circuit_move_component_to(circuit, ids[1], HMM_V2(900, 900));
+  circuit_add_component(circuit, COMP_XOR, HMM_V2(100, 800));
+  ux_route(&ux);
+  ux_update_bvh(&ux);
+  ux_stamp_bvh(&copy, &ux.view.theme, buffer);
+
+  ASSERT_TRUE(circuit_save_file(&copy, "save_bvh_snapshot_test.dlc"));
+  circuit_clear(circuit);
+  ASSERT_TRUE(circuit_load_file(circuit, "save_bvh_snapshot_test.dlc"));
+  remove("save_bvh_snapshot_test.dlc");
+  ux_route(&ux);
+  ASSERT_TRUE(ux_load_bvh(&ux, buffer, arrlen(buffer)));
+
+  arrfree(buffer);
+  circuit_free(&copy);
+  ux_free(&ux);
+}
@@ -26,6 +26,9 @@
 #define LOG_LEVEL LL_DEBUG
 #include "log.h"
 
+// how far labels and ports may stick out of the boxes in the spatial index
+#define VIEW_CULL_PADDING 50.0f
+
 void theme_init(Theme *theme, FontHandle font) {
   *theme = (Theme){
     .portSpacing = 20.0f,
@@ -185,6 +188,48 @@ static void view_waypoint_deleted(void *user, WaypointID id, void *ptr) {
   }
 }
 
+static void view_mark_unindexed(CircuitView *view, ID id) {
+  if (view->bvh) {
+    hmput(view->unindexed, id, 1);
+  }
+}
+
+static void view_sync_component(void *user, ComponentID id, void *ptr) {
+  CircuitView *view = user;
+  Component *component = ptr;
+  view->componentBoxes[circuit_index(&view->circuit, id)] = component->box;
+  view_mark_unindexed(view, id);
+
+  // ports are stored in world space, so they move with the component
+  PortID portID = component->portFirst;
+  while (circuit_has(&view->circuit, portID)) {
+    Port *port = circuit_port_ptr(&view->circuit, portID);
+    view->portPositions[circuit_index(&view->circuit, portID)] =
+      HMM_AddV2(component->box.center, port->position);
+    portID = port->next;
+  }
+}
+
+static void view_sync_port(void *user, PortID id, void *ptr) {
+  CircuitView *view = user;
+  Port *port = ptr;
+  Component *component =
+    circuit_component_ptr(&view->circuit, port->component);
+  view->portPositions[circuit_index(&view->circuit, id)] =
+    HMM_AddV2(component->box.center, port->position);
+}
+
+static void view_sync_waypoint(void *user, WaypointID id, void *ptr) {
+  view_mark_unindexed(user, id);
+}
+
+static void view_sync_endpoint(void *user, EndpointID id, void *ptr) {
+  CircuitView *view = user;
+  Endpoint *endpoint = ptr;
+  view->endpointPositions[circuit_index(&view->circuit, id)] =
+    endpoint->position;
+}
+
 void view_init(
   CircuitView *view, const ComponentDesc *componentDescs, DrawContext *drawCtx,
   FontHandle font) {
@@ -199,15 +244,45 @@ void view_init(
   circuit_on_component_delete(&view->circuit, view, view_component_deleted);
   circuit_on_waypoint_delete(&view->circuit, view, view_waypoint_deleted);
 
+  // important: the component sync must come after view_augment_component so
+  // that it sees the final size and port positions
+  smap_add_synced_array(
+    &view->circuit.sm.components, (void **)&view->componentBoxes,
+    sizeof(*view->componentBoxes));
+  circuit_on_component_create(&view->circuit, view, view_sync_component);
+  circuit_on_component_update(&view->circuit, view, view_sync_component);
+
+  smap_add_synced_array(
+    &view->circuit.sm.ports, (void **)&view->portPositions,
+    sizeof(*view->portPositions));
+  circuit_on_port_create(&view->circuit, view, view_sync_port);
+  circuit_on_port_update(&view->circuit, view, view_sync_port);
+
+  smap_add_synced_array(
+    &view->circuit.sm.endpoints, (void **)&view->endpointPositions,
+    sizeof(*view->endpointPositions));
+  circuit_on_endpoint_create(&view->circuit, view, view_sync_endpoint);
+  circuit_on_endpoint_update(&view->circuit, view, view_sync_endpoint);
+
+  circuit_on_waypoint_create(&view->circuit, view, view_sync_waypoint);
+  circuit_on_waypoint_update(&view->circuit, view, view_sync_waypoint);
+
   theme_init(&view->theme, font);
 }
 
 void view_free(CircuitView *view) {
   arrfree(view->selected);
   arrfree(view->hovered2);
+  hmfree(view->unindexed);
+  arrfree(view->drawHits);
   circuit_free(&view->circuit);
 }
 
+void view_index_synced(CircuitView *view) {
+  hmfree(view->unindexed);
+  view->wiresUnindexed = false;
+}
+
 Box view_label_size(
   CircuitView *view, const char *text, HMM_Vec2 pos, HorizAlign horz,
   VertAlign vert, float fontSize) {
@@ -224,28 +299,26 @@ void view_direct_wire_nets(CircuitView *view) {
   int wireOffset = 0;
   int vertexOffset = 0;
   arr(HMM_Vec2) waypoints = NULL;
+  NetIndex *index = circuit_net_index(&view->circuit);
   for (int i = 0; i < circuit_net_len(&view->circuit); i++) {
     Net *net = &view->circuit.nets[i];
     net->wireCount = 0;
     net->wireOffset = wireOffset;
     net->vertexOffset = vertexOffset;
+    circuit_touch_index(&view->circuit, ID_NET, i);
 
     arrsetlen(waypoints, 0);
-    WaypointID waypointID = net->waypointFirst;
-    while (circuit_has(&view->circuit, waypointID)) {
-      Waypoint *waypoint = circuit_waypoint_ptr(&view->circuit, waypointID);
-      arrput(waypoints, waypoint->position);
-      waypointID = waypoint->next;
+    for (uint32_t j = index->waypointStart[i]; j < index->waypointStart[i + 1];
+         j++) {
+      arrput(waypoints, view->circuit.waypoints[index->waypoints[j]].position);
     }
 
     HMM_Vec2 centroid = HMM_V2(0, 0);
-    int endpointCount = 0;
-    EndpointID endpointID = net->endpointFirst;
-    while (circuit_has(&view->circuit, endpointID)) {
-      Endpoint *endpoint = circuit_endpoint_ptr(&view->circuit, endpointID);
-      endpointCount++;
+    int endpointCount = index->endpointStart[i + 1] - index->endpointStart[i];
+    for (uint32_t j = index->endpointStart[i]; j < index->endpointStart[i + 1];
+         j++) {
+      Endpoint *endpoint = &view->circuit.endpoints[index->endpoints[j]];
       centroid = HMM_AddV2(centroid, endpoint->position);
-      endpointID = endpoint->next;
     }
     if (endpointCount > 0) {
       centroid = HMM_DivV2F(centroid, (float)endpointCount);
@@ -280,9 +353,10 @@ void view_direct_wire_nets(CircuitView *view) {
       net->wireCount++;
     }
 
-    endpointID = net->endpointFirst;
-    while (circuit_has(&view->circuit, endpointID)) {
-      Endpoint *endpoint = circuit_endpoint_ptr(&view->circuit, endpointID);
+    for (uint32_t j = index->endpointStart[i]; j < index->endpointStart[i + 1];
+         j++) {
+      uint32_t endpointIndex = index->endpoints[j];
+      Endpoint *endpoint = &view->circuit.endpoints[endpointIndex];
 
       Port *port = circuit_port_ptr(&view->circuit, endpoint->port);
       Component *component =
@@ -290,6 +364,7 @@ void view_direct_wire_nets(CircuitView *view) {
       HMM_Vec2 pos = HMM_AddV2(component->box.center, port->position);
 
       endpoint->position = pos;
+      circuit_touch_index(&view->circuit, ID_ENDPOINT, endpointIndex);
 
       if (endpointCount > 2) {
         // find the closest waypoint
@@ -316,8 +391,6 @@ void view_direct_wire_nets(CircuitView *view) {
 
       arrput(view->circuit.vertices, pos);
       vertexOffset++;
-
-      endpointID = endpoint->next;
     }
   }
 }
@@ -331,135 +404,241 @@ static bool view_is_hovered(CircuitView *view, ID id) {
   return false;
 }
 
-void view_draw(CircuitView *view) {
-  if (
-    view->selectionBox.halfSize.X > 0.001f &&
-    view->selectionBox.halfSize.Y > 0.001f) {
-    draw_selection_box(view->drawCtx, &view->theme, view->selectionBox, 0);
+static void view_draw_component(CircuitView *view, int index) {
+  ComponentID id = circuit_component_id(&view->circuit, index);
+  Component *component = &view->circuit.components[index];
+  const ComponentDesc *desc = &view->circuit.componentDescs[component->desc];
+  HMM_Vec2 center = component->box.center;
+
+  DrawFlags flags = 0;
+
+  for (int j = 0; j < arrlen(view->selected); j++) {
+    if (view->selected[j] == id) {
+      flags |= DRAW_SELECTED;
+      break;
+    }
+  }
+
+  if (view_is_hovered(view, id)) {
+    flags |= DRAW_HOVERED;
   }
 
-  for (int i = 0; i < circuit_component_len(&view->circuit); i++) {
-    ComponentID id = circuit_component_id(&view->circuit, i);
-    Component *component = &view->circuit.components[i];
-    const ComponentDesc *desc = &view->circuit.componentDescs[component->desc];
-    HMM_Vec2 center = component->box.center;
+  draw_component_shape(
+    view->drawCtx, &view->theme, component->box, desc->shape, flags);
 
-    DrawFlags flags = 0;
+  if (desc->shape == SHAPE_DEFAULT) {
+    Label *typeLabel = circuit_label_ptr(&view->circuit, component->typeLabel);
+    const char *typeLabelText =
+      circuit_label_text(&view->circuit, component->typeLabel);
+    draw_label(
+      view->drawCtx, &view->theme, box_translate(typeLabel->box, center),
+      typeLabelText, LABEL_COMPONENT_TYPE, 0);
+  }
 
-    for (int j = 0; j < arrlen(view->selected); j++) {
-      if (view->selected[j] == id) {
-        flags |= DRAW_SELECTED;
-        break;
-      }
-    }
+  Label *nameLabel = circuit_label_ptr(&view->circuit, component->nameLabel);
+  const char *nameLabelText =
+    circuit_label_text(&view->circuit, component->nameLabel);
+  draw_label(
+    view->drawCtx, &view->theme, box_translate(nameLabel->box, center),
+    nameLabelText, LABEL_COMPONENT_NAME, 0);
 
-    if (view_is_hovered(view, id)) {
-      flags |= DRAW_HOVERED;
-    }
+  PortID portID = component->portFirst;
+  while (circuit_has(&view->circuit, portID)) {
+    Port *port = circuit_port_ptr(&view->circuit, portID);
+
+    HMM_Vec2 portPosition = HMM_AddV2(component->box.center, port->position);
+
+    DrawFlags portFlags = 0;
 
-    draw_component_shape(
-      view->drawCtx, &view->theme, component->box, desc->shape, flags);
+    if (view_is_hovered(view, portID)) {
+      portFlags |= DRAW_HOVERED;
+    }
+    draw_port(view->drawCtx, &view->theme, portPosition, portFlags);
 
     if (desc->shape == SHAPE_DEFAULT) {
-      Label *typeLabel =
-        circuit_label_ptr(&view->circuit, component->typeLabel);
-      const char *typeLabelText =
-        circuit_label_text(&view->circuit, component->typeLabel);
+      Label *label = circuit_label_ptr(&view->circuit, port->label);
+      const char *labelText = circuit_label_text(&view->circuit, port->label);
+
+      Box labelBounds =
+        box_translate(label->box, HMM_AddV2(center, port->position));
       draw_label(
-        view->drawCtx, &view->theme, box_translate(typeLabel->box, center),
-        typeLabelText, LABEL_COMPONENT_TYPE, 0);
+        view->drawCtx, &view->theme, labelBounds, labelText, LABEL_PORT,
+        portFlags);
     }
 
-    Label *nameLabel = circuit_label_ptr(&view->circuit, component->nameLabel);
-    const char *nameLabelText =
-      circuit_label_text(&view->circuit, component->nameLabel);
-    draw_label(
-      view->drawCtx, &view->theme, box_translate(nameLabel->box, center),
-      nameLabelText, LABEL_COMPONENT_NAME, 0);
+    portID = port->next;
+  }
+}
 
-    PortID portID = component->portFirst;
-    while (circuit_has(&view->circuit, portID)) {
-      Port *port = circuit_port_ptr(&view->circuit, portID);
+static void view_draw_net(CircuitView *view, int netIdx) {
+  Net *net = &view->circuit.nets[netIdx];
 
-      HMM_Vec2 portPosition = HMM_AddV2(component->box.center, port->position);
+  bool netIsHovered =
+    view_is_hovered(view, circuit_net_id(&view->circuit, netIdx));
 
-      DrawFlags portFlags = 0;
+  VertexIndex vertexOffset = net->vertexOffset;
+  assert(vertexOffset < arrlen(view->circuit.vertices));
 
-      if (view_is_hovered(view, portID)) {
-        portFlags |= DRAW_HOVERED;
-      }
-      draw_port(view->drawCtx, &view->theme, portPosition, portFlags);
+  for (int wireIdx = net->wireOffset;
+       wireIdx < net->wireOffset + net->wireCount; wireIdx++) {
+    assert(wireIdx < arrlen(view->circuit.wires));
+    Wire *wire = &view->circuit.wires[wireIdx];
 
-      if (desc->shape == SHAPE_DEFAULT) {
-        Label *label = circuit_label_ptr(&view->circuit, port->label);
-        const char *labelText = circuit_label_text(&view->circuit, port->label);
+    DrawFlags flags = 0;
+    if (wireIdx == net->wireOffset && view->debugMode) {
+      flags |= DRAW_DEBUG;
+    }
+    if (netIsHovered) {
+      flags |= DRAW_HOVERED;
+    }
 
-        Box labelBounds =
-          box_translate(label->box, HMM_AddV2(center, port->position));
-        draw_label(
-          view->drawCtx, &view->theme, labelBounds, labelText, LABEL_PORT,
-          portFlags);
-      }
+    draw_wire(
+      view->drawCtx, &view->theme, view->circuit.vertices + vertexOffset,
+      circuit_wire_vertex_count(wire->vertexCount), flags);
 
-      portID = port->next;
+    if (circuit_wire_ends_in_junction(wire->vertexCount)) {
+      draw_junction(
+        view->drawCtx, &view->theme,
+        view->circuit.vertices
+          [vertexOffset + circuit_wire_vertex_count(wire->vertexCount) - 1],
+        flags);
     }
-  }
 
-  for (int netIdx = 0; netIdx < circuit_net_len(&view->circuit); netIdx++) {
-    Net *net = &view->circuit.nets[netIdx];
+    vertexOffset += circuit_wire_vertex_count(wire->vertexCount);
+  }
+}
 
-    bool netIsHovered =
-      view_is_hovered(view, circuit_net_id(&view->circuit, netIdx));
+static void view_draw_waypoint(CircuitView *view, int index) {
+  Waypoint *waypoint = &view->circuit.waypoints[index];
+  WaypointID id = circuit_waypoint_id(&view->circuit, index);
+  DrawFlags flags = 0;
 
-    VertexIndex vertexOffset = net->vertexOffset;
-    assert(vertexOffset < arrlen(view->circuit.vertices));
+  for (int j = 0; j < arrlen(view->selected); j++) {
+    if (view->selected[j] == id) {
+      flags |= DRAW_SELECTED;
+      break;
+    }
+  }
 
-    for (int wireIdx = net->wireOffset;
-         wireIdx < net->wireOffset + net->wireCount; wireIdx++) {
-      assert(wireIdx < arrlen(view->circuit.wires));
-      Wire *wire = &view->circuit.wires[wireIdx];
+  if (view_is_hovered(view, id)) {
+    flags |= DRAW_HOVERED;
+  }
 
-      DrawFlags flags = 0;
-      if (wireIdx == net->wireOffset && view->debugMode) {
-        flags |= DRAW_DEBUG;
-      }
-      if (netIsHovered) {
-        flags |= DRAW_HOVERED;
-      }
+  if ((flags & DRAW_HOVERED) || view_is_hovered(view, waypoint->net)) {
+    draw_waypoint(view->drawCtx, &view->theme, waypoint->position, flags);
+  }
+}
 
-      draw_wire(
-        view->drawCtx, &view->theme, view->circuit.vertices + vertexOffset,
-        circuit_wire_vertex_count(wire->vertexCount), flags);
+static void view_draw_item(CircuitView *view, ID id) {
+  int index = circuit_index(&view->circuit, id);
+  switch (id_type(id)) {
+  case ID_COMPONENT:
+    view_draw_component(view, index);
+    break;
+  case ID_NET:
+    view_draw_net(view, index);
+    break;
+  case ID_WAYPOINT:
+    view_draw_waypoint(view, index);
+    break;
+  default:
+    break;
+  }
+}
 
-      if (circuit_wire_ends_in_junction(wire->vertexCount)) {
-        draw_junction(
-          view->drawCtx, &view->theme,
-          view->circuit.vertices
-            [vertexOffset + circuit_wire_vertex_count(wire->vertexCount) - 1],
-          flags);
-      }
+// the part of the world the window shows, padded for the labels and ports
+// that stick out of the boxes in the index. returns false if it's unknown, or
+// there's no index to cull with.
+static bool view_viewport(CircuitView *view, Box *viewport) {
+  if (
+    !view->bvh || view->bvh->root == BVH_NULL || view->bvh->needsRebuild ||
+    view->screenSize.X <= 0 || view->screenSize.Y <= 0) {
+    return false;
+  }
+  HMM_Vec2 tl = draw_screen_to_world(view->drawCtx, HMM_V2(0, 0));
+  HMM_Vec2 br = draw_screen_to_world(view->drawCtx, view->screenSize);
+  *viewport = box_from_tlbr(tl, br);
+  viewport->halfSize = HMM_AddV2(
+    viewport->halfSize, HMM_V2(VIEW_CULL_PADDING, VIEW_CULL_PADDING));
+  return true;
+}
 
-      vertexOffset += circuit_wire_vertex_count(wire->vertexCount);
+// draws the items of one type the index found in the viewport, along with
+// the ones that changed since it was synced and are in the viewport now
+static uint32_t
+view_draw_visible(CircuitView *view, IDType type, Box viewport) {
+  Circuit *circuit = &view->circuit;
+  uint32_t drawn = 0;
+  for (ptrdiff_t i = 0; i < hmlen(view->unindexed); i++) {
+    ID id = view->unindexed[i].key;
+    if (id_type(id) != type || !circuit_has(circuit, id)) {
+      continue;
+    }
+    int index = circuit_index(circuit, id);
+    bool visible =
+      type == ID_COMPONENT
+        ? box_intersect_box(view->componentBoxes[index], viewport)
+        : box_intersect_point(viewport, circuit->waypoints[index].position);
+    if (visible) {
+      view_draw_item(view, id);
+      drawn++;
     }
   }
-  for (int i = 0; i < circuit_waypoint_len(&view->circuit); i++) {
-    Waypoint *waypoint = &view->circuit.waypoints[i];
-    WaypointID id = circuit_waypoint_id(&view->circuit, i);
-    DrawFlags flags = 0;
 
-    for (int j = 0; j < arrlen(view->selected); j++) {
-      if (view->selected[j] == id) {
-        flags |= DRAW_SELECTED;
-        break;
-      }
+  for (int i = 0; i < arrlen(view->drawHits); i++) {
+    ID id = view->drawHits[i];
+    if (
+      id_type(id) != type || !circuit_has(circuit, id) ||
+      hmgeti(view->unindexed, id) >= 0) {
+      continue;
     }
+    view_draw_item(view, id);
+    drawn++;
+  }
+  return drawn;
+}
 
-    if (view_is_hovered(view, id)) {
-      flags |= DRAW_HOVERED;
+void view_draw(CircuitView *view) {
+  if (
+    view->selectionBox.halfSize.X > 0.001f &&
+    view->selectionBox.halfSize.Y > 0.001f) {
+    draw_selection_box(view->drawCtx, &view->theme, view->selectionBox, 0);
+  }
+
+  Circuit *circuit = &view->circuit;
+  uint32_t total = circuit_component_len(circuit) + circuit_net_len(circuit) +
+                   circuit_waypoint_len(circuit);
+
+  Box viewport;
+  if (!view_viewport(view, &viewport)) {
+    for (int i = 0; i < circuit_component_len(circuit); i++) {
+      view_draw_component(view, i);
+    }
+    for (int i = 0; i < circuit_net_len(circuit); i++) {
+      view_draw_net(view, i);
+    }
+    for (int i = 0; i < circuit_waypoint_len(circuit); i++) {
+      view_draw_waypoint(view, i);
     }
+    view->drawStats.drawn = total;
+    view->drawStats.culled = 0;
+    return;
+  }
+
+  arrsetlen(view->drawHits, 0);
+  view->drawHits = bvh_query(view->bvh, viewport, view->drawHits);
 
-    if ((flags & DRAW_HOVERED) || view_is_hovered(view, waypoint->net)) {
-      draw_waypoint(view->drawCtx, &view->theme, waypoint->position, flags);
+  uint32_t drawn = view_draw_visible(view, ID_COMPONENT, viewport);
+  if (view->wiresUnindexed) {
+    for (int i = 0; i < circuit_net_len(circuit); i++) {
+      view_draw_net(view, i);
     }
+    drawn += circuit_net_len(circuit);
+  } else {
+    drawn += view_draw_visible(view, ID_NET, viewport);
   }
+  drawn += view_draw_visible(view, ID_WAYPOINT, viewport);
+
+  view->drawStats.drawn = drawn;
+  view->drawStats.culled = total - drawn;
 }
@@ -36,6 +36,37 @@ typedef struct CircuitView {
   Box selectionBox;
 
   bool debugMode;
+
+  // hot geometry columns, synced with the circuit's components, ports and
+  // endpoints so that scans over all of them read contiguous memory instead
+  // of striding over the cold fields. port positions are in world space.
+  // while the circuit tracks dirty items these are current after a flush.
+  Box *componentBoxes;
+  HMM_Vec2 *portPositions;
+  HMM_Vec2 *endpointPositions;
+
+  // size of the window in pixels. once it's known and there's a spatial index,
+  // view_draw only draws what's in the part of the world the window shows.
+  HMM_Vec2 screenSize;
+
+  // spatial index of the circuit, kept in sync by whoever owns it, who calls
+  // view_index_synced after syncing it. components and waypoints that changed
+  // since then are in unindexed, and all wires are drawn while wiresUnindexed
+  // is set, since routing doesn't say which ones it changed.
+  BVH *bvh;
+  struct {
+    ID key;
+    char value;
+  } *unindexed;
+  bool wiresUnindexed;
+  arr(ID) drawHits;
+
+  // number of components, nets and waypoints the last view_draw drew, and
+  // skipped as being off screen
+  struct {
+    uint32_t drawn;
+    uint32_t culled;
+  } drawStats;
 } CircuitView;
 
 typedef void *Context;
@@ -50,6 +81,7 @@ void view_free(CircuitView *view);
 void view_direct_wire_nets(CircuitView *view);
 
 void view_draw(CircuitView *view);
+void view_index_synced(CircuitView *view);
 
 Box view_label_size(
   CircuitView *view, const char *text, HMM_Vec2 pos, HorizAlign horz,
@@ -0,0 +1,104 @@
+/*
+   Copyright 2024 Ryan "rj45" Sanche
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "core/core.h"
+#include "render/draw.h"
+#include "render/draw_test.h"
+
+#include "handmade_math.h"
+#include "sokol_time.h"
+#include "stb_ds.h"
+#include "utest.h"
+
+#include "view.h"
+
+#ifndef BENCH_COMPONENTS
+#define BENCH_COMPONENTS 100000
+#endif
+#define BENCH_SCANS 100
+
+UTEST(ViewBench, hover_scan) {
+  CircuitView view = {0};
+  DrawContext *draw = draw_create();
+  view_init(&view, circuit_component_descs(), draw, NULL);
+
+  arr(ComponentDescID) descs = NULL;
+  arr(HMM_Vec2) positions = NULL;
+  for (int i = 0; i < BENCH_COMPONENTS; i++) {
+    arrput(descs, COMP_AND + (i % (COMP_COUNT - COMP_AND)));
+    arrput(positions, HMM_V2((i % 1000) * 100.0f, (i / 1000) * 100.0f));
+  }
+  circuit_add_components(
+    &view.circuit, descs, positions, BENCH_COMPONENTS, NULL);
+
+  HMM_Vec2 portHalfSize =
+    HMM_V2(view.theme.portWidth / 2.0f, view.theme.portWidth / 2.0f);
+
+  // sweep a mouse sized box over the circuit like hover testing does, first
+  // the way it used to be done through the component and port structs
+  int aosHits = 0;
+  uint64_t start = stm_now();
+  for (int scan = 0; scan < BENCH_SCANS; scan++) {
+    Box mouseBox = {HMM_V2(scan * 1000.0f, scan * 1000.0f), HMM_V2(5, 5)};
+    for (int i = 0; i < circuit_component_len(&view.circuit); i++) {
+      Component *component = &view.circuit.components[i];
+      if (box_intersect_box(component->box, mouseBox)) {
+        aosHits++;
+      }
+      PortID portID = component->portFirst;
+      while (circuit_has(&view.circuit, portID)) {
+        Port *port = circuit_port_ptr(&view.circuit, portID);
+        Box portBox = {
+          HMM_AddV2(port->position, component->box.center), portHalfSize};
+        if (box_intersect_box(portBox, mouseBox)) {
+          aosHits++;
+        }
+        portID = port->next;
+      }
+    }
+  }
+  double aosMs = stm_ms(stm_since(start)) / BENCH_SCANS;
+
+  // then through the geometry columns
+  int soaHits = 0;
+  start = stm_now();
+  for (int scan = 0; scan < BENCH_SCANS; scan++) {
+    Box mouseBox = {HMM_V2(scan * 1000.0f, scan * 1000.0f), HMM_V2(5, 5)};
+    for (int i = 0; i < circuit_component_len(&view.circuit); i++) {
+      if (box_intersect_box(view.componentBoxes[i], mouseBox)) {
+        soaHits++;
+      }
+    }
+    for (int i = 0; i < circuit_port_len(&view.circuit); i++) {
+      Box portBox = {view.portPositions[i], portHalfSize};
+      if (box_intersect_box(portBox, mouseBox)) {
+        soaHits++;
+      }
+    }
+  }
+  double soaMs = stm_ms(stm_since(start)) / BENCH_SCANS;
+
+  printf(
+    "hover scan of %d components: structs %.3fms, columns %.3fms (%.2fx)\n",
+    BENCH_COMPONENTS, aosMs, soaMs, aosMs / soaMs);
+
+  ASSERT_EQ(aosHits, soaHits);
+
+  arrfree(descs);
+  arrfree(positions);
+  view_free(&view);
+  draw_free(draw);
+}
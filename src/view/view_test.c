@@ -114,4 +114,34 @@ UTEST(View, view_draw_component_with_wires) {
 
   view_free(&view);
   draw_free(draw);
-}
\ No newline at end of file
+}
+
+UTEST(View, geometry_columns) {
+  CircuitView view = {0};
+  DrawContext *draw = draw_create();
+
+  view_init(&view, circuit_component_descs(), draw, NULL);
+  ComponentID and =
+    circuit_add_component(&view.circuit, COMP_AND, HMM_V2(100, 100));
+  circuit_add_component(&view.circuit, COMP_OR, HMM_V2(200, 200));
+  circuit_move_component(&view.circuit, and, HMM_V2(10, 20));
+
+  for (int i = 0; i < circuit_component_len(&view.circuit); i++) {
+    Component *component = &view.circuit.components[i];
+    ASSERT_EQ(view.componentBoxes[i].center.X, component->box.center.X);
+    ASSERT_EQ(view.componentBoxes[i].center.Y, component->box.center.Y);
+    ASSERT_EQ(view.componentBoxes[i].halfSize.X, component->box.halfSize.X);
+    ASSERT_EQ(view.componentBoxes[i].halfSize.Y, component->box.halfSize.Y);
+  }
+  for (int i = 0; i < circuit_port_len(&view.circuit); i++) {
+    Port *port = &view.circuit.ports[i];
+    Component *component =
+      circuit_component_ptr(&view.circuit, port->component);
+    HMM_Vec2 pos = HMM_AddV2(component->box.center, port->position);
+    ASSERT_EQ(view.portPositions[i].X, pos.X);
+    ASSERT_EQ(view.portPositions[i].Y, pos.Y);
+  }
+
+  view_free(&view);
+  draw_free(draw);
+}